@@ -0,0 +1,611 @@
+#include "apu.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "nes.h"
+#include "memory_bus.h"
+
+// CPU cycles from the start of the frame sequence to each of its steps (NTSC).
+// The 4 step sequence raises the IRQ on its last step.
+static const u32 four_step_cycles[4] = { 7457, 14913, 22371, 29829 };
+static const u32 five_step_cycles[5] = { 7457, 14913, 22371, 29829, 37281 };
+
+#define FOUR_STEP_LENGTH 29830
+#define FIVE_STEP_LENGTH 37282
+
+// What each step clocks, envelopes and the linear counter every quarter frame,
+// length counters and sweeps every half frame
+#define QUARTER_FRAME 0x01
+#define HALF_FRAME 0x02
+
+static const u8 four_step_clocks[4] = { QUARTER_FRAME, QUARTER_FRAME | HALF_FRAME, QUARTER_FRAME, QUARTER_FRAME | HALF_FRAME };
+static const u8 five_step_clocks[5] = { QUARTER_FRAME, QUARTER_FRAME | HALF_FRAME, QUARTER_FRAME, 0, QUARTER_FRAME | HALF_FRAME };
+
+static const u8 length_table[32] = {
+	10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+	12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const u8 duty_table[4][8] = {
+	{ 0, 1, 0, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 1, 1, 0, 0, 0 },
+	{ 1, 0, 0, 1, 1, 1, 1, 1 },
+};
+
+static const u8 triangle_table[32] = {
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
+
+// Timer periods in CPU cycles (NTSC)
+static const u16 noise_periods[16] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+static const u16 dmc_periods[16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+
+// Linear approximation of the mixer (https://www.nesdev.org/wiki/APU_Mixer), scaled
+// so every channel at full volume comes close to 32767. Being linear lets every
+// channel add its steps on its own.
+#define PULSE_WEIGHT 263
+#define TRIANGLE_WEIGHT 298
+#define NOISE_WEIGHT 173
+#define DMC_WEIGHT 117
+
+static void apu_restart_sequence(apu* state) {
+	state->frame_step = 0;
+	state->frame_step_cycle = state->cycle + four_step_cycles[0];
+}
+
+void apu_init(nes_system* system) {
+	apu* state = &system->apu;
+	memset(state, 0, sizeof(apu));
+
+	state->noise.shift_register = 1;
+	state->noise.timer_period = noise_periods[0];
+	state->dmc.timer_period = dmc_periods[0];
+	state->dmc.bits_remaining = 8;
+	state->dmc.silence = 1;
+
+	apu_restart_sequence(state);
+	apu_schedule_irqs(system);
+}
+
+void apu_set_output(nes_system* system, audio_ring* output, u32 sample_rate) {
+	apu* state = &system->apu;
+
+	state->output = output;
+	state->sample_rate = sample_rate;
+	if (output == NULL) {
+		return;
+	}
+
+	blip_init(&state->blip, NES_NTSC_CPU_CYCLES_PER_SECOND, sample_rate);
+	state->blip_start_cycle = state->cycle;
+
+	// The buffer starts out silent, the channels step up from there on their next run
+	state->pulse[0].output = 0;
+	state->pulse[1].output = 0;
+	state->triangle.output = 0;
+	state->noise.output = 0;
+	state->dmc.output = 0;
+}
+
+//
+// Frame sequence units
+//
+
+static void apu_clock_envelope(apu_envelope* envelope) {
+	if (envelope->start) {
+		envelope->start = 0;
+		envelope->decay = 15;
+		envelope->divider = envelope->volume;
+	}
+	else if (envelope->divider == 0) {
+		envelope->divider = envelope->volume;
+		if (envelope->decay > 0) {
+			envelope->decay--;
+		}
+		else if (envelope->loop) {
+			envelope->decay = 15;
+		}
+	}
+	else {
+		envelope->divider--;
+	}
+}
+
+static inline u8 apu_envelope_volume(const apu_envelope* envelope) {
+	return envelope->constant_volume ? envelope->volume : envelope->decay;
+}
+
+// Pulse 1 negates with the one's complement, pulse 2 with the two's complement.
+static u16 apu_sweep_target(const apu_pulse* pulse, int channel) {
+	i32 change = pulse->timer_period >> pulse->sweep_shift;
+	if (pulse->sweep_negate) {
+		change = -change - (channel == 0 ? 1 : 0);
+	}
+
+	i32 target = pulse->timer_period + change;
+	return target < 0 ? 0 : (u16)target;
+}
+
+// The sweep silences the channel whether it's enabled or not.
+static inline int apu_pulse_muted(const apu_pulse* pulse, int channel) {
+	return pulse->timer_period < 8 || apu_sweep_target(pulse, channel) > 0x7FF;
+}
+
+static void apu_clock_sweep(apu_pulse* pulse, int channel) {
+	if (pulse->sweep_divider == 0 && pulse->sweep_enabled && pulse->sweep_shift > 0 && !apu_pulse_muted(pulse, channel)) {
+		pulse->timer_period = apu_sweep_target(pulse, channel);
+	}
+
+	if (pulse->sweep_divider == 0 || pulse->sweep_reload) {
+		pulse->sweep_divider = pulse->sweep_period;
+		pulse->sweep_reload = 0;
+	}
+	else {
+		pulse->sweep_divider--;
+	}
+}
+
+static inline void apu_clock_length(u8* length_counter, u8 halt) {
+	if (!halt && *length_counter > 0) {
+		(*length_counter)--;
+	}
+}
+
+static void apu_clock_quarter_frame(apu* state) {
+	apu_clock_envelope(&state->pulse[0].envelope);
+	apu_clock_envelope(&state->pulse[1].envelope);
+	apu_clock_envelope(&state->noise.envelope);
+
+	apu_triangle* triangle = &state->triangle;
+	if (triangle->linear_reload) {
+		triangle->linear_counter = triangle->linear_reload_value;
+	}
+	else if (triangle->linear_counter > 0) {
+		triangle->linear_counter--;
+	}
+	if (!triangle->control) {
+		triangle->linear_reload = 0;
+	}
+}
+
+static void apu_clock_half_frame(apu* state) {
+	apu_clock_length(&state->pulse[0].length_counter, state->pulse[0].envelope.loop);
+	apu_clock_length(&state->pulse[1].length_counter, state->pulse[1].envelope.loop);
+	apu_clock_length(&state->triangle.length_counter, state->triangle.control);
+	apu_clock_length(&state->noise.length_counter, state->noise.envelope.loop);
+
+	apu_clock_sweep(&state->pulse[0], 0);
+	apu_clock_sweep(&state->pulse[1], 1);
+}
+
+static void apu_run_frame_step(nes_system* system) {
+	apu* state = &system->apu;
+	u32 step_count = state->five_step_mode ? 5 : 4;
+	const u32* step_cycles = state->five_step_mode ? five_step_cycles : four_step_cycles;
+	u8 clocks = state->five_step_mode ? five_step_clocks[state->frame_step] : four_step_clocks[state->frame_step];
+	u64 sequence_start = state->frame_step_cycle - step_cycles[state->frame_step];
+
+	if (clocks & QUARTER_FRAME) {
+		apu_clock_quarter_frame(state);
+	}
+	if (clocks & HALF_FRAME) {
+		apu_clock_half_frame(state);
+	}
+
+	if (!state->five_step_mode && state->frame_step == 3 && !state->irq_inhibit) {
+		system->irq_line |= NES_IRQ_APU_FRAME;
+	}
+
+	state->frame_step++;
+	if (state->frame_step == step_count) {
+		state->frame_step = 0;
+		sequence_start += state->five_step_mode ? FIVE_STEP_LENGTH : FOUR_STEP_LENGTH;
+	}
+
+	state->frame_step_cycle = sequence_start + step_cycles[state->frame_step];
+}
+
+//
+// Channels, each runs its timer from state->cycle up to `end` and adds a step
+// to the output whenever its amplitude changes
+//
+
+static inline void apu_output_step(apu* state, u8* output, u8 amplitude, u64 cycle, i32 weight) {
+	if (amplitude != *output) {
+		blip_add_delta(&state->blip, (u32)(cycle - state->blip_start_cycle), ((i32)amplitude - *output) * weight);
+		*output = amplitude;
+	}
+}
+
+// Number of timer clocks from `time` up to `end`, for skipping through spans where the amplitude can't change.
+static inline u64 apu_clocks_until(u64 time, u64 end, u32 period) {
+	return time < end ? (end - time + period - 1) / period : 0;
+}
+
+static void apu_run_pulse(apu* state, int channel, u64 end) {
+	apu_pulse* pulse = &state->pulse[channel];
+	u32 period = (pulse->timer_period + 1) * 2;
+	u64 time = state->cycle + pulse->timer;
+
+	u8 volume = pulse->length_counter > 0 && !apu_pulse_muted(pulse, channel) ? apu_envelope_volume(&pulse->envelope) : 0;
+	const u8* duty = duty_table[pulse->duty];
+
+	// Registers or the frame sequence may have changed the amplitude since the last run
+	apu_output_step(state, &pulse->output, duty[pulse->duty_step] ? volume : 0, state->cycle, PULSE_WEIGHT);
+
+	if (volume == 0) {
+		u64 clocks = apu_clocks_until(time, end, period);
+		pulse->duty_step = (pulse->duty_step + clocks) & 0x07;
+		time += clocks * period;
+	}
+
+	for (; time < end; time += period) {
+		pulse->duty_step = (pulse->duty_step + 1) & 0x07;
+		apu_output_step(state, &pulse->output, duty[pulse->duty_step] ? volume : 0, time, PULSE_WEIGHT);
+	}
+
+	pulse->timer = (u32)(time - end);
+}
+
+static void apu_run_triangle(apu* state, u64 end) {
+	apu_triangle* triangle = &state->triangle;
+	u32 period = triangle->timer_period + 1;
+	u64 time = state->cycle + triangle->timer;
+
+	apu_output_step(state, &triangle->output, triangle_table[triangle->step], state->cycle, TRIANGLE_WEIGHT);
+
+	// Halted it holds its level. Ultrasonic periods are held too, they'd only be heard as a pop
+	if (triangle->length_counter == 0 || triangle->linear_counter == 0 || triangle->timer_period < 2) {
+		time += apu_clocks_until(time, end, period) * period;
+	}
+
+	for (; time < end; time += period) {
+		triangle->step = (triangle->step + 1) & 0x1F;
+		apu_output_step(state, &triangle->output, triangle_table[triangle->step], time, TRIANGLE_WEIGHT);
+	}
+
+	triangle->timer = (u32)(time - end);
+}
+
+static void apu_run_noise(apu* state, u64 end) {
+	apu_noise* noise = &state->noise;
+	u32 period = noise->timer_period;
+	u64 time = state->cycle + noise->timer;
+
+	u8 volume = noise->length_counter > 0 ? apu_envelope_volume(&noise->envelope) : 0;
+	apu_output_step(state, &noise->output, (noise->shift_register & 0x01) ? 0 : volume, state->cycle, NOISE_WEIGHT);
+
+	// Nobody can hear the shift register while it's silent, so it's left where it is
+	if (volume == 0) {
+		time += apu_clocks_until(time, end, period) * period;
+	}
+
+	u32 tap = noise->mode ? 6 : 1;
+	for (; time < end; time += period) {
+		u16 feedback = (noise->shift_register ^ (noise->shift_register >> tap)) & 0x01;
+		noise->shift_register = (noise->shift_register >> 1) | (feedback << 14);
+
+		apu_output_step(state, &noise->output, (noise->shift_register & 0x01) ? 0 : volume, time, NOISE_WEIGHT);
+	}
+
+	noise->timer = (u32)(time - end);
+}
+
+static void apu_dmc_restart(apu_dmc* dmc) {
+	dmc->current_address = dmc->sample_address;
+	dmc->bytes_remaining = dmc->sample_length;
+}
+
+// The memory reader refills the sample buffer as soon as it's empty.
+static void apu_dmc_fill_buffer(nes_system* system) {
+	apu_dmc* dmc = &system->apu.dmc;
+	if (dmc->buffer_full || dmc->bytes_remaining == 0) {
+		return;
+	}
+
+	dmc->sample_buffer = cpubus_read(system, dmc->current_address);
+	dmc->buffer_full = 1;
+	dmc->current_address = dmc->current_address == 0xFFFF ? 0x8000 : dmc->current_address + 1;
+	dmc->bytes_remaining--;
+
+	if (dmc->bytes_remaining == 0) {
+		if (dmc->loop) {
+			apu_dmc_restart(dmc);
+		}
+		else if (dmc->irq_enable) {
+			system->irq_line |= NES_IRQ_DMC;
+		}
+	}
+}
+
+// Runs even without synthesis, the sample's progress shows up in $4015 and its IRQ.
+static void apu_run_dmc(nes_system* system, u64 end, int synthesize) {
+	apu* state = &system->apu;
+	apu_dmc* dmc = &state->dmc;
+	u32 period = dmc->timer_period;
+	u64 time = state->cycle + dmc->timer;
+
+	if (synthesize) {
+		apu_output_step(state, &dmc->output, dmc->level, state->cycle, DMC_WEIGHT);
+	}
+
+	// Nothing left to play, only the bit counter keeps going round
+	if (dmc->silence && !dmc->buffer_full && dmc->bytes_remaining == 0) {
+		u64 clocks = apu_clocks_until(time, end, period);
+		dmc->bits_remaining = (u8)((dmc->bits_remaining + 7 - clocks % 8) % 8 + 1);
+		time += clocks * period;
+	}
+
+	for (; time < end; time += period) {
+		if (!dmc->silence) {
+			if (dmc->shift_register & 0x01) {
+				if (dmc->level <= 125) {
+					dmc->level += 2;
+				}
+			}
+			else if (dmc->level >= 2) {
+				dmc->level -= 2;
+			}
+			dmc->shift_register >>= 1;
+		}
+
+		dmc->bits_remaining--;
+		if (dmc->bits_remaining == 0) {
+			dmc->bits_remaining = 8;
+			dmc->silence = !dmc->buffer_full;
+
+			if (dmc->buffer_full) {
+				dmc->shift_register = dmc->sample_buffer;
+				dmc->buffer_full = 0;
+				apu_dmc_fill_buffer(system);
+			}
+		}
+
+		if (synthesize) {
+			apu_output_step(state, &dmc->output, dmc->level, time, DMC_WEIGHT);
+		}
+	}
+
+	dmc->timer = (u32)(time - end);
+}
+
+static void apu_run_channels(nes_system* system, u64 end) {
+	apu* state = &system->apu;
+	if (end <= state->cycle) {
+		return;
+	}
+
+	int synthesize = state->output != NULL;
+	if (synthesize) {
+		apu_run_pulse(state, 0, end);
+		apu_run_pulse(state, 1, end);
+		apu_run_triangle(state, end);
+		apu_run_noise(state, end);
+	}
+	apu_run_dmc(system, end, synthesize);
+
+	state->cycle = end;
+}
+
+void apu_run(nes_system* system, u64 target_cycle) {
+	apu* state = &system->apu;
+
+	while (state->frame_step_cycle <= target_cycle) {
+		apu_run_channels(system, state->frame_step_cycle);
+		apu_run_frame_step(system);
+	}
+
+	apu_run_channels(system, target_cycle);
+}
+
+//
+// Registers
+//
+
+u8 apu_read_status(nes_system* system) {
+	apu* state = &system->apu;
+
+	u8 value = 0x00;
+	value |= state->pulse[0].length_counter > 0 ? 0x01 : 0x00;
+	value |= state->pulse[1].length_counter > 0 ? 0x02 : 0x00;
+	value |= state->triangle.length_counter > 0 ? 0x04 : 0x00;
+	value |= state->noise.length_counter > 0 ? 0x08 : 0x00;
+	value |= state->dmc.bytes_remaining > 0 ? 0x10 : 0x00;
+	value |= (system->irq_line & NES_IRQ_APU_FRAME) ? 0x40 : 0x00;
+	value |= (system->irq_line & NES_IRQ_DMC) ? 0x80 : 0x00;
+
+	system->irq_line &= ~NES_IRQ_APU_FRAME;
+
+	return value;
+}
+
+static void apu_write_envelope(apu_envelope* envelope, u8 value) {
+	envelope->loop = (value & 0x20) != 0;
+	envelope->constant_volume = (value & 0x10) != 0;
+	envelope->volume = value & 0x0F;
+}
+
+static void apu_write_pulse(apu_pulse* pulse, u16 address, u8 value) {
+	switch (address & 0x03) {
+	case 0:
+		pulse->duty = value >> 6;
+		apu_write_envelope(&pulse->envelope, value);
+		break;
+	case 1:
+		pulse->sweep_enabled = (value & 0x80) != 0;
+		pulse->sweep_period = (value >> 4) & 0x07;
+		pulse->sweep_negate = (value & 0x08) != 0;
+		pulse->sweep_shift = value & 0x07;
+		pulse->sweep_reload = 1;
+		break;
+	case 2:
+		pulse->timer_period = (pulse->timer_period & 0x0700) | value;
+		break;
+	case 3:
+		pulse->timer_period = (pulse->timer_period & 0x00FF) | ((value & 0x07) << 8);
+		if (pulse->enabled) {
+			pulse->length_counter = length_table[value >> 3];
+		}
+		pulse->duty_step = 0;
+		pulse->envelope.start = 1;
+		break;
+	}
+}
+
+void apu_write_register(nes_system* system, u16 address, u8 value) {
+	apu* state = &system->apu;
+
+	switch (address) {
+	case 0x4000: case 0x4001: case 0x4002: case 0x4003:
+		apu_write_pulse(&state->pulse[0], address, value);
+		break;
+	case 0x4004: case 0x4005: case 0x4006: case 0x4007:
+		apu_write_pulse(&state->pulse[1], address, value);
+		break;
+
+	case 0x4008:
+		state->triangle.control = (value & 0x80) != 0;
+		state->triangle.linear_reload_value = value & 0x7F;
+		break;
+	case 0x400A:
+		state->triangle.timer_period = (state->triangle.timer_period & 0x0700) | value;
+		break;
+	case 0x400B:
+		state->triangle.timer_period = (state->triangle.timer_period & 0x00FF) | ((value & 0x07) << 8);
+		if (state->triangle.enabled) {
+			state->triangle.length_counter = length_table[value >> 3];
+		}
+		state->triangle.linear_reload = 1;
+		break;
+
+	case 0x400C:
+		apu_write_envelope(&state->noise.envelope, value);
+		break;
+	case 0x400E:
+		state->noise.mode = (value & 0x80) != 0;
+		state->noise.timer_period = noise_periods[value & 0x0F];
+		break;
+	case 0x400F:
+		if (state->noise.enabled) {
+			state->noise.length_counter = length_table[value >> 3];
+		}
+		state->noise.envelope.start = 1;
+		break;
+
+	case 0x4010:
+		state->dmc.irq_enable = (value & 0x80) != 0;
+		state->dmc.loop = (value & 0x40) != 0;
+		state->dmc.timer_period = dmc_periods[value & 0x0F];
+		if (!state->dmc.irq_enable) {
+			system->irq_line &= ~NES_IRQ_DMC;
+		}
+		break;
+	case 0x4011:
+		state->dmc.level = value & 0x7F;
+		break;
+	case 0x4012:
+		state->dmc.sample_address = 0xC000 | (value << 6);
+		break;
+	case 0x4013:
+		state->dmc.sample_length = (value << 4) | 0x0001;
+		break;
+
+	case 0x4015:
+		state->pulse[0].enabled = (value & 0x01) != 0;
+		state->pulse[1].enabled = (value & 0x02) != 0;
+		state->triangle.enabled = (value & 0x04) != 0;
+		state->noise.enabled = (value & 0x08) != 0;
+		state->dmc.enabled = (value & 0x10) != 0;
+
+		if (!state->pulse[0].enabled) {
+			state->pulse[0].length_counter = 0;
+		}
+		if (!state->pulse[1].enabled) {
+			state->pulse[1].length_counter = 0;
+		}
+		if (!state->triangle.enabled) {
+			state->triangle.length_counter = 0;
+		}
+		if (!state->noise.enabled) {
+			state->noise.length_counter = 0;
+		}
+
+		system->irq_line &= ~NES_IRQ_DMC;
+		if (!state->dmc.enabled) {
+			state->dmc.bytes_remaining = 0;
+		}
+		else if (state->dmc.bytes_remaining == 0) {
+			apu_dmc_restart(&state->dmc);
+			apu_dmc_fill_buffer(system);
+		}
+		break;
+
+	case 0x4017:
+		state->five_step_mode = (value & 0x80) != 0;
+		state->irq_inhibit = (value & 0x40) != 0;
+		if (state->irq_inhibit) {
+			system->irq_line &= ~NES_IRQ_APU_FRAME;
+		}
+
+		apu_restart_sequence(state);
+
+		// The 5 step sequence clocks everything straight away
+		if (state->five_step_mode) {
+			apu_clock_quarter_frame(state);
+			apu_clock_half_frame(state);
+		}
+		break;
+
+	default:
+		return;
+	}
+
+	apu_schedule_irqs(system);
+}
+
+void apu_schedule_irqs(nes_system* system) {
+	const apu* state = &system->apu;
+
+	if (state->five_step_mode || state->irq_inhibit) {
+		scheduler_cancel(system, EVENT_APU_FRAME_IRQ);
+	}
+	else {
+		u64 sequence_start = state->frame_step_cycle - four_step_cycles[state->frame_step];
+		u64 irq_cycle = sequence_start + four_step_cycles[3];
+		scheduler_schedule(system, EVENT_APU_FRAME_IRQ, irq_cycle * SCHEDULER_TICKS_PER_CPU_CYCLE);
+	}
+
+	// The buffer is refilled right after the output unit empties it, which happens
+	// after `bits_remaining` more clocks and then every 8. The last byte raises the
+	// IRQ, a run only covers that clock once it goes past it.
+	const apu_dmc* dmc = &state->dmc;
+	if (!dmc->irq_enable || dmc->loop || dmc->bytes_remaining == 0) {
+		scheduler_cancel(system, EVENT_APU_DMC_IRQ);
+	}
+	else {
+		u64 next_clock = state->cycle + dmc->timer;
+		u64 irq_cycle = next_clock + (u64)(dmc->bits_remaining - 1 + (dmc->bytes_remaining - 1) * 8) * dmc->timer_period + 1;
+		scheduler_schedule(system, EVENT_APU_DMC_IRQ, irq_cycle * SCHEDULER_TICKS_PER_CPU_CYCLE);
+	}
+}
+
+void apu_end_frame(nes_system* system) {
+	apu* state = &system->apu;
+	if (state->output == NULL) {
+		return;
+	}
+
+	apu_run(system, system->cpu.total_cycles);
+	blip_end_frame(&state->blip, (u32)(state->cycle - state->blip_start_cycle));
+	state->blip_start_cycle = state->cycle;
+
+	// Whatever doesn't fit into the ring is dropped, the emulation never waits for audio
+	i16 samples[512];
+	u32 count;
+	while ((count = blip_read_samples(&state->blip, samples, 512)) > 0) {
+		audio_ring_write(state->output, samples, count);
+	}
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "types.h"
+#include "blip.h"
+#include "audio_ring.h"
+
+typedef struct nes_system nes_system;
+
+typedef struct apu_envelope {
+	u8 start;
+	u8 loop;
+	u8 constant_volume;
+	// Constant volume or the divider period
+	u8 volume;
+	u8 divider;
+	u8 decay;
+} apu_envelope;
+
+typedef struct apu_pulse {
+	u8 enabled;
+	u8 duty;
+	u8 duty_step;
+	u8 length_counter;
+	apu_envelope envelope;
+
+	u8 sweep_enabled;
+	u8 sweep_period;
+	u8 sweep_negate;
+	u8 sweep_shift;
+	u8 sweep_reload;
+	u8 sweep_divider;
+
+	u16 timer_period;
+	// CPU cycles left until the timer next clocks the sequencer
+	u32 timer;
+
+	// Amplitude the synthesis last saw, changes are added to the output as steps
+	u8 output;
+} apu_pulse;
+
+typedef struct apu_triangle {
+	u8 enabled;
+	u8 control;
+	u8 length_counter;
+	u8 linear_counter;
+	u8 linear_reload_value;
+	u8 linear_reload;
+	u8 step;
+
+	u16 timer_period;
+	u32 timer;
+	u8 output;
+} apu_triangle;
+
+typedef struct apu_noise {
+	u8 enabled;
+	u8 mode;
+	u8 length_counter;
+	apu_envelope envelope;
+	u16 shift_register;
+
+	u16 timer_period;
+	u32 timer;
+	u8 output;
+} apu_noise;
+
+typedef struct apu_dmc {
+	u8 enabled;
+	u8 irq_enable;
+	u8 loop;
+	u16 timer_period;
+	u32 timer;
+
+	// $4012/$4013 and where the memory reader is in the sample
+	u16 sample_address;
+	u16 sample_length;
+	u16 current_address;
+	u16 bytes_remaining;
+
+	u8 sample_buffer;
+	u8 buffer_full;
+
+	// Output unit
+	u8 shift_register;
+	u8 bits_remaining;
+	u8 silence;
+	u8 level;
+
+	u8 output;
+} apu_dmc;
+
+typedef struct apu {
+	apu_pulse pulse[2];
+	apu_triangle triangle;
+	apu_noise noise;
+	apu_dmc dmc;
+
+	// $4017 frame counter
+	u8 five_step_mode;
+	u8 irq_inhibit;
+
+	// Next step of the frame sequence and the CPU cycle it happens on
+	u8 frame_step;
+	u64 frame_step_cycle;
+
+	// CPU cycles run since power on
+	u64 cycle;
+
+	// Samples go here once a frame, without one only what the CPU can see
+	// through $4015 and the IRQs is run and synthesis is skipped entirely
+	audio_ring* output;
+	u32 sample_rate;
+	blip_buffer blip;
+	// CPU cycle blip time 0 corresponds to
+	u64 blip_start_cycle;
+} apu;
+
+void apu_init(nes_system* system);
+
+// Starts sending samples at `sample_rate` to `output`, NULL stops it again.
+void apu_set_output(nes_system* system, audio_ring* output, u32 sample_rate);
+
+// $4015, reading it acknowledges the frame IRQ. The IRQs themselves are
+// NES_IRQ_APU_FRAME and NES_IRQ_DMC on the system's IRQ line.
+u8 apu_read_status(nes_system* system);
+void apu_write_register(nes_system* system, u16 address, u8 value);
+
+// Runs the APU until `target_cycle` CPU cycles have passed since power on.
+void apu_run(nes_system* system, u64 target_cycle);
+
+// Queues EVENT_APU_FRAME_IRQ and EVENT_APU_DMC_IRQ for the next time the frame
+// sequence or the end of a DMC sample raises its IRQ.
+void apu_schedule_irqs(nes_system* system);
+
+// Finishes the samples up to the CPU's current cycle and hands them to the output.
+void apu_end_frame(nes_system* system);
@@ -0,0 +1,40 @@
+#include "audio_ring.h"
+
+#include "thread.h"
+
+void audio_ring_init(audio_ring* ring) {
+	ring->write_position = 0;
+	ring->read_position = 0;
+}
+
+u32 audio_ring_write(audio_ring* ring, const i16* samples, u32 count) {
+	u32 write_position = ring->write_position;
+	u32 free_space = AUDIO_RING_SIZE - (write_position - atomic_load_acquire(&ring->read_position));
+	if (count > free_space) {
+		count = free_space;
+	}
+
+	for (u32 i = 0; i < count; i++) {
+		ring->samples[(write_position + i) & (AUDIO_RING_SIZE - 1)] = samples[i];
+	}
+
+	// Publishes the samples, the reader only looks at them after seeing the new position
+	atomic_store_release(&ring->write_position, write_position + count);
+	return count;
+}
+
+u32 audio_ring_read(audio_ring* ring, i16* samples, u32 count) {
+	u32 read_position = ring->read_position;
+	u32 available = atomic_load_acquire(&ring->write_position) - read_position;
+	if (count > available) {
+		count = available;
+	}
+
+	for (u32 i = 0; i < count; i++) {
+		samples[i] = ring->samples[(read_position + i) & (AUDIO_RING_SIZE - 1)];
+	}
+
+	// Hands the space back to the writer once the samples are copied out
+	atomic_store_release(&ring->read_position, read_position + count);
+	return count;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "types.h"
+
+// Samples on their way from the emulation thread to the audio callback. Exactly
+// one thread writes and one reads, so neither ever waits on the other: a full
+// ring drops what doesn't fit and an empty one reads nothing.
+
+// Must be a power of two
+#define AUDIO_RING_SIZE 8192
+
+typedef struct audio_ring {
+	i16 samples[AUDIO_RING_SIZE];
+
+	// Both only ever count up and wrap, each is written by one side only
+	volatile u32 write_position;
+	volatile u32 read_position;
+} audio_ring;
+
+void audio_ring_init(audio_ring* ring);
+
+// Returns how many samples were written.
+u32 audio_ring_write(audio_ring* ring, const i16* samples, u32 count);
+// Returns how many samples were read.
+u32 audio_ring_read(audio_ring* ring, i16* samples, u32 count);
@@ -0,0 +1,380 @@
+#include "batch.h"
+
+#include <cjson/cJSON.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+#include "controller.h"
+#include "crc32.h"
+#include "thread.h"
+#include "rom_cache.h"
+
+// Controller 1 buttons that are held from `frame` until the next entry.
+typedef struct input_entry {
+	u32 frame;
+	u8 buttons;
+} input_entry;
+
+typedef enum batch_job_status {
+	// Zeroed jobs start out like this, it stays if no worker got to the job
+	JOB_NOT_RUN,
+	JOB_DONE,
+	JOB_INVALID_ENTRY,
+	JOB_INPUT_FAILED,
+	JOB_ROM_FAILED,
+} batch_job_status;
+
+typedef struct batch_job {
+	char* rom_path;
+	char* input_path;
+	u32 frames;
+	// Held for the whole batch so every job running the rom shares one mapping
+	rom_image* rom;
+
+	// Results
+	batch_job_status status;
+	u64 cycles;
+	u32 ram_crc32;
+	double seconds;
+} batch_job;
+
+// Jobs a worker owns. The owner takes from the bottom and idle workers steal
+// from the top, so a worker stuck on a long job doesn't hold up the jobs behind it.
+typedef struct job_queue {
+	batch_job** jobs;
+	u32 top;
+	u32 bottom;
+	mutex lock;
+} job_queue;
+
+typedef struct batch_worker {
+	u32 index;
+	u32 worker_count;
+	job_queue* queues;
+} batch_worker;
+
+static char* string_copy(const char* string) {
+	u64 length = strlen(string);
+	char* copy = malloc(length + 1);
+	memcpy(copy, string, length + 1);
+
+	return copy;
+}
+
+static double seconds_since(const struct timespec* start) {
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+
+	return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Input scripts are text files with one "<frame> <buttons...>" entry per line,
+// for example "120 start" or "300 right a". Entries must be in frame order and
+// lines starting with '#' are comments.
+static input_entry* input_script_load(const char* path, u32* entry_count) {
+	*entry_count = 0;
+
+	FILE* file = fopen(path, "r");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	u32 capacity = 64;
+	input_entry* entries = malloc(capacity * sizeof(input_entry));
+
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		char* token = strtok(line, " \t\r\n");
+		if (token == NULL || token[0] == '#') {
+			continue;
+		}
+
+		input_entry entry;
+		entry.frame = strtoul(token, NULL, 10);
+		entry.buttons = 0;
+
+		while ((token = strtok(NULL, " \t\r\n")) != NULL) {
+			entry.buttons |= controller_button_from_name(token);
+		}
+
+		if (*entry_count == capacity) {
+			capacity *= 2;
+			entries = realloc(entries, capacity * sizeof(input_entry));
+		}
+		entries[(*entry_count)++] = entry;
+	}
+
+	fclose(file);
+	return entries;
+}
+
+static void batch_run_job(batch_job* job) {
+	struct timespec start;
+	timespec_get(&start, TIME_UTC);
+
+	u32 entry_count = 0;
+	input_entry* entries = NULL;
+	if (job->input_path != NULL) {
+		entries = input_script_load(job->input_path, &entry_count);
+		if (entries == NULL) {
+			job->status = JOB_INPUT_FAILED;
+			return;
+		}
+	}
+
+	nes_system* system = malloc(sizeof(nes_system));
+	if (nes_init(system, job->rom_path) != 0) {
+		free(system);
+		free(entries);
+		job->status = JOB_ROM_FAILED;
+		return;
+	}
+
+	u32 next_entry = 0;
+	for (u32 frame = 0; frame < job->frames; frame++) {
+		while (next_entry < entry_count && entries[next_entry].frame <= frame) {
+			controller_set_buttons(system, 0, entries[next_entry].buttons);
+			next_entry++;
+		}
+
+		nes_run_frame(system);
+	}
+
+	job->status = JOB_DONE;
+	job->cycles = system->cpu.total_cycles;
+	job->ram_crc32 = crc32(system->cpu_memory, sizeof(system->cpu_memory));
+	job->seconds = seconds_since(&start);
+
+	nes_free(system);
+	free(system);
+	free(entries);
+}
+
+static batch_job* job_queue_pop(job_queue* queue) {
+	batch_job* job = NULL;
+
+	mutex_lock(&queue->lock);
+	if (queue->bottom > queue->top) {
+		queue->bottom--;
+		job = queue->jobs[queue->bottom];
+	}
+	mutex_unlock(&queue->lock);
+
+	return job;
+}
+
+static batch_job* job_queue_steal(job_queue* queue) {
+	batch_job* job = NULL;
+
+	mutex_lock(&queue->lock);
+	if (queue->bottom > queue->top) {
+		job = queue->jobs[queue->top];
+		queue->top++;
+	}
+	mutex_unlock(&queue->lock);
+
+	return job;
+}
+
+static int batch_worker_run(void* argument) {
+	batch_worker* worker = argument;
+
+	while (1) {
+		batch_job* job = job_queue_pop(&worker->queues[worker->index]);
+
+		// No jobs are added once the batch starts, so if every queue is empty we're done
+		for (u32 i = 1; job == NULL && i < worker->worker_count; i++) {
+			job = job_queue_steal(&worker->queues[(worker->index + i) % worker->worker_count]);
+		}
+
+		if (job == NULL) {
+			return 0;
+		}
+
+		batch_run_job(job);
+	}
+}
+
+static batch_job* batch_load_manifest(const char* manifest_path, u32* job_count) {
+	*job_count = 0;
+
+	FILE* file = fopen(manifest_path, "r");
+	if (file == NULL) {
+		printf("Couldn't open manifest '%s'.\n", manifest_path);
+		return NULL;
+	}
+
+	fseek(file, 0, SEEK_END);
+	u64 length = ftell(file);
+	rewind(file);
+
+	char* contents = malloc(length + 1);
+	length = fread(contents, 1, length, file);
+	contents[length] = '\0';
+	fclose(file);
+
+	cJSON* root = cJSON_Parse(contents);
+	free(contents);
+
+	cJSON* jobs_obj = cJSON_GetObjectItemCaseSensitive(root, "jobs");
+	if (!cJSON_IsArray(jobs_obj)) {
+		printf("Manifest '%s' needs a \"jobs\" array.\n", manifest_path);
+		cJSON_Delete(root);
+		return NULL;
+	}
+
+	u32 count = cJSON_GetArraySize(jobs_obj);
+	batch_job* jobs = calloc(count, sizeof(batch_job));
+
+	for (u32 i = 0; i < count; i++) {
+		cJSON* job_obj = cJSON_GetArrayItem(jobs_obj, i);
+		cJSON* rom_obj = cJSON_GetObjectItemCaseSensitive(job_obj, "rom");
+		cJSON* input_obj = cJSON_GetObjectItemCaseSensitive(job_obj, "input");
+		cJSON* frames_obj = cJSON_GetObjectItemCaseSensitive(job_obj, "frames");
+
+		if (!cJSON_IsString(rom_obj)) {
+			printf("Job %u in the manifest has no \"rom\".\n", i);
+			jobs[i].status = JOB_INVALID_ENTRY;
+			continue;
+		}
+
+		// valueint saturates and wraps into a huge u32, so the number itself is checked
+		if (frames_obj != NULL && (!cJSON_IsNumber(frames_obj) || frames_obj->valuedouble < 0 ||
+			frames_obj->valuedouble > UINT32_MAX || frames_obj->valuedouble != (double)(u32)frames_obj->valuedouble)) {
+			printf("Job %u in the manifest needs \"frames\" to be a whole number of at least 0.\n", i);
+			jobs[i].status = JOB_INVALID_ENTRY;
+			continue;
+		}
+
+		jobs[i].rom_path = string_copy(rom_obj->valuestring);
+		jobs[i].input_path = cJSON_IsString(input_obj) ? string_copy(input_obj->valuestring) : NULL;
+		jobs[i].frames = frames_obj != NULL ? (u32)frames_obj->valuedouble : 60;
+	}
+
+	cJSON_Delete(root);
+
+	*job_count = count;
+	return jobs;
+}
+
+int batch_run(const char* manifest_path, u32 thread_count) {
+	u32 job_count = 0;
+	batch_job* jobs = batch_load_manifest(manifest_path, &job_count);
+	if (jobs == NULL) {
+		return -1;
+	}
+
+	if (thread_count == 0) {
+		thread_count = thread_hardware_concurrency();
+	}
+	if (thread_count > job_count && job_count > 0) {
+		thread_count = job_count;
+	}
+
+	// Deal the jobs out round robin, workers steal from each other once they run dry
+	job_queue* queues = calloc(thread_count, sizeof(job_queue));
+	for (u32 i = 0; i < thread_count; i++) {
+		queues[i].jobs = malloc((job_count / thread_count + 1) * sizeof(batch_job*));
+		mutex_init(&queues[i].lock);
+	}
+
+	for (u32 i = 0; i < job_count; i++) {
+		if (jobs[i].rom_path != NULL) {
+			jobs[i].rom = rom_cache_load(jobs[i].rom_path);
+
+			job_queue* queue = &queues[i % thread_count];
+			queue->jobs[queue->bottom++] = &jobs[i];
+		}
+	}
+
+	printf("Running %u jobs on %u threads.\n", job_count, thread_count);
+
+	struct timespec start;
+	timespec_get(&start, TIME_UTC);
+
+	thread* threads = malloc(thread_count * sizeof(thread));
+	batch_worker* workers = malloc(thread_count * sizeof(batch_worker));
+	u8* started = malloc(thread_count);
+	for (u32 i = 0; i < thread_count; i++) {
+		workers[i].index = i;
+		workers[i].worker_count = thread_count;
+		workers[i].queues = queues;
+
+		started[i] = thread_create(&threads[i], batch_worker_run, &workers[i]) == 0;
+	}
+
+	// A worker that couldn't be started runs here instead, otherwise its queue
+	// would only be emptied if another worker happened to steal all of it
+	for (u32 i = 0; i < thread_count; i++) {
+		if (!started[i]) {
+			printf("Couldn't start worker thread %u, running its jobs on the main thread.\n", i);
+			batch_worker_run(&workers[i]);
+		}
+	}
+
+	for (u32 i = 0; i < thread_count; i++) {
+		if (started[i]) {
+			thread_join(&threads[i]);
+		}
+	}
+
+	double total_seconds = seconds_since(&start);
+
+	int return_code = 0;
+	u64 total_frames = 0;
+
+	printf("\n%-5s %-8s %-14s %-10s %-9s %s\n", "Job", "Frames", "Cycles", "RAM CRC32", "Seconds", "ROM");
+	for (u32 i = 0; i < job_count; i++) {
+		batch_job* job = &jobs[i];
+
+		if (job->status == JOB_INVALID_ENTRY) {
+			printf("%-5u invalid manifest entry jobs[%u], see above\n", i, i);
+			return_code = -1;
+		}
+		else if (job->status == JOB_INPUT_FAILED) {
+			printf("%-5u failed to load input script '%s'\n", i, job->input_path);
+			return_code = -1;
+		}
+		else if (job->status == JOB_ROM_FAILED) {
+			printf("%-5u failed to load rom '%s'\n", i, job->rom_path);
+			return_code = -1;
+		}
+		else if (job->status == JOB_NOT_RUN) {
+			printf("%-5u not run\n", i);
+			return_code = -1;
+		}
+		else {
+			printf(
+				"%-5u %-8u %-14llu %08X   %-9.3f %s\n",
+				i, job->frames, job->cycles, job->ram_crc32, job->seconds, job->rom_path
+			);
+			total_frames += job->frames;
+		}
+
+		rom_image_release(job->rom);
+		free(job->rom_path);
+		free(job->input_path);
+	}
+
+	printf(
+		"\nFinished in %.3f seconds, %.1f frames/second across all jobs.\n",
+		total_seconds, (double)total_frames / total_seconds
+	);
+
+	for (u32 i = 0; i < thread_count; i++) {
+		mutex_destroy(&queues[i].lock);
+		free(queues[i].jobs);
+	}
+	free(queues);
+	free(workers);
+	free(threads);
+	free(started);
+	free(jobs);
+
+	return return_code;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "types.h"
+
+// Runs every job in the manifest on a pool of `thread_count` worker threads,
+// each job with its own nes_system. A thread count of 0 uses every core.
+//
+// {
+//     "jobs": [
+//         { "rom": "path/to/rom.nes", "input": "path/to/input.txt", "frames": 3600 }
+//     ]
+// }
+int batch_run(const char* manifest_path, u32 thread_count);
@@ -0,0 +1,128 @@
+#include "blip.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "thread.h"
+
+#define BLIP_PI 3.14159265358979323846
+
+// Steps are stored 15 bits up so the kernel's fractions survive
+#define BLIP_DELTA_BITS 15
+// How fast the integrator leaks back to 0, removes the DC offset of the channels
+#define BLIP_BASS_SHIFT 9
+
+// Windowed sinc for every phase a step can start at, each phase sums to 1 << BLIP_DELTA_BITS.
+// Systems can be created on several threads at once, the first one builds it
+// under the lock and the flag is only set once it's complete.
+static i16 blip_kernel[BLIP_PHASE_COUNT][BLIP_KERNEL_SIZE];
+static volatile u32 blip_kernel_ready = 0;
+static mutex blip_kernel_lock = MUTEX_INITIALIZER;
+
+static void blip_build_kernel() {
+	// A bit under Nyquist so the window's transition band stays below it
+	const double cutoff = 0.9;
+
+	for (u32 phase = 0; phase < BLIP_PHASE_COUNT; phase++) {
+		double taps[BLIP_KERNEL_SIZE];
+		double sum = 0.0;
+
+		for (u32 i = 0; i < BLIP_KERNEL_SIZE; i++) {
+			double t = (double)i - (BLIP_KERNEL_SIZE / 2 - 1) - (double)phase / BLIP_PHASE_COUNT;
+			double x = t / (BLIP_KERNEL_SIZE / 2);
+
+			double sinc = t == 0.0 ? 1.0 : sin(BLIP_PI * cutoff * t) / (BLIP_PI * cutoff * t);
+			double window = fabs(x) >= 1.0 ? 0.0 : 0.42 + 0.5 * cos(BLIP_PI * x) + 0.08 * cos(2.0 * BLIP_PI * x);
+
+			taps[i] = sinc * window;
+			sum += taps[i];
+		}
+
+		// Rounding error goes into the middle tap so the phase sums exactly
+		i32 total = 0;
+		for (u32 i = 0; i < BLIP_KERNEL_SIZE; i++) {
+			blip_kernel[phase][i] = (i16)lround(taps[i] / sum * (1 << BLIP_DELTA_BITS));
+			total += blip_kernel[phase][i];
+		}
+		blip_kernel[phase][BLIP_KERNEL_SIZE / 2] += (1 << BLIP_DELTA_BITS) - total;
+	}
+}
+
+void blip_init(blip_buffer* buffer, double clock_rate, double sample_rate) {
+	if (!atomic_load_acquire(&blip_kernel_ready)) {
+		mutex_lock(&blip_kernel_lock);
+		if (!blip_kernel_ready) {
+			blip_build_kernel();
+			atomic_store_release(&blip_kernel_ready, 1);
+		}
+		mutex_unlock(&blip_kernel_lock);
+	}
+
+	buffer->factor = (u64)(sample_rate / clock_rate * 4294967296.0);
+	blip_clear(buffer);
+}
+
+void blip_clear(blip_buffer* buffer) {
+	buffer->offset = 0;
+	buffer->available = 0;
+	buffer->integrator = 0;
+	memset(buffer->deltas, 0, sizeof(buffer->deltas));
+}
+
+void blip_add_delta(blip_buffer* buffer, u32 clock_time, i32 delta) {
+	u64 position = (u64)clock_time * buffer->factor + buffer->offset;
+	u32 index = buffer->available + (u32)(position >> 32);
+	u32 phase = (u32)(position >> (32 - BLIP_PHASE_BITS)) & (BLIP_PHASE_COUNT - 1);
+
+	// Too far ahead, the frame is longer than the buffer
+	if (index > BLIP_BUFFER_SIZE) {
+		return;
+	}
+
+	i32* out = &buffer->deltas[index];
+	const i16* kernel = blip_kernel[phase];
+	for (u32 i = 0; i < BLIP_KERNEL_SIZE; i++) {
+		out[i] += kernel[i] * delta;
+	}
+}
+
+void blip_end_frame(blip_buffer* buffer, u32 clock_duration) {
+	u64 position = (u64)clock_duration * buffer->factor + buffer->offset;
+
+	buffer->available += (u32)(position >> 32);
+	if (buffer->available > BLIP_BUFFER_SIZE) {
+		buffer->available = BLIP_BUFFER_SIZE;
+	}
+	buffer->offset = position & 0xFFFFFFFF;
+}
+
+u32 blip_read_samples(blip_buffer* buffer, i16* out, u32 count) {
+	if (count > buffer->available) {
+		count = buffer->available;
+	}
+
+	i64 integrator = buffer->integrator;
+	for (u32 i = 0; i < count; i++) {
+		integrator += buffer->deltas[i];
+
+		i64 sample = integrator >> BLIP_DELTA_BITS;
+		if (sample < -32768) {
+			sample = -32768;
+		}
+		else if (sample > 32767) {
+			sample = 32767;
+		}
+		out[i] = (i16)sample;
+
+		integrator -= sample << (BLIP_DELTA_BITS - BLIP_BASS_SHIFT);
+	}
+	buffer->integrator = integrator;
+
+	// Move what's left, including the kernel tails past the end, to the front
+	u32 remaining = buffer->available - count;
+	memmove(buffer->deltas, &buffer->deltas[count], (remaining + BLIP_KERNEL_SIZE) * sizeof(i32));
+	memset(&buffer->deltas[remaining + BLIP_KERNEL_SIZE], 0, count * sizeof(i32));
+	buffer->available = remaining;
+
+	return count;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "types.h"
+
+// Band-limited step synthesis. Instead of sampling the channels every clock, each
+// change in amplitude is added as a step that's already low-pass filtered for
+// the output rate, so nothing above Nyquist aliases back into the audible range.
+
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASE_COUNT (1 << BLIP_PHASE_BITS)
+#define BLIP_KERNEL_SIZE 16
+// Enough for a bit more than two frames at 96kHz
+#define BLIP_BUFFER_SIZE 4096
+
+typedef struct blip_buffer {
+	// Output samples per input clock and where clock 0 of the current frame lands, both 32.32 fixed point
+	u64 factor;
+	u64 offset;
+
+	// Samples finished by blip_end_frame that haven't been read yet
+	u32 available;
+	i64 integrator;
+
+	i32 deltas[BLIP_BUFFER_SIZE + BLIP_KERNEL_SIZE];
+} blip_buffer;
+
+void blip_init(blip_buffer* buffer, double clock_rate, double sample_rate);
+void blip_clear(blip_buffer* buffer);
+
+// Adds a step of `delta` at `clock_time` clocks into the current frame.
+void blip_add_delta(blip_buffer* buffer, u32 clock_time, i32 delta);
+// Ends the current frame after `clock_duration` clocks, its samples become available.
+void blip_end_frame(blip_buffer* buffer, u32 clock_duration);
+
+// Reads up to `count` samples, returns how many were read.
+u32 blip_read_samples(blip_buffer* buffer, i16* out, u32 count);
@@ -4,95 +4,498 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "nes.h"
 #include "mapper.h"
+#include "memory_bus.h"
+#include "crc32.h"
+#include "rom_database.h"
+#include "file.h"
 
-// iNES ROM Header
-typedef struct rom_header {
-	char name[4];
-	u8 prg_rom_size;
-	u8 chr_rom_size;
-
-	union flags6 {
-		struct {
-			u8 nametable_arrangement : 1;
-			u8 persistent_memory : 1;
-			u8 trainer : 1;
-			u8 alternative_nametable_layout : 1;
-			u8 mapper_lower : 4;
-		};
-		u8 as_byte;
-	} flags6;
-
-	union flags7 {
-		struct {
-			u8 vs_unisystem : 1;
-			u8 playchoice_10 : 1;
-			u8 nes_2 : 2;
-			u8 mapper_upper : 4;
-		};
-		u8 as_byte;
-	} flags7;
-
-	u8 prg_ram_size;
-	u8 tv_system;
-
-	u8 unused[6];
-} rom_header;
-
-u8 mapper;
-u8* prg_ram = NULL;
-u8* prg_rom = NULL;
-u8* chr_rom = NULL;
-rom_header header;
-
-int cartridge_init(const char* rom_path) {
-	FILE* file = fopen(rom_path, "rb");
-	if (file == NULL) {
-		return -1;
+// NES 2.0 ROM sizes over 4095 units are given as 2^E * (M * 2 + 1) bytes.
+static u64 cartridge_rom_size(u8 size, u8 size_msb, u32 unit) {
+	if (size_msb == 0x0F) {
+		return ((u64)1 << (size >> 2)) * ((size & 0x03) * 2 + 1);
+	}
+
+	return (u64)((size_msb << 8) | size) * unit;
+}
+
+static u32 cartridge_ram_size(u8 shift) {
+	return shift != 0 ? 64 << shift : 0;
+}
+
+static void cartridge_parse_header(const rom_header* header, rom_info* info, u64* prg_rom_length, u64* chr_rom_length) {
+	memset(info, 0, sizeof(rom_info));
+	info->battery = header->flags6.persistent_memory;
+	info->vertical_mirroring = header->flags6.nametable_arrangement;
+
+	if (header->flags7.nes_2 == 2) {
+		info->nes_2 = 1;
+		info->mapper = (header->flags8.mapper_msb << 8) | (header->flags7.mapper_upper << 4) | header->flags6.mapper_lower;
+		info->submapper = header->flags8.submapper;
+		info->timing = header->timing & 0x03;
+
+		*prg_rom_length = cartridge_rom_size(header->prg_rom_size, header->flags9.prg_rom_size_msb, 16 * 1024);
+		*chr_rom_length = cartridge_rom_size(header->chr_rom_size, header->flags9.chr_rom_size_msb, 8 * 1024);
+
+		info->prg_ram_length = cartridge_ram_size(header->flags10.prg_ram_shift);
+		info->prg_nvram_length = cartridge_ram_size(header->flags10.prg_nvram_shift);
+		info->chr_ram_length = cartridge_ram_size(header->flags11.chr_ram_shift);
+		info->chr_nvram_length = cartridge_ram_size(header->flags11.chr_nvram_shift);
+		return;
 	}
 
-	fread(&header, sizeof(rom_header), 1, file);
+	// Old dumping tools left text in bytes 7-15 ("DiskDude!"), when bytes 12-15
+	// aren't zero only the lower mapper nibble can be trusted
+	int clean = header->timing == 0 && header->console_type == 0 && header->misc_roms == 0 && header->expansion_device == 0;
+	info->mapper = header->flags6.mapper_lower;
+	if (clean) {
+		info->mapper |= header->flags7.mapper_upper << 4;
+	}
+	info->timing = (clean && (header->flags9.tv_system & 0x01)) ? ROM_TIMING_PAL : ROM_TIMING_NTSC;
+
+	*prg_rom_length = header->prg_rom_size * (16 * 1024);
+	*chr_rom_length = header->chr_rom_size * (8 * 1024);
+
+	// iNES can't tell how much RAM there is, every cart gets 8KB and CHR RAM if it has no CHR ROM
+	u32 prg_ram_length = (clean && header->flags8.prg_ram_size != 0 ? header->flags8.prg_ram_size : 1) * (8 * 1024);
+	if (info->battery) {
+		info->prg_nvram_length = prg_ram_length;
+	}
+	else {
+		info->prg_ram_length = prg_ram_length;
+	}
+	info->chr_ram_length = header->chr_rom_size == 0 ? 8 * 1024 : 0;
+}
+
+static void cartridge_apply_database(rom_info* info) {
+	const rom_database_entry* entry = rom_database_find(info->crc32);
+	if (entry == NULL) {
+		return;
+	}
 
+	info->from_database = 1;
+	info->mapper = entry->mapper;
+	info->submapper = entry->submapper;
+	info->timing = entry->timing;
+	info->vertical_mirroring = entry->vertical_mirroring;
+	info->prg_ram_length = cartridge_ram_size(entry->prg_ram_shift);
+	info->prg_nvram_length = cartridge_ram_size(entry->prg_nvram_shift);
+	info->chr_ram_length = cartridge_ram_size(entry->chr_ram_shift);
+	info->chr_nvram_length = cartridge_ram_size(entry->chr_nvram_shift);
+	info->battery = entry->prg_nvram_shift != 0 || entry->chr_nvram_shift != 0;
+}
+
+// RAM is allocated in whole bus pages and mirrored when it's smaller than what the mapper maps.
+static u32 cartridge_round_up(u32 length, u32 page_size) {
+	return length == 0 ? 0 : (length + page_size - 1) & ~(page_size - 1);
+}
+
+// Reads the header of a mapped rom and looks it up in the database, returns -1
+// if it isn't a rom or the file is too short for it.
+static int cartridge_parse(const rom_image* rom, rom_header* header, rom_info* info, u64* prg_rom_offset) {
 	const unsigned char expected[4] = { 'N', 'E', 'S', 0x1A };
-	if (memcmp(header.name, expected, 4) != 0) {
+	if (rom->length < sizeof(rom_header) || memcmp(rom->data, expected, 4) != 0) {
 		printf("ROM Header is incorrect.\n");
-		fclose(file);
 		return -1;
 	}
 
-	if (header.flags6.trainer == 1) {
-		fseek(file, 512, SEEK_CUR);
+	memcpy(header, rom->data, sizeof(rom_header));
+
+	*prg_rom_offset = sizeof(rom_header);
+	if (header->flags6.trainer == 1) {
+		*prg_rom_offset += 512;
+	}
+
+	u64 prg_rom_length = 0;
+	u64 chr_rom_length = 0;
+	cartridge_parse_header(header, info, &prg_rom_length, &chr_rom_length);
+
+	if (prg_rom_length == 0) {
+		printf("ROM has no PRG ROM.\n");
+		return -1;
+	}
+	// The banks are mapped in whole bus pages
+	if ((prg_rom_length & 0xFF) != 0 || (chr_rom_length & 0x3FF) != 0) {
+		printf("ROM sizes aren't whole 256 byte PRG or 1KB CHR pages.\n");
+		return -1;
+	}
+	if (rom->length < *prg_rom_offset + prg_rom_length + chr_rom_length) {
+		printf("ROM is shorter than its header says.\n");
+		return -1;
+	}
+
+	info->prg_rom_length = (u32)prg_rom_length;
+	info->chr_rom_length = (u32)chr_rom_length;
+	info->crc32 = crc32(rom->data + *prg_rom_offset, prg_rom_length + chr_rom_length);
+	cartridge_apply_database(info);
+
+	if (info->prg_ram_length + info->prg_nvram_length > CARTRIDGE_MAX_PRG_RAM ||
+		info->chr_ram_length + info->chr_nvram_length > CARTRIDGE_MAX_CHR_RAM) {
+		printf("ROM asks for more than %uKB PRG RAM or %uKB CHR RAM.\n", CARTRIDGE_MAX_PRG_RAM / 1024, CARTRIDGE_MAX_CHR_RAM / 1024);
+		return -1;
+	}
+
+	return 0;
+}
+
+int cartridge_read_info(const char* rom_path, rom_info* info) {
+	rom_image* rom = rom_cache_load(rom_path);
+	if (rom == NULL) {
+		return -1;
 	}
 
-	mapper = (header.flags6.mapper_lower & 0x0F) | ((header.flags7.mapper_upper & 0xF0));
+	rom_header header;
+	u64 prg_rom_offset = 0;
+	int status = cartridge_parse(rom, &header, info, &prg_rom_offset);
 
-	if (mapper == 0) {
-		prg_rom = malloc(header.prg_rom_size * (16 * 1024));
-		chr_rom = malloc(header.chr_rom_size * (8 * 1024));
-		prg_ram = malloc(8 * 1024);
+	rom_image_release(rom);
+	return status;
+}
+
+int cartridge_init(nes_system* system, const char* rom_path) {
+	cartridge* cart = &system->cartridge;
 
-		fread(prg_rom, header.prg_rom_size * (16 * 1024), 1, file);
-		fread(chr_rom, header.chr_rom_size * (8 * 1024), 1, file);
+	cart->rom = rom_cache_load(rom_path);
+	if (cart->rom == NULL) {
+		return -1;
+	}
+
+	u64 prg_rom_offset = 0;
+	if (cartridge_parse(cart->rom, &cart->header, &cart->info, &prg_rom_offset) != 0) {
+		cartridge_free(system);
+		return -1;
+	}
+
+	rom_info* info = &cart->info;
+	const rom_image* rom = cart->rom;
+
+	cart->mapper_functions = mapper_find(info->mapper);
+	if (cart->mapper_functions == NULL) {
+		printf("Mapper %u isn't supported.\n", info->mapper);
+		cartridge_free(system);
+		return -1;
+	}
+
+	// The banks are mapped straight from the rom image, nothing is copied
+	cart->prg_rom_length = info->prg_rom_length;
+	cart->chr_rom_length = info->chr_rom_length;
+	cart->prg_rom = (u8*)rom->data + prg_rom_offset;
+	if (cart->chr_rom_length > 0) {
+		cart->chr_rom = (u8*)rom->data + prg_rom_offset + cart->prg_rom_length;
 	}
 	else {
-		fclose(file);
+		cart->chr_ram_length = cartridge_round_up(info->chr_ram_length + info->chr_nvram_length, 0x400);
+	}
+	cart->prg_ram_length = cartridge_round_up(info->prg_ram_length + info->prg_nvram_length, 0x100);
+
+	if (cart->chr_ram_length > 0) {
+		cart->chr_ram_block = shared_memory_create(cart->chr_ram_length);
+		cart->chr_ram = cart->chr_ram_block->data;
+		memset(cart->chr_ram, 0, cart->chr_ram_length);
+	}
+	if (cart->prg_ram_length > 0) {
+		cart->prg_ram_block = shared_memory_create(cart->prg_ram_length);
+		cart->prg_ram = cart->prg_ram_block->data;
+		memset(cart->prg_ram, 0, cart->prg_ram_length);
+	}
+
+	memset(&cart->mapper_state, 0, sizeof(mapper_state));
+	cart->mapper_functions->init(system);
+
+	return 0;
+}
+
+void cartridge_free(nes_system* system) {
+	cartridge* cart = &system->cartridge;
+
+	if (cart->save_file != NULL) {
+		file_flush(cart->save_file, cart->save_file_length, 1);
+		file_unmap(cart->save_file, cart->save_file_length);
+	}
+
+	rom_image_release(cart->rom);
+	shared_memory_release(cart->chr_ram_block);
+	shared_memory_release(cart->prg_ram_block);
+	shared_memory_release(cart->prg_ram_cow.snapshot);
+	shared_memory_release(cart->chr_ram_cow.snapshot);
+
+	cart->rom = NULL;
+	cart->save_file = NULL;
+	cart->chr_ram_block = NULL;
+	cart->prg_ram_block = NULL;
+	cart->prg_ram_cow.snapshot = NULL;
+	cart->chr_ram_cow.snapshot = NULL;
+
+	cart->prg_rom = NULL;
+	cart->chr_rom = NULL;
+	cart->chr_ram = NULL;
+	cart->prg_ram = NULL;
+}
+
+//
+// Copy-on-write RAM for forked systems. Pages of RAM that's still shared read
+// from the snapshot and have their write pointer held back, which the bus
+// tracks in cpu_cow_pages/ppu_cow_pages. The first write copies the page.
+//
+
+// Moves every page table entry that reads from [from, from + length) over to
+// the same offset in `to`. With `release_writes` the held back writes go there too.
+static void cartridge_cow_repoint(nes_system* system, const u8* from, u32 length, u8* to, int release_writes) {
+	for (u32 page = 0; page < 256; page++) {
+		u8* read = system->cpu_read_pages[page];
+		if (read >= from && read < from + length) {
+			system->cpu_read_pages[page] = to + (read - from);
+
+			if (release_writes && bus_cow_page(system->cpu_cow_pages, page)) {
+				system->cpu_write_pages[page] = system->cpu_read_pages[page];
+				bus_set_cow_page(system->cpu_cow_pages, page, 0);
+			}
+		}
+	}
+
+	for (u32 page = 0; page < 16; page++) {
+		u8* read = system->ppu_read_pages[page];
+		if (read >= from && read < from + length) {
+			system->ppu_read_pages[page] = to + (read - from);
+
+			if (release_writes && bus_cow_page(system->ppu_cow_pages, page)) {
+				system->ppu_write_pages[page] = system->ppu_read_pages[page];
+				bus_set_cow_page(system->ppu_cow_pages, page, 0);
+			}
+		}
+	}
+}
+
+// Moves every page table entry, read and write, from [from, from + length) to `to`.
+static void cartridge_move_pages(nes_system* system, const u8* from, u32 length, u8* to) {
+	u8** tables[4] = { system->cpu_read_pages, system->cpu_write_pages, system->ppu_read_pages, system->ppu_write_pages };
+	u32 page_counts[4] = { 256, 256, 16, 16 };
+
+	for (u32 table = 0; table < 4; table++) {
+		for (u32 page = 0; page < page_counts[table]; page++) {
+			u8* memory = tables[table][page];
+			if (memory >= from && memory < from + length) {
+				tables[table][page] = to + (memory - from);
+			}
+		}
+	}
+}
+
+// Holds back writes to every page that writes into [memory, memory + length).
+static void cartridge_cow_hold_writes(nes_system* system, const u8* memory, u32 length) {
+	for (u32 page = 0; page < 256; page++) {
+		u8* write = system->cpu_write_pages[page];
+		if (write >= memory && write < memory + length) {
+			system->cpu_write_pages[page] = NULL;
+			bus_set_cow_page(system->cpu_cow_pages, page, 1);
+		}
+	}
+
+	for (u32 page = 0; page < 16; page++) {
+		u8* write = system->ppu_write_pages[page];
+		if (write >= memory && write < memory + length) {
+			system->ppu_write_pages[page] = NULL;
+			bus_set_cow_page(system->ppu_cow_pages, page, 1);
+		}
+	}
+}
+
+static void cartridge_cow_copy_page(nes_system* system, cartridge_cow* cow, u8* memory, u32 page) {
+	u32 offset = page * cow->page_size;
+	memcpy(memory + offset, cow->snapshot->data + offset, cow->page_size);
+	cow->page_copied[page] = 1;
+	cow->pages_left--;
+
+	cartridge_cow_repoint(system, cow->snapshot->data + offset, cow->page_size, memory + offset, 1);
+
+	if (cow->pages_left == 0) {
+		shared_memory_release(cow->snapshot);
+		cow->snapshot = NULL;
+	}
+}
+
+static int cartridge_freeze(nes_system* system, cartridge_cow* cow, shared_memory** block, u8** memory, u32 page_size) {
+	shared_memory* own = *block;
+	if (own == NULL) {
+		return 0;
+	}
+
+	shared_memory* fresh = shared_memory_create(own->length);
+	if (fresh == NULL) {
 		return -1;
 	}
 
-	fclose(file);
+	// The new snapshot has to be complete, so whatever still reads from the last one is copied over first
+	if (cow->snapshot != NULL) {
+		for (u32 page = 0; page < own->length / cow->page_size; page++) {
+			if (!cow->page_copied[page]) {
+				memcpy(own->data + page * cow->page_size, cow->snapshot->data + page * cow->page_size, cow->page_size);
+			}
+		}
+
+		cartridge_cow_repoint(system, cow->snapshot->data, own->length, own->data, 0);
+		shared_memory_release(cow->snapshot);
+	}
+
+	cow->snapshot = own;
+	cow->page_size = page_size;
+	cow->pages_left = own->length / page_size;
+	memset(cow->page_copied, 0, sizeof(cow->page_copied));
+	cartridge_cow_hold_writes(system, own->data, own->length);
+
+	*block = fresh;
+	*memory = fresh->data;
 	return 0;
 }
 
-u8 cartridge_read(u16 address) {
-	if (mapper == 0) {
-		return mapper0_read(address, prg_ram, prg_rom, header.prg_rom_size);
+int cartridge_freeze_ram(nes_system* system) {
+	cartridge* cart = &system->cartridge;
+
+	if (cartridge_freeze(system, &cart->prg_ram_cow, &cart->prg_ram_block, &cart->prg_ram, 0x100) != 0 ||
+		cartridge_freeze(system, &cart->chr_ram_cow, &cart->chr_ram_block, &cart->chr_ram, 0x400) != 0) {
+		return -1;
 	}
-	
-	return 0x00;
+
+	return 0;
 }
 
-void cartridge_write(u16 address, u8 value) {
-	if (mapper == 0) {
-		mapper0_write(address, value, prg_ram);
+int cartridge_attach_save(nes_system* system, const char* save_path) {
+	cartridge* cart = &system->cartridge;
+
+	// RAM that's frozen for a fork can't move anymore
+	if (cart->prg_ram_block == NULL || cart->prg_ram_cow.snapshot != NULL) {
+		return -1;
+	}
+
+	// A save from another emulator can have a header or another size, resizing it would ruin it
+	u64 save_length = 0;
+	u64 modified_time = 0;
+	u64 file_id = 0;
+	if (file_stat(save_path, &save_length, &modified_time, &file_id) == 0 && save_length != 0 && save_length != cart->prg_ram_length) {
+		printf(
+			"Save file '%s' is %llu bytes but the cart has %u bytes of PRG RAM, it's left as it is and not used.\n",
+			save_path, (unsigned long long)save_length, cart->prg_ram_length
+		);
+		return -1;
 	}
+
+	u8* save_file = file_map_writable(save_path, cart->prg_ram_length);
+	if (save_file == NULL) {
+		printf("Couldn't open save file '%s'.\n", save_path);
+		return -1;
+	}
+
+	cartridge_move_pages(system, cart->prg_ram, cart->prg_ram_length, save_file);
+	shared_memory_release(cart->prg_ram_block);
+	cart->prg_ram_block = NULL;
+	cart->prg_ram = save_file;
+	cart->save_file = save_file;
+	cart->save_file_length = cart->prg_ram_length;
+
+	return 0;
+}
+
+void cartridge_flush_save(nes_system* system) {
+	cartridge* cart = &system->cartridge;
+
+	if (cart->save_file != NULL) {
+		file_flush(cart->save_file, cart->save_file_length, 0);
+	}
+}
+
+int cartridge_share(nes_system* system) {
+	cartridge* cart = &system->cartridge;
+
+	// The save file stays the parent's, the copy starts from what's in it. The
+	// parent's RAM wasn't frozen then, so the copy is already the child's own
+	int prg_ram_copied = cart->save_file != NULL;
+	if (cart->save_file != NULL) {
+		cart->prg_ram_block = shared_memory_create(cart->prg_ram_length);
+		if (cart->prg_ram_block == NULL) {
+			return -1;
+		}
+
+		memcpy(cart->prg_ram_block->data, cart->save_file, cart->prg_ram_length);
+		cartridge_move_pages(system, cart->save_file, cart->prg_ram_length, cart->prg_ram_block->data);
+		cart->prg_ram = cart->prg_ram_block->data;
+		cart->save_file = NULL;
+		cart->save_file_length = 0;
+	}
+
+	if (cart->rom != NULL) {
+		rom_image_retain(cart->rom);
+	}
+
+	shared_memory** shared[2] = { &cart->prg_ram_cow.snapshot, &cart->chr_ram_cow.snapshot };
+	for (u32 i = 0; i < 2; i++) {
+		if (*shared[i] != NULL) {
+			shared_memory_retain(*shared[i]);
+		}
+	}
+
+	// Nothing has been copied yet, so the RAM's contents don't matter
+	int status = 0;
+	if (cart->prg_ram_block != NULL && !prg_ram_copied) {
+		cart->prg_ram_block = shared_memory_create(cart->prg_ram_length);
+		cart->prg_ram = cart->prg_ram_block != NULL ? cart->prg_ram_block->data : NULL;
+		status |= cart->prg_ram_block == NULL ? -1 : 0;
+	}
+	if (cart->chr_ram_block != NULL) {
+		cart->chr_ram_block = shared_memory_create(cart->chr_ram_length);
+		cart->chr_ram = cart->chr_ram_block != NULL ? cart->chr_ram_block->data : NULL;
+		status |= cart->chr_ram_block == NULL ? -1 : 0;
+	}
+
+	return status;
+}
+
+int cartridge_cow_redirect(const nes_system* system, u8** read_memory, u8** write_memory) {
+	const cartridge* cart = &system->cartridge;
+
+	const cartridge_cow* cows[2] = { &cart->prg_ram_cow, &cart->chr_ram_cow };
+	const u8* memories[2] = { cart->prg_ram, cart->chr_ram };
+	for (u32 i = 0; i < 2; i++) {
+		const cartridge_cow* cow = cows[i];
+		if (cow->snapshot == NULL || *read_memory < memories[i] || *read_memory >= memories[i] + cow->snapshot->length) {
+			continue;
+		}
+
+		u32 offset = (u32)(*read_memory - memories[i]);
+		if (cow->page_copied[offset / cow->page_size]) {
+			return 0;
+		}
+
+		*read_memory = cow->snapshot->data + offset;
+		if (*write_memory != NULL) {
+			*write_memory = NULL;
+			return 1;
+		}
+		return 0;
+	}
+
+	return 0;
+}
+
+void cartridge_cow_write(nes_system* system, u8* page, u32 offset, u8 value) {
+	cartridge* cart = &system->cartridge;
+
+	cartridge_cow* cow = &cart->prg_ram_cow;
+	u8* memory = cart->prg_ram;
+	if (!shared_memory_contains(cow->snapshot, page)) {
+		cow = &cart->chr_ram_cow;
+		memory = cart->chr_ram;
+	}
+
+	u32 location = (u32)(page - cow->snapshot->data) + offset;
+	cartridge_cow_copy_page(system, cow, memory, location / cow->page_size);
+	memory[location] = value;
+}
+
+u8 cartridge_read(nes_system* system, u16 address) {
+	return system->cartridge.mapper_functions->read(system, address);
+}
+
+void cartridge_write(nes_system* system, u16 address, u8 value) {
+	system->cartridge.mapper_functions->write(system, address, value);
 }
\ No newline at end of file
@@ -1,8 +1,190 @@
 #pragma once
 
 #include "types.h"
+#include "shared_memory.h"
+#include "rom_cache.h"
+#include "mapper.h"
 
-int cartridge_init(const char* rom_path);
+typedef struct nes_system nes_system;
 
-u8 cartridge_read(u16 address);
-void cartridge_write(u16 address, u8 value);
\ No newline at end of file
+// iNES ROM Header, NES 2.0 headers have flags7.nes_2 set to 2 and use bytes 8-15 too
+typedef struct rom_header {
+	char name[4];
+	u8 prg_rom_size;
+	u8 chr_rom_size;
+
+	union flags6 {
+		struct {
+			u8 nametable_arrangement : 1;
+			u8 persistent_memory : 1;
+			u8 trainer : 1;
+			u8 alternative_nametable_layout : 1;
+			u8 mapper_lower : 4;
+		};
+		u8 as_byte;
+	} flags6;
+
+	union flags7 {
+		struct {
+			u8 vs_unisystem : 1;
+			u8 playchoice_10 : 1;
+			u8 nes_2 : 2;
+			u8 mapper_upper : 4;
+		};
+		u8 as_byte;
+	} flags7;
+
+	// iNES: PRG RAM size in 8KB units. NES 2.0: mapper bits 8-11 and the submapper
+	union flags8 {
+		struct {
+			u8 mapper_msb : 4;
+			u8 submapper : 4;
+		};
+		u8 prg_ram_size;
+	} flags8;
+
+	// iNES: bit 0 set for PAL. NES 2.0: bits 8-11 of the PRG and CHR ROM sizes
+	union flags9 {
+		struct {
+			u8 prg_rom_size_msb : 4;
+			u8 chr_rom_size_msb : 4;
+		};
+		u8 tv_system;
+	} flags9;
+
+	// NES 2.0 only from here on. RAM sizes are 64 << shift bytes, 0 for none
+	union flags10 {
+		struct {
+			u8 prg_ram_shift : 4;
+			u8 prg_nvram_shift : 4;
+		};
+		u8 as_byte;
+	} flags10;
+
+	union flags11 {
+		struct {
+			u8 chr_ram_shift : 4;
+			u8 chr_nvram_shift : 4;
+		};
+		u8 as_byte;
+	} flags11;
+
+	// Bits 0-1, a rom_timing
+	u8 timing;
+	u8 console_type;
+	u8 misc_roms;
+	u8 expansion_device;
+} rom_header;
+
+typedef enum rom_timing {
+	ROM_TIMING_NTSC,
+	ROM_TIMING_PAL,
+	ROM_TIMING_MULTI_REGION,
+	ROM_TIMING_DENDY,
+} rom_timing;
+
+// The cart as the header describes it, or as the rom database does when it
+// knows the rom (see rom_database.h).
+typedef struct rom_info {
+	u16 mapper;
+	u8 submapper;
+	u8 timing;
+	u8 nes_2;
+	u8 from_database;
+	u8 battery;
+	u8 vertical_mirroring;
+
+	u32 prg_rom_length;
+	u32 chr_rom_length;
+	// Volatile and battery backed RAM, in bytes
+	u32 prg_ram_length;
+	u32 prg_nvram_length;
+	u32 chr_ram_length;
+	u32 chr_nvram_length;
+
+	// Of the PRG and CHR ROM together, what the database is keyed by
+	u32 crc32;
+} rom_info;
+
+// Most RAM a cart can have, so a fork can keep track of every page it copied.
+// That's 256 pages on both buses, far more than any board has.
+#define CARTRIDGE_MAX_PRG_RAM (256 * 0x100)
+#define CARTRIDGE_MAX_CHR_RAM (256 * 0x400)
+
+// Cartridge RAM right after a fork. Its pages keep reading from the snapshot
+// taken at the fork and are only copied into the system's own memory once
+// written, see nes_fork.
+typedef struct cartridge_cow {
+	// NULL once every page has been copied
+	shared_memory* snapshot;
+	// Size of the bus pages the RAM is mapped with, the CPU's for PRG RAM and the PPU's for CHR RAM
+	u32 page_size;
+	u32 pages_left;
+	// One per bus page, CARTRIDGE_MAX_PRG_RAM and CARTRIDGE_MAX_CHR_RAM keep the RAM within it
+	u8 page_copied[256];
+} cartridge_cow;
+
+typedef struct cartridge {
+	rom_header header;
+	rom_info info;
+	const mapper_interface* mapper_functions;
+	mapper_state mapper_state;
+
+	u8* prg_ram;
+	// PRG and CHR ROM point into the read-only rom image, writing them crashes
+	u8* prg_rom;
+	u8* chr_rom;
+	u8* chr_ram; // Only for carts without CHR ROM
+
+	// Sizes of the above in bytes, 0 for what the cart doesn't have
+	u32 prg_ram_length;
+	u32 prg_rom_length;
+	u32 chr_rom_length;
+	u32 chr_ram_length;
+
+	// What the memory above lives in. The rom image is shared by every system
+	// running the same rom, forks included
+	rom_image* rom;
+	shared_memory* prg_ram_block;
+	shared_memory* chr_ram_block;
+
+	cartridge_cow prg_ram_cow;
+	cartridge_cow chr_ram_cow;
+
+	// Battery backed PRG RAM can be a mapping of a save file instead, prg_ram
+	// then points into it and prg_ram_block is NULL. See cartridge_attach_save
+	u8* save_file;
+	u32 save_file_length;
+} cartridge;
+
+int cartridge_init(nes_system* system, const char* rom_path);
+// What the header and the rom database say about a rom without loading it, so
+// it works for unsupported mappers too. Returns 0 on success.
+int cartridge_read_info(const char* rom_path, rom_info* info);
+
+// Keeps the cart's PRG RAM in the file at `save_path` (a .sav), which is created
+// if it doesn't exist yet and loaded if it does. Everything the game writes goes
+// straight into the mapped file, so saves survive the process dying. Call it
+// right after loading, before the system is forked. Forks get a copy of the RAM
+// instead of the file. Returns 0 on success.
+int cartridge_attach_save(nes_system* system, const char* save_path);
+// Starts writing the save out to disk, it's also flushed when the system is freed.
+void cartridge_flush_save(nes_system* system);
+void cartridge_free(nes_system* system);
+
+// Fork support, see nes_fork. Freezing turns the system's RAM into a snapshot
+// its pages read from until they're written. Sharing is done on the copy of a
+// frozen system, it takes references to the ROM and snapshots and gives the
+// copy RAM of its own. Both return 0 on success.
+int cartridge_freeze_ram(nes_system* system);
+int cartridge_share(nes_system* system);
+
+// Points a page being mapped into RAM that's still shared with a fork at the
+// snapshot instead. Returns 1 if writes to the page have to be held back.
+int cartridge_cow_redirect(const nes_system* system, u8** read_memory, u8** write_memory);
+// Copies the page a held back write went to and does the write, `page` is the
+// page's read pointer on either bus.
+void cartridge_cow_write(nes_system* system, u8* page, u32 offset, u8 value);
+
+u8 cartridge_read(nes_system* system, u16 address);
+void cartridge_write(nes_system* system, u16 address, u8 value);
\ No newline at end of file
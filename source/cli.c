@@ -0,0 +1,458 @@
+#include "cli.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+#include "memory_bus.h"
+#include "cpu.h"
+#include "batch.h"
+#include "single_step.h"
+#include "crc32.h"
+#include "trace.h"
+#include "save_state.h"
+
+static int run_cpu_benchmark(u64 cycle_count);
+static int run_frame_benchmark(u32 frame_count, char** rom_paths, int rom_count);
+static int run_rom_info(const char* rom_path);
+static int run_trace(u32 frame_count, const char* rom_path, const char* trace_path);
+static int run_fork_test(u32 frame_count, const char* rom_path, const char* save_path);
+static int run_save_state_test(u32 frame_count, const char* rom_path);
+
+int cli_is_command(int argc, char* argv[]) {
+	return argc >= 2 && strncmp(argv[1], "--", 2) == 0;
+}
+
+int cli_run(int argc, char* argv[]) {
+	if (strcmp(argv[1], "--single-step-test") == 0 && argc >= 3) {
+		return single_step_run_file(argv[2]);
+	}
+	else if (strcmp(argv[1], "--single-step-suite") == 0 && argc >= 3) {
+		u32 thread_count = 0;
+		if (argc >= 5 && strcmp(argv[3], "--threads") == 0) {
+			thread_count = strtoul(argv[4], NULL, 10);
+		}
+
+		return single_step_run_suite(argv[2], thread_count);
+	}
+	else if (strcmp(argv[1], "--compile-tests") == 0 && argc >= 4) {
+		return single_step_compile(argv[2], argv[3]);
+	}
+	else if (strcmp(argv[1], "--batch") == 0 && argc >= 3) {
+		u32 thread_count = 0;
+		if (argc >= 5 && strcmp(argv[3], "--threads") == 0) {
+			thread_count = strtoul(argv[4], NULL, 10);
+		}
+
+		return batch_run(argv[2], thread_count);
+	}
+	else if (strcmp(argv[1], "--cpu-benchmark") == 0) {
+		u64 cycle_count = 300000000;
+		if (argc >= 3) {
+			cycle_count = strtoull(argv[2], NULL, 10);
+		}
+
+		return run_cpu_benchmark(cycle_count);
+	}
+	else if (strcmp(argv[1], "--frame-benchmark") == 0 && argc >= 4) {
+		return run_frame_benchmark(strtoul(argv[2], NULL, 10), &argv[3], argc - 3);
+	}
+	else if (strcmp(argv[1], "--rom-info") == 0 && argc >= 3) {
+		return run_rom_info(argv[2]);
+	}
+	else if (strcmp(argv[1], "--trace") == 0 && argc >= 5) {
+		return run_trace(strtoul(argv[2], NULL, 10), argv[3], argv[4]);
+	}
+	else if (strcmp(argv[1], "--render-trace") == 0 && argc >= 3) {
+		return trace_render(argv[2], stdout);
+	}
+	else if (strcmp(argv[1], "--fork-test") == 0 && argc >= 4) {
+		return run_fork_test(strtoul(argv[2], NULL, 10), argv[3], argc >= 5 ? argv[4] : NULL);
+	}
+	else if (strcmp(argv[1], "--save-state-test") == 0 && argc >= 4) {
+		return run_save_state_test(strtoul(argv[2], NULL, 10), argv[3]);
+	}
+	else if (strcmp(argv[1], "--trace-format-test") == 0) {
+		return trace_check_format();
+	}
+	else {
+		printf("Unknown command or missing arguments '%s'.\n", argv[1]);
+		cli_print_usage(argv[0]);
+		return -1;
+	}
+}
+
+void cli_print_usage(const char* program) {
+	printf("%s --single-step-test <path/to/test.json>\n", program);
+	printf("%s --single-step-suite <path/to/tests> [--threads <count>]\n", program);
+	printf("%s --compile-tests <path/to/test.json> <path/to/test.bin>\n", program);
+	printf("%s --batch <path/to/manifest.json> [--threads <count>]\n", program);
+	printf("%s --cpu-benchmark [cycle count]\n", program);
+	printf("%s --frame-benchmark <frame count> <path/to/rom.nes>...\n", program);
+	printf("%s --rom-info <path/to/rom.nes>\n", program);
+	printf("%s --trace <frame count> <path/to/rom.nes> <path/to/out.trace>\n", program);
+	printf("%s --render-trace <path/to/in.trace>\n", program);
+	printf("%s --trace-format-test\n", program);
+	printf("%s --fork-test <frame count> <path/to/rom.nes> [path/to/save.sav]\n", program);
+	printf("%s --save-state-test <frame count> <path/to/rom.nes>\n", program);
+}
+
+static int run_cpu_benchmark(u64 cycle_count) {
+	// Small program looping over the common addressing modes, it runs in
+	// test mode so no rom is needed and every build runs the same code.
+	static const u8 program[] = {
+		0xA2, 0x00,       // $8000 LDX #$00
+		0xBD, 0x00, 0x02, // $8002 LDA $0200,X
+		0x18,             // $8005 CLC
+		0x69, 0x01,       // $8006 ADC #$01
+		0x9D, 0x00, 0x03, // $8008 STA $0300,X
+		0xE8,             // $800B INX
+		0xD0, 0xF4,       // $800C BNE $8002
+		0x20, 0x17, 0x80, // $800E JSR $8017
+		0xE6, 0x10,       // $8011 INC $10
+		0x4C, 0x00, 0x80, // $8013 JMP $8000
+		0xEA,             // $8016 NOP
+		0xA0, 0x08,       // $8017 LDY #$08
+		0x06, 0x11,       // $8019 ASL $11
+		0x6A,             // $801B ROR A
+		0x88,             // $801C DEY
+		0xD0, 0xFA,       // $801D BNE $8019
+		0x60              // $801F RTS
+	};
+
+	u8* memory = malloc(0x10000);
+	nes_system* system = malloc(sizeof(nes_system));
+	nes_init_testmode(system, memory);
+
+	for (u16 i = 0; i < sizeof(program); i++) {
+		memory[0x8000 + i] = program[i];
+	}
+	memory[0xFFFC] = 0x00;
+	memory[0xFFFD] = 0x80;
+
+	// Once stepping one instruction per call, then as a single batch.
+	for (int batched = 0; batched <= 1; batched++) {
+		cpu cpu_state;
+		cpu_init(&cpu_state, system);
+
+		struct timespec start, end;
+		timespec_get(&start, TIME_UTC);
+
+		if (batched) {
+			cpu_run_cycles(&cpu_state, cycle_count);
+		}
+		else {
+			while (cpu_state.total_cycles < cycle_count) {
+				cpu_execute_instruction(&cpu_state);
+			}
+		}
+
+		timespec_get(&end, TIME_UTC);
+
+		double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+		double cycles_per_second = (double)cpu_state.total_cycles / seconds;
+		printf(
+			"%s: %llu cycles in %.3f seconds, %.2f million cycles/second (%.1fx realtime).\n",
+			batched ? "cpu_run_cycles" : "cpu_execute_instruction",
+			cpu_state.total_cycles, seconds, cycles_per_second / 1e6, cycles_per_second / NES_NTSC_CPU_CYCLES_PER_SECOND
+		);
+	}
+
+	free(system);
+	free(memory);
+	return 0;
+}
+
+static int run_frame_benchmark(u32 frame_count, char** rom_paths, int rom_count) {
+	nes_system* system = malloc(sizeof(nes_system));
+	int return_code = 0;
+
+	printf("%-8s %-9s %-10s %-9s %-11s %s\n", "Frames", "Seconds", "FPS", "Realtime", "Frame CRC32", "ROM");
+
+	for (int i = 0; i < rom_count; i++) {
+		if (nes_init(system, rom_paths[i]) != 0) {
+			printf("Error loading rom '%s'.\n", rom_paths[i]);
+			return_code = -1;
+			continue;
+		}
+
+		struct timespec start, end;
+		timespec_get(&start, TIME_UTC);
+
+		for (u32 frame = 0; frame < frame_count; frame++) {
+			nes_run_frame(system);
+		}
+
+		timespec_get(&end, TIME_UTC);
+
+		// The CRC of the last frame makes it easy to spot a raster effect changing between builds
+		double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+		double frames_per_second = (double)frame_count / seconds;
+		printf(
+			"%-8u %-9.3f %-10.1f %-9.1f %08X    %s\n",
+			frame_count, seconds, frames_per_second, frames_per_second / 60.0988,
+			crc32(system->ppu.framebuffer, sizeof(system->ppu.framebuffer)), rom_paths[i]
+		);
+
+		nes_free(system);
+	}
+
+	free(system);
+	return return_code;
+}
+
+// RAM sizes back as the NES 2.0 shift count, 64 << shift bytes.
+static u32 ram_size_shift(u32 length) {
+	u32 shift = 0;
+	while (length > 0 && (64u << shift) < length) {
+		shift++;
+	}
+
+	return length > 0 ? shift : 0;
+}
+
+static int run_rom_info(const char* rom_path) {
+	rom_info info;
+	if (cartridge_read_info(rom_path, &info) != 0) {
+		printf("Error loading rom '%s'.\n", rom_path);
+		return -1;
+	}
+
+	static const char* timings[4] = { "NTSC", "PAL", "Multi-region", "Dendy" };
+	static const char* timing_names[4] = { "ROM_TIMING_NTSC", "ROM_TIMING_PAL", "ROM_TIMING_MULTI_REGION", "ROM_TIMING_DENDY" };
+	const mapper_interface* mapper = mapper_find(info.mapper);
+
+	printf("Header      %s\n", info.nes_2 ? "NES 2.0" : "iNES");
+	printf("CRC32       %08X (%s the rom database)\n", info.crc32, info.from_database ? "configured from" : "not in");
+	printf("Mapper      %u.%u (%s)\n", info.mapper, info.submapper, mapper != NULL ? mapper->name : "not supported");
+	printf("PRG ROM     %u bytes\n", info.prg_rom_length);
+	printf("CHR ROM     %u bytes\n", info.chr_rom_length);
+	printf("PRG RAM     %u bytes, %u battery backed\n", info.prg_ram_length, info.prg_nvram_length);
+	printf("CHR RAM     %u bytes, %u battery backed\n", info.chr_ram_length, info.chr_nvram_length);
+	printf("Timing      %s\n", timings[info.timing & 0x03]);
+	printf("Mirroring   %s\n", info.vertical_mirroring ? "Vertical" : "Horizontal");
+
+	// The line rom_database.c needs to configure the rom like this
+	printf(
+		"\n{ 0x%08X, %u, %u, %s, %u, %u, %u, %u, %u },\n",
+		info.crc32, info.mapper, info.submapper, timing_names[info.timing & 0x03],
+		ram_size_shift(info.prg_ram_length), ram_size_shift(info.prg_nvram_length),
+		ram_size_shift(info.chr_ram_length), ram_size_shift(info.chr_nvram_length), info.vertical_mirroring
+	);
+
+	return 0;
+}
+
+// A frame is around 30000 instructions, the ring is emptied after every one
+#define TRACE_RING_CAPACITY (1 << 16)
+
+static int run_trace(u32 frame_count, const char* rom_path, const char* trace_path) {
+	nes_system* system = malloc(sizeof(nes_system));
+	if (nes_init(system, rom_path) != 0) {
+		printf("Error loading rom '%s'.\n", rom_path);
+		free(system);
+		return -1;
+	}
+
+	trace_ring ring;
+	FILE* file = fopen(trace_path, "wb");
+	if (file == NULL || trace_ring_init(&ring, TRACE_RING_CAPACITY) != 0) {
+		printf("Couldn't create '%s'.\n", trace_path);
+		if (file != NULL) {
+			fclose(file);
+		}
+		nes_free(system);
+		free(system);
+		return -1;
+	}
+
+	int return_code = trace_write_header(file);
+	system->cpu.trace = &ring;
+
+	u64 record_count = 0;
+	u64 dropped = 0;
+	for (u32 frame = 0; frame < frame_count && return_code == 0; frame++) {
+		nes_run_frame(system);
+
+		i64 written = trace_ring_drain(&ring, file, &dropped);
+		if (written < 0) {
+			return_code = -1;
+		}
+		else {
+			record_count += written;
+		}
+	}
+
+	if (fclose(file) != 0 || return_code != 0) {
+		printf("Couldn't write '%s'.\n", trace_path);
+		return_code = -1;
+	}
+	else {
+		printf("%llu instructions traced, %llu dropped.\n", (unsigned long long)record_count, (unsigned long long)dropped);
+	}
+
+	trace_ring_free(&ring);
+	nes_free(system);
+	free(system);
+	return return_code;
+}
+
+// What two systems running the same thing have to agree on: the frame, both
+// RAMs through the bus (so a fork's copy on write pages are read the way the
+// game sees them) and the cycle count.
+static u32 system_crc(nes_system* system) {
+	u8 ram[0x2000];
+	for (u32 i = 0; i < sizeof(ram); i++) {
+		ram[i] = cpubus_read(system, 0x6000 + i);
+	}
+
+	return crc32(system->ppu.framebuffer, sizeof(system->ppu.framebuffer)) ^
+		crc32(system->cpu_memory, sizeof(system->cpu_memory)) * 3 ^
+		crc32(ram, sizeof(ram)) * 5 ^ (u32)system->cpu.total_cycles;
+}
+
+#define FORK_TEST_TIMING_COUNT 1000
+
+// Runs a system for `frame_count` frames, forks it and runs the parent, the child
+// and an unforked reference for as many frames again. All three have to end up
+// the same, then forking and freeing is timed. With a save path the parent's
+// PRG RAM is that file, the reference starts from a copy of it.
+static int run_fork_test(u32 frame_count, const char* rom_path, const char* save_path) {
+	nes_system* systems = malloc(4 * sizeof(nes_system));
+	nes_system* reference = &systems[0];
+	nes_system* parent = &systems[1];
+	nes_system* child = &systems[2];
+	nes_system* timed = &systems[3];
+
+	if (nes_init(reference, rom_path) != 0) {
+		printf("Error loading rom '%s'.\n", rom_path);
+		free(systems);
+		return -1;
+	}
+	nes_init(parent, rom_path);
+
+	if (save_path != NULL) {
+		if (cartridge_attach_save(parent, save_path) != 0) {
+			printf("Couldn't attach '%s' as the save file.\n", save_path);
+			nes_free(parent);
+			nes_free(reference);
+			free(systems);
+			return -1;
+		}
+		memcpy(reference->cartridge.prg_ram, parent->cartridge.prg_ram, parent->cartridge.prg_ram_length);
+	}
+
+	for (u32 frame = 0; frame < frame_count; frame++) {
+		nes_run_frame(reference);
+		nes_run_frame(parent);
+	}
+
+	if (nes_fork(parent, child) != 0) {
+		printf("Couldn't fork the system.\n");
+		nes_free(parent);
+		nes_free(reference);
+		free(systems);
+		return -1;
+	}
+
+	for (u32 frame = 0; frame < frame_count; frame++) {
+		nes_run_frame(reference);
+		nes_run_frame(parent);
+		nes_run_frame(child);
+	}
+
+	u32 reference_crc = system_crc(reference);
+	u32 parent_crc = system_crc(parent);
+	u32 child_crc = system_crc(child);
+	int return_code = parent_crc == reference_crc && child_crc == reference_crc ? 0 : -1;
+	printf("Reference %08X, parent %08X, child %08X: %s\n", reference_crc, parent_crc, child_crc, return_code == 0 ? "match" : "differ");
+
+	struct timespec start, end;
+	timespec_get(&start, TIME_UTC);
+
+	for (u32 i = 0; i < FORK_TEST_TIMING_COUNT && return_code == 0; i++) {
+		if (nes_fork(child, timed) != 0) {
+			printf("Couldn't fork the system.\n");
+			return_code = -1;
+			break;
+		}
+		nes_free(timed);
+	}
+
+	timespec_get(&end, TIME_UTC);
+	if (return_code == 0) {
+		double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("Fork and free took %.2f us on average.\n", seconds / FORK_TEST_TIMING_COUNT * 1e6);
+	}
+
+	nes_free(child);
+	nes_free(parent);
+	nes_free(reference);
+	free(systems);
+	return return_code;
+}
+
+// Runs a rom for `frame_count` frames, saves a state and runs as many frames
+// again. Loading the state back, into the same system and into a fresh one,
+// and running those frames once more has to end up in the same place.
+static int run_save_state_test(u32 frame_count, const char* rom_path) {
+	nes_system* systems = malloc(2 * sizeof(nes_system));
+	nes_system* system = &systems[0];
+	nes_system* fresh = &systems[1];
+
+	if (nes_init(system, rom_path) != 0) {
+		printf("Error loading rom '%s'.\n", rom_path);
+		free(systems);
+		return -1;
+	}
+	nes_init(fresh, rom_path);
+
+	for (u32 frame = 0; frame < frame_count; frame++) {
+		nes_run_frame(system);
+	}
+
+	u32 size = nes_save_state_size(system);
+	u8* state = malloc(size);
+	if (nes_save_state(system, state, size) == 0) {
+		printf("Couldn't save the state.\n");
+		free(state);
+		nes_free(fresh);
+		nes_free(system);
+		free(systems);
+		return -1;
+	}
+
+	for (u32 frame = 0; frame < frame_count; frame++) {
+		nes_run_frame(system);
+	}
+	u32 expected_crc = system_crc(system);
+
+	int return_code = 0;
+	if (nes_load_state(system, state, size) != 0 || nes_load_state(fresh, state, size) != 0) {
+		printf("Couldn't load the state.\n");
+		return_code = -1;
+	}
+
+	for (u32 frame = 0; frame < frame_count && return_code == 0; frame++) {
+		nes_run_frame(system);
+		nes_run_frame(fresh);
+	}
+
+	if (return_code == 0) {
+		u32 loaded_crc = system_crc(system);
+		u32 fresh_crc = system_crc(fresh);
+		return_code = loaded_crc == expected_crc && fresh_crc == expected_crc ? 0 : -1;
+		printf(
+			"%u byte state. Expected %08X, loaded %08X, loaded into a new system %08X: %s\n",
+			size, expected_crc, loaded_crc, fresh_crc, return_code == 0 ? "match" : "differ"
+		);
+	}
+
+	free(state);
+	nes_free(fresh);
+	nes_free(system);
+	free(systems);
+	return return_code;
+}
\ No newline at end of file
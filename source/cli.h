@@ -0,0 +1,13 @@
+#pragma once
+
+// The commands that need no window (tests, batch runs, benchmarks), shared by
+// the headless NesEmuCli and the SDL frontend.
+
+// Whether argv[1] is a command rather than a rom path.
+int cli_is_command(int argc, char* argv[]);
+
+// Runs the command in argv[1], returns the exit code for main.
+int cli_run(int argc, char* argv[]);
+
+// Prints the commands, prefixed with the executable's name.
+void cli_print_usage(const char* program);
@@ -0,0 +1,14 @@
+#include <stdio.h>
+
+#include "cli.h"
+
+// Headless entry point, everything but opening a rom in a window.
+int main(int argc, char* argv[]) {
+	if (!cli_is_command(argc, argv)) {
+		printf("Not enough arguments. Use one of the following:\n");
+		cli_print_usage(argv[0]);
+		return -1;
+	}
+
+	return cli_run(argc, argv);
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include "controller.h"
+
+#include <string.h>
+
+#include "nes.h"
+
+#ifdef _WIN32
+	#define strcasecmp _stricmp
+#else
+	#include <strings.h>
+#endif
+
+void controller_set_buttons(nes_system* system, u8 port, u8 buttons) {
+	system->controller_buttons[port] = buttons;
+
+	if (system->controller_strobe) {
+		system->controller_shift[port] = buttons;
+	}
+}
+
+u8 controller_button_from_name(const char* name) {
+	static const char* names[8] = { "a", "b", "select", "start", "up", "down", "left", "right" };
+
+	for (u8 i = 0; i < 8; i++) {
+		if (strcasecmp(name, names[i]) == 0) {
+			return 1 << i;
+		}
+	}
+
+	return 0;
+}
+
+// $4016 write, while bit 0 is set the shift registers keep reloading
+void controller_write(nes_system* system, u8 value) {
+	system->controller_strobe = value & 1;
+
+	if (system->controller_strobe) {
+		system->controller_shift[0] = system->controller_buttons[0];
+		system->controller_shift[1] = system->controller_buttons[1];
+	}
+}
+
+// $4016/$4017 read, the upper bits are open bus which is usually 0x40
+u8 controller_read(nes_system* system, u8 port) {
+	if (system->controller_strobe) {
+		return 0x40 | (system->controller_buttons[port] & 1);
+	}
+
+	u8 bit = system->controller_shift[port] & 1;
+
+	// Official controllers return 1 once all 8 buttons have been read
+	system->controller_shift[port] = (system->controller_shift[port] >> 1) | 0x80;
+
+	return 0x40 | bit;
+}
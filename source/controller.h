@@ -0,0 +1,22 @@
+#pragma once
+
+#include "types.h"
+
+typedef struct nes_system nes_system;
+
+// Standard controller buttons, in the order they are shifted out of $4016/$4017.
+#define CONTROLLER_A      0x01
+#define CONTROLLER_B      0x02
+#define CONTROLLER_SELECT 0x04
+#define CONTROLLER_START  0x08
+#define CONTROLLER_UP     0x10
+#define CONTROLLER_DOWN   0x20
+#define CONTROLLER_LEFT   0x40
+#define CONTROLLER_RIGHT  0x80
+
+void controller_set_buttons(nes_system* system, u8 port, u8 buttons);
+// Parses a button name like "A" or "right", returns 0 if the name isn't known.
+u8 controller_button_from_name(const char* name);
+
+void controller_write(nes_system* system, u8 value);
+u8 controller_read(nes_system* system, u8 port);
@@ -1,107 +1,117 @@
 #include "cpu.h"
 
 #include "memory_bus.h"
-
-u16 addressing_immediate(cpu* state);
-u16 addressing_zeropage(cpu* state);
-u16 addressing_zeropagex(cpu* state);
-u16 addressing_zeropagey(cpu* state);
-u16 addressing_absolute(cpu* state);
-u16 addressing_absolutex(cpu* state);
-u16 addressing_absolutey(cpu* state);
-u16 addressing_indirect(cpu* state);
-u16 addressing_indexedindirect(cpu* state);
-u16 addressing_indirectindexed(cpu* state);
-i8 addressing_relative(cpu* state);
+#include "trace.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+static inline u16 addressing_immediate(cpu* state);
+static inline u16 addressing_zeropage(cpu* state);
+static inline u16 addressing_zeropagex(cpu* state);
+static inline u16 addressing_zeropagey(cpu* state);
+static inline u16 addressing_absolute(cpu* state);
+static inline u16 addressing_absolutex(cpu* state);
+static inline u16 addressing_absolutex_write(cpu* state);
+static inline u16 addressing_absolutey(cpu* state);
+static inline u16 addressing_absolutey_write(cpu* state);
+static inline u16 addressing_indirect(cpu* state);
+static inline u16 addressing_indexedindirect(cpu* state);
+static inline u16 addressing_indirectindexed(cpu* state);
+static inline u16 addressing_indirectindexed_write(cpu* state);
+static inline i8 addressing_relative(cpu* state);
 
 // Access
-void opcode_lda(cpu* state, u16 address);
-void opcode_sta(cpu* state, u16 address);
-void opcode_ldx(cpu* state, u16 address);
-void opcode_stx(cpu* state, u16 address);
-void opcode_ldy(cpu* state, u16 address);
-void opcode_sty(cpu* state, u16 address);
+static inline void opcode_lda(cpu* state, u16 address);
+static inline void opcode_sta(cpu* state, u16 address);
+static inline void opcode_ldx(cpu* state, u16 address);
+static inline void opcode_stx(cpu* state, u16 address);
+static inline void opcode_ldy(cpu* state, u16 address);
+static inline void opcode_sty(cpu* state, u16 address);
 
 // Transfer
-void opcode_tax(cpu* state);
-void opcode_tay(cpu* state);
-void opcode_txa(cpu* state);
+static inline void opcode_tax(cpu* state);
+static inline void opcode_tay(cpu* state);
+static inline void opcode_txa(cpu* state);
 
-void opcode_tya(cpu* state);
+static inline void opcode_tya(cpu* state);
 
 // Arithmetic
-void opcode_adc(cpu* state, u16 address);
-void opcode_sbc(cpu* state, u16 address);
-void opcode_inc(cpu* state, u16 address);
-void opcode_dec(cpu* state, u16 address);
-void opcode_inx(cpu* state);
-void opcode_dex(cpu* state);
-void opcode_iny(cpu* state);
-void opcode_dey(cpu* state);
+static inline void opcode_adc(cpu* state, u16 address);
+static inline void opcode_sbc(cpu* state, u16 address);
+static inline void opcode_inc(cpu* state, u16 address);
+static inline void opcode_dec(cpu* state, u16 address);
+static inline void opcode_inx(cpu* state);
+static inline void opcode_dex(cpu* state);
+static inline void opcode_iny(cpu* state);
+static inline void opcode_dey(cpu* state);
 
 // Shift
-void opcode_asl(cpu* state, u16 address);
-void opcode_asl_accumulator(cpu* state);
-void opcode_lsr(cpu* state, u16 address);
-void opcode_lsr_accumulator(cpu* state);
-void opcode_rol(cpu* state, u16 address);
-void opcode_rol_accumulator(cpu* state);
-void opcode_ror(cpu* state, u16 address);
-void opcode_ror_accumulator(cpu* state);
+static inline void opcode_asl(cpu* state, u16 address);
+static inline void opcode_asl_accumulator(cpu* state);
+static inline void opcode_lsr(cpu* state, u16 address);
+static inline void opcode_lsr_accumulator(cpu* state);
+static inline void opcode_rol(cpu* state, u16 address);
+static inline void opcode_rol_accumulator(cpu* state);
+static inline void opcode_ror(cpu* state, u16 address);
+static inline void opcode_ror_accumulator(cpu* state);
 
 // Bitwise
-void opcode_and(cpu* state, u16 address);
-void opcode_ora(cpu* state, u16 address);
-void opcode_eor(cpu* state, u16 address);
-void opcode_bit(cpu* state, u16 address);
+static inline void opcode_and(cpu* state, u16 address);
+static inline void opcode_ora(cpu* state, u16 address);
+static inline void opcode_eor(cpu* state, u16 address);
+static inline void opcode_bit(cpu* state, u16 address);
 
 // Compare
-void opcode_cmp(cpu* state, u16 address);
-void opcode_cpx(cpu* state, u16 address);
-void opcode_cpy(cpu* state, u16 address);
+static inline void opcode_cmp(cpu* state, u16 address);
+static inline void opcode_cpx(cpu* state, u16 address);
+static inline void opcode_cpy(cpu* state, u16 address);
 
 // Branch
-void opcode_bcc(cpu* state, i8 address);
-void opcode_bcs(cpu* state, i8 address);
-void opcode_beq(cpu* state, i8 address);
-void opcode_bne(cpu* state, i8 address);
-void opcode_bpl(cpu* state, i8 address);
-void opcode_bmi(cpu* state, i8 address);
-void opcode_bvc(cpu* state, i8 address);
-void opcode_bvs(cpu* state, i8 address);
+static inline void opcode_bcc(cpu* state, i8 address);
+static inline void opcode_bcs(cpu* state, i8 address);
+static inline void opcode_beq(cpu* state, i8 address);
+static inline void opcode_bne(cpu* state, i8 address);
+static inline void opcode_bpl(cpu* state, i8 address);
+static inline void opcode_bmi(cpu* state, i8 address);
+static inline void opcode_bvc(cpu* state, i8 address);
+static inline void opcode_bvs(cpu* state, i8 address);
 
 // Jump
-void opcode_jmp(cpu* state, u16 address);
-void opcode_jsr(cpu* state, u16 address);
-void opcode_rts(cpu* state);
-void opcode_brk(cpu* state);
-void opcode_rti(cpu* state);
+static inline void opcode_jmp(cpu* state, u16 address);
+static inline void opcode_jsr(cpu* state, u16 address);
+static inline void opcode_rts(cpu* state);
+static inline void opcode_brk(cpu* state);
+static inline void opcode_rti(cpu* state);
 
 // Stack
-void opcode_pha(cpu* state);
-void opcode_pla(cpu* state);
-void opcode_php(cpu* state);
-void opcode_plp(cpu* state);
-void opcode_txs(cpu* state);
-void opcode_tsx(cpu* state);
+static inline void opcode_pha(cpu* state);
+static inline void opcode_pla(cpu* state);
+static inline void opcode_php(cpu* state);
+static inline void opcode_plp(cpu* state);
+static inline void opcode_txs(cpu* state);
+static inline void opcode_tsx(cpu* state);
 
 // Flags
-void opcode_clc(cpu* state);
-void opcode_sec(cpu* state);
-void opcode_cli(cpu* state);
-void opcode_sei(cpu* state);
-void opcode_cld(cpu* state);
-void opcode_sed(cpu* state);
-void opcode_clv(cpu* state);
+static inline void opcode_clc(cpu* state);
+static inline void opcode_sec(cpu* state);
+static inline void opcode_cli(cpu* state);
+static inline void opcode_sei(cpu* state);
+static inline void opcode_cld(cpu* state);
+static inline void opcode_sed(cpu* state);
+static inline void opcode_clv(cpu* state);
 
 // Other
-void opcode_nop(cpu* state);
+static inline void opcode_nop(cpu* state);
+static inline void opcode_unofficial(cpu* state);
+
+void cpu_init(cpu* state, nes_system* system) {
+	state->system = system;
 
-void cpu_init(cpu* state) {
 	state->total_cycles = 0;
 	state->current_instruction_cycles = 0;
 	
-	state->program_counter = (cpubus_read(0xFFFD) << 8) | cpubus_read(0xFFFC);
+	state->program_counter = (cpubus_read(state->system, 0xFFFD) << 8) | cpubus_read(state->system, 0xFFFC);
 	state->stack_pointer = 0xFD;
 
 	state->accumulator = 0x00;
@@ -119,356 +129,668 @@ void cpu_init(cpu* state) {
 
 	state->interrupt_flag_changed = 0;
 	state->previous_interrupt_flag = 1;
+
+	state->trace = NULL;
+}
+
+// Every opcode paired with the opcode function and addressing mode it decodes to.
+// Each entry expands to its own handler, so the addressing mode is specialised
+// into the handler instead of being picked at runtime.
+#define CPU_OFFICIAL_OPCODES(OP, IMPLIED) \
+	/* ACCESS */ \
+	OP(A9, lda, immediate) \
+	OP(A5, lda, zeropage) \
+	OP(B5, lda, zeropagex) \
+	OP(AD, lda, absolute) \
+	OP(BD, lda, absolutex) \
+	OP(B9, lda, absolutey) \
+	OP(A1, lda, indexedindirect) \
+	OP(B1, lda, indirectindexed) \
+	\
+	OP(85, sta, zeropage) \
+	OP(95, sta, zeropagex) \
+	OP(8D, sta, absolute) \
+	OP(9D, sta, absolutex_write) \
+	OP(99, sta, absolutey_write) \
+	OP(81, sta, indexedindirect) \
+	OP(91, sta, indirectindexed_write) \
+	\
+	OP(A2, ldx, immediate) \
+	OP(A6, ldx, zeropage) \
+	OP(B6, ldx, zeropagey) \
+	OP(AE, ldx, absolute) \
+	OP(BE, ldx, absolutey) \
+	\
+	OP(86, stx, zeropage) \
+	OP(96, stx, zeropagey) \
+	OP(8E, stx, absolute) \
+	\
+	OP(A0, ldy, immediate) \
+	OP(A4, ldy, zeropage) \
+	OP(B4, ldy, zeropagex) \
+	OP(AC, ldy, absolute) \
+	OP(BC, ldy, absolutex) \
+	\
+	OP(84, sty, zeropage) \
+	OP(94, sty, zeropagex) \
+	OP(8C, sty, absolute) \
+	\
+	/* TRANSFER */ \
+	IMPLIED(AA, tax) \
+	IMPLIED(A8, tay) \
+	IMPLIED(8A, txa) \
+	IMPLIED(98, tya) \
+	\
+	/* ARITHMETIC */ \
+	OP(69, adc, immediate) \
+	OP(65, adc, zeropage) \
+	OP(75, adc, zeropagex) \
+	OP(6D, adc, absolute) \
+	OP(7D, adc, absolutex) \
+	OP(79, adc, absolutey) \
+	OP(61, adc, indexedindirect) \
+	OP(71, adc, indirectindexed) \
+	\
+	OP(E9, sbc, immediate) \
+	OP(E5, sbc, zeropage) \
+	OP(F5, sbc, zeropagex) \
+	OP(ED, sbc, absolute) \
+	OP(FD, sbc, absolutex) \
+	OP(F9, sbc, absolutey) \
+	OP(E1, sbc, indexedindirect) \
+	OP(F1, sbc, indirectindexed) \
+	\
+	OP(E6, inc, zeropage) \
+	OP(F6, inc, zeropagex) \
+	OP(EE, inc, absolute) \
+	OP(FE, inc, absolutex_write) \
+	\
+	OP(C6, dec, zeropage) \
+	OP(D6, dec, zeropagex) \
+	OP(CE, dec, absolute) \
+	OP(DE, dec, absolutex_write) \
+	\
+	IMPLIED(E8, inx) \
+	IMPLIED(CA, dex) \
+	\
+	IMPLIED(C8, iny) \
+	IMPLIED(88, dey) \
+	\
+	/* SHIFT */ \
+	IMPLIED(0A, asl_accumulator) \
+	OP(06, asl, zeropage) \
+	OP(16, asl, zeropagex) \
+	OP(0E, asl, absolute) \
+	OP(1E, asl, absolutex_write) \
+	\
+	IMPLIED(4A, lsr_accumulator) \
+	OP(46, lsr, zeropage) \
+	OP(56, lsr, zeropagex) \
+	OP(4E, lsr, absolute) \
+	OP(5E, lsr, absolutex_write) \
+	\
+	IMPLIED(2A, rol_accumulator) \
+	OP(26, rol, zeropage) \
+	OP(36, rol, zeropagex) \
+	OP(2E, rol, absolute) \
+	OP(3E, rol, absolutex_write) \
+	\
+	IMPLIED(6A, ror_accumulator) \
+	OP(66, ror, zeropage) \
+	OP(76, ror, zeropagex) \
+	OP(6E, ror, absolute) \
+	OP(7E, ror, absolutex_write) \
+	\
+	/* BITWISE */ \
+	OP(29, and, immediate) \
+	OP(25, and, zeropage) \
+	OP(35, and, zeropagex) \
+	OP(2D, and, absolute) \
+	OP(3D, and, absolutex) \
+	OP(39, and, absolutey) \
+	OP(21, and, indexedindirect) \
+	OP(31, and, indirectindexed) \
+	\
+	OP(09, ora, immediate) \
+	OP(05, ora, zeropage) \
+	OP(15, ora, zeropagex) \
+	OP(0D, ora, absolute) \
+	OP(1D, ora, absolutex) \
+	OP(19, ora, absolutey) \
+	OP(01, ora, indexedindirect) \
+	OP(11, ora, indirectindexed) \
+	\
+	OP(49, eor, immediate) \
+	OP(45, eor, zeropage) \
+	OP(55, eor, zeropagex) \
+	OP(4D, eor, absolute) \
+	OP(5D, eor, absolutex) \
+	OP(59, eor, absolutey) \
+	OP(41, eor, indexedindirect) \
+	OP(51, eor, indirectindexed) \
+	\
+	OP(24, bit, zeropage) \
+	OP(2C, bit, absolute) \
+	\
+	/* COMPARE */ \
+	OP(C9, cmp, immediate) \
+	OP(C5, cmp, zeropage) \
+	OP(D5, cmp, zeropagex) \
+	OP(CD, cmp, absolute) \
+	OP(DD, cmp, absolutex) \
+	OP(D9, cmp, absolutey) \
+	OP(C1, cmp, indexedindirect) \
+	OP(D1, cmp, indirectindexed) \
+	\
+	OP(E0, cpx, immediate) \
+	OP(E4, cpx, zeropage) \
+	OP(EC, cpx, absolute) \
+	\
+	OP(C0, cpy, immediate) \
+	OP(C4, cpy, zeropage) \
+	OP(CC, cpy, absolute) \
+	\
+	/* BRANCH */ \
+	OP(90, bcc, relative) \
+	OP(B0, bcs, relative) \
+	OP(F0, beq, relative) \
+	OP(D0, bne, relative) \
+	OP(10, bpl, relative) \
+	OP(30, bmi, relative) \
+	OP(50, bvc, relative) \
+	OP(70, bvs, relative) \
+	\
+	/* JUMP */ \
+	OP(4C, jmp, absolute) \
+	OP(6C, jmp, indirect) \
+	\
+	OP(20, jsr, immediate) \
+	IMPLIED(60, rts) \
+	IMPLIED(00, brk) \
+	IMPLIED(40, rti) \
+	\
+	/* STACK */ \
+	IMPLIED(48, pha) \
+	IMPLIED(68, pla) \
+	IMPLIED(08, php) \
+	IMPLIED(28, plp) \
+	IMPLIED(9A, txs) \
+	IMPLIED(BA, tsx) \
+	\
+	/* FLAGS */ \
+	IMPLIED(18, clc) \
+	IMPLIED(38, sec) \
+	IMPLIED(58, cli) \
+	IMPLIED(78, sei) \
+	IMPLIED(D8, cld) \
+	IMPLIED(F8, sed) \
+	IMPLIED(B8, clv) \
+	\
+	/* OTHER */ \
+	IMPLIED(EA, nop)
+
+// Unofficial opcodes aren't implemented yet, they all decode to a one byte no-op.
+#define CPU_UNOFFICIAL_OPCODES(IMPLIED) \
+	IMPLIED(02, unofficial) IMPLIED(03, unofficial) IMPLIED(04, unofficial) IMPLIED(07, unofficial) \
+	IMPLIED(0B, unofficial) IMPLIED(0C, unofficial) IMPLIED(0F, unofficial) IMPLIED(12, unofficial) \
+	IMPLIED(13, unofficial) IMPLIED(14, unofficial) IMPLIED(17, unofficial) IMPLIED(1A, unofficial) \
+	IMPLIED(1B, unofficial) IMPLIED(1C, unofficial) IMPLIED(1F, unofficial) IMPLIED(22, unofficial) \
+	IMPLIED(23, unofficial) IMPLIED(27, unofficial) IMPLIED(2B, unofficial) IMPLIED(2F, unofficial) \
+	IMPLIED(32, unofficial) IMPLIED(33, unofficial) IMPLIED(34, unofficial) IMPLIED(37, unofficial) \
+	IMPLIED(3A, unofficial) IMPLIED(3B, unofficial) IMPLIED(3C, unofficial) IMPLIED(3F, unofficial) \
+	IMPLIED(42, unofficial) IMPLIED(43, unofficial) IMPLIED(44, unofficial) IMPLIED(47, unofficial) \
+	IMPLIED(4B, unofficial) IMPLIED(4F, unofficial) IMPLIED(52, unofficial) IMPLIED(53, unofficial) \
+	IMPLIED(54, unofficial) IMPLIED(57, unofficial) IMPLIED(5A, unofficial) IMPLIED(5B, unofficial) \
+	IMPLIED(5C, unofficial) IMPLIED(5F, unofficial) IMPLIED(62, unofficial) IMPLIED(63, unofficial) \
+	IMPLIED(64, unofficial) IMPLIED(67, unofficial) IMPLIED(6B, unofficial) IMPLIED(6F, unofficial) \
+	IMPLIED(72, unofficial) IMPLIED(73, unofficial) IMPLIED(74, unofficial) IMPLIED(77, unofficial) \
+	IMPLIED(7A, unofficial) IMPLIED(7B, unofficial) IMPLIED(7C, unofficial) IMPLIED(7F, unofficial) \
+	IMPLIED(80, unofficial) IMPLIED(82, unofficial) IMPLIED(83, unofficial) IMPLIED(87, unofficial) \
+	IMPLIED(89, unofficial) IMPLIED(8B, unofficial) IMPLIED(8F, unofficial) IMPLIED(92, unofficial) \
+	IMPLIED(93, unofficial) IMPLIED(97, unofficial) IMPLIED(9B, unofficial) IMPLIED(9C, unofficial) \
+	IMPLIED(9E, unofficial) IMPLIED(9F, unofficial) IMPLIED(A3, unofficial) IMPLIED(A7, unofficial) \
+	IMPLIED(AB, unofficial) IMPLIED(AF, unofficial) IMPLIED(B2, unofficial) IMPLIED(B3, unofficial) \
+	IMPLIED(B7, unofficial) IMPLIED(BB, unofficial) IMPLIED(BF, unofficial) IMPLIED(C2, unofficial) \
+	IMPLIED(C3, unofficial) IMPLIED(C7, unofficial) IMPLIED(CB, unofficial) IMPLIED(CF, unofficial) \
+	IMPLIED(D2, unofficial) IMPLIED(D3, unofficial) IMPLIED(D4, unofficial) IMPLIED(D7, unofficial) \
+	IMPLIED(DA, unofficial) IMPLIED(DB, unofficial) IMPLIED(DC, unofficial) IMPLIED(DF, unofficial) \
+	IMPLIED(E2, unofficial) IMPLIED(E3, unofficial) IMPLIED(E7, unofficial) IMPLIED(EB, unofficial) \
+	IMPLIED(EF, unofficial) IMPLIED(F2, unofficial) IMPLIED(F3, unofficial) IMPLIED(F4, unofficial) \
+	IMPLIED(F7, unofficial) IMPLIED(FA, unofficial) IMPLIED(FB, unofficial) IMPLIED(FC, unofficial) \
+	IMPLIED(FF, unofficial)
+
+#define CPU_OPCODES(OP, IMPLIED) CPU_OFFICIAL_OPCODES(OP, IMPLIED) CPU_UNOFFICIAL_OPCODES(IMPLIED)
+
+// Every cycle of an instruction is exactly one bus access, so the cycles are
+// counted where the bus is accessed instead of being added up by hand.
+// cpu_run works on a copy of the cpu, so accesses that leave the page table tell
+// the system which cycle they happen on. The I/O registers need it to catch up.
+static inline u8 cpu_read(cpu* state, u16 address) {
+	state->current_instruction_cycles++;
+
+	nes_system* system = state->system;
+	u8* page = system->cpu_read_pages[address >> 8];
+	if (page != NULL) {
+		return page[address & 0xFF];
+	}
+
+	system->cpu_bus_cycle = state->total_cycles + state->current_instruction_cycles;
+	return cpubus_read_slow(system, address);
 }
 
-void cpu_execute_instruction(cpu* state) {
-	u8 instruction = cpubus_read(state->program_counter);
+static inline void cpu_write(cpu* state, u16 address, u8 value) {
+	state->current_instruction_cycles++;
+
+	nes_system* system = state->system;
+	u8* page = system->cpu_write_pages[address >> 8];
+	if (page != NULL) {
+		page[address & 0xFF] = value;
+		return;
+	}
+
+	system->cpu_bus_cycle = state->total_cycles + state->current_instruction_cycles;
+	cpubus_write_slow(system, address, value);
+}
+
+#define DEFINE_HANDLER(code, opcode, addressing) \
+	static void handler_##code(cpu* state) { opcode_##opcode(state, addressing_##addressing(state)); }
+// Instructions without an operand still read the byte after the opcode on their
+// second cycle and throw it away.
+#define DEFINE_HANDLER_IMPLIED(code, opcode) \
+	static void handler_##code(cpu* state) { cpu_read(state, state->program_counter); opcode_##opcode(state); }
+
+CPU_OPCODES(DEFINE_HANDLER, DEFINE_HANDLER_IMPLIED)
+
+#ifndef CPU_DISPATCH_COMPUTED_GOTO
+typedef void (*opcode_handler)(cpu* state);
+
+#define TABLE_ENTRY(code, ...) [0x##code] = handler_##code,
+static const opcode_handler opcode_table[256] = {
+	CPU_OPCODES(TABLE_ENTRY, TABLE_ENTRY)
+};
+#endif
+
+// Interrupts are only looked at between runs, so if the IRQ line is already low
+// when they get enabled the run has to end here.
+static inline void cpu_poll_irq(cpu* state) {
+	if (!state->status.interrupt_disable && state->system->irq_line != 0) {
+		state->system->cpu_stop_cycle = 0;
+	}
+}
+
+// Kept out of line so tracing costs the dispatch nothing but the NULL check.
+// Operands are only peeked at through the page table, reading I/O could change it.
+static void cpu_trace(const cpu* state) {
+	nes_system* system = state->system;
+	trace_record* record = trace_ring_next(state->trace);
+
+	record->cycle = state->total_cycles;
+	record->program_counter = state->program_counter;
+	for (u16 i = 0; i < 3; i++) {
+		u16 address = state->program_counter + i;
+		u8* page = system->cpu_read_pages[address >> 8];
+		record->bytes[i] = page != NULL ? page[address & 0xFF] : 0x00;
+	}
+	record->accumulator = state->accumulator;
+	record->register_x = state->register_x;
+	record->register_y = state->register_y;
+	record->status = state->status.as_byte;
+	record->stack_pointer = state->stack_pointer;
+
+	// The PPU is only caught up when something needs it, so the position is worked
+	// out from where it stopped. That misses an odd frame's skipped dot in between.
+	const ppu* video = &system->ppu;
+	i64 dots = (i64)(state->total_cycles * 3) - (i64)video->cycle;
+	i64 position = (i64)video->scanline * PPU_DOTS_PER_SCANLINE + video->dot + dots;
+	i64 frame_length = PPU_SCANLINES_PER_FRAME * PPU_DOTS_PER_SCANLINE;
+	position = ((position % frame_length) + frame_length) % frame_length;
+	record->scanline = (u16)(position / PPU_DOTS_PER_SCANLINE);
+	record->dot = (u16)(position % PPU_DOTS_PER_SCANLINE);
+
+	trace_ring_commit(state->trace);
+}
+
+// Fetches the next opcode and starts counting the cycles of its instruction.
+static inline u8 cpu_fetch(cpu* state) {
+	if (state->trace != NULL) {
+		cpu_trace(state);
+	}
+
+	state->current_instruction_cycles = 0;
+	u8 instruction = cpu_read(state, state->program_counter);
 	state->program_counter++;
-	state->current_instruction_cycles += 1;
 
+	// CLI, SEI and PLP change the flag after the IRQ line was polled for the next
+	// instruction, so the new value only counts once this one is done
 	if (state->interrupt_flag_changed) {
-		if (state->previous_interrupt_flag != state->status.interrupt_disable) {
-			// The 1 instruction delay for interrupt disable flag
-		}
+		state->interrupt_flag_changed = 0;
+		cpu_poll_irq(state);
 	}
 
-	switch (instruction) {
-		//
-		// ACCESS
-		//
-
-		case 0xA9: opcode_lda(state, addressing_immediate(state)); break;
-		case 0xA5: opcode_lda(state, addressing_zeropage(state)); break;
-		case 0xB5: opcode_lda(state, addressing_zeropagex(state)); break;
-		case 0xAD: opcode_lda(state, addressing_absolute(state)); break;
-		case 0xBD: opcode_lda(state, addressing_absolutex(state)); break;
-		case 0xB9: opcode_lda(state, addressing_absolutey(state)); break;
-		case 0xA1: opcode_lda(state, addressing_indexedindirect(state)); break;
-		case 0xB1: opcode_lda(state, addressing_indirectindexed(state)); break;
-
-		case 0x85: opcode_sta(state, addressing_zeropage(state)); break;
-		case 0x95: opcode_sta(state, addressing_zeropagex(state)); break;
-		case 0x8D: opcode_sta(state, addressing_absolute(state)); break;
-		case 0x9D: opcode_sta(state, addressing_absolutex(state)); break;
-		case 0x99: opcode_sta(state, addressing_absolutey(state)); break;
-		case 0x81: opcode_sta(state, addressing_indexedindirect(state)); break;
-		case 0x91: opcode_sta(state, addressing_indirectindexed(state)); break;
-
-		case 0xA2: opcode_ldx(state, addressing_immediate(state)); break;
-		case 0xA6: opcode_ldx(state, addressing_zeropage(state)); break;
-		case 0xB6: opcode_ldx(state, addressing_zeropagey(state)); break;
-		case 0xAE: opcode_ldx(state, addressing_absolute(state)); break;
-		case 0xBE: opcode_ldx(state, addressing_absolutey(state)); break;
-
-		case 0x86: opcode_stx(state, addressing_zeropage(state)); break;
-		case 0x96: opcode_stx(state, addressing_zeropagey(state)); break;
-		case 0x8E: opcode_stx(state, addressing_absolute(state)); break;
-
-		case 0xA0: opcode_ldy(state, addressing_immediate(state)); break;
-		case 0xA4: opcode_ldy(state, addressing_zeropage(state)); break;
-		case 0xB4: opcode_ldy(state, addressing_zeropagex(state)); break;
-		case 0xAC: opcode_ldy(state, addressing_absolute(state)); break;
-		case 0xBC: opcode_ldy(state, addressing_absolutex(state)); break;
-
-		case 0x84: opcode_sty(state, addressing_zeropage(state)); break;
-		case 0x94: opcode_sty(state, addressing_zeropagex(state)); break;
-		case 0x8C: opcode_sty(state, addressing_absolute(state)); break;
-		
-		//
-		// TRANSFER
-		//
-
-		case 0xAA: opcode_tax(state); break;
-		case 0xA8: opcode_tay(state); break;
-		case 0x8A: opcode_txa(state); break;
-		case 0x98: opcode_tya(state); break;
-		
-		//
-		// ARITHMETIC
-		//
-
-		case 0x69: opcode_adc(state, addressing_immediate(state)); break;
-		case 0x65: opcode_adc(state, addressing_zeropage(state)); break;
-		case 0x75: opcode_adc(state, addressing_zeropagex(state)); break;
-		case 0x6D: opcode_adc(state, addressing_absolute(state)); break;
-		case 0x7D: opcode_adc(state, addressing_absolutex(state)); break;
-		case 0x79: opcode_adc(state, addressing_absolutey(state)); break;
-		case 0x61: opcode_adc(state, addressing_indexedindirect(state)); break;
-		case 0x71: opcode_adc(state, addressing_indirectindexed(state)); break;
-	
-		case 0xE9: opcode_sbc(state, addressing_immediate(state)); break;
-		case 0xE5: opcode_sbc(state, addressing_zeropage(state)); break;
-		case 0xF5: opcode_sbc(state, addressing_zeropagex(state)); break;
-		case 0xED: opcode_sbc(state, addressing_absolute(state)); break;
-		case 0xFD: opcode_sbc(state, addressing_absolutex(state)); break;
-		case 0xF9: opcode_sbc(state, addressing_absolutey(state)); break;
-		case 0xE1: opcode_sbc(state, addressing_indexedindirect(state)); break;
-		case 0xF1: opcode_sbc(state, addressing_indirectindexed(state)); break;
-
-		case 0xE6: opcode_inc(state, addressing_zeropage(state)); break;
-		case 0xF6: opcode_inc(state, addressing_zeropagex(state)); break;
-		case 0xEE: opcode_inc(state, addressing_absolute(state)); break;
-		case 0xFE: opcode_inc(state, addressing_absolutex(state)); break;
-
-		case 0xC6: opcode_dec(state, addressing_zeropage(state)); break;
-		case 0xD6: opcode_dec(state, addressing_zeropagex(state)); break;
-		case 0xCE: opcode_dec(state, addressing_absolute(state)); break;
-		case 0xDE: opcode_dec(state, addressing_absolutex(state)); break;
-
-		case 0xE8: opcode_inx(state); break;
-		case 0xCA: opcode_dex(state); break;
-
-		case 0xC8: opcode_iny(state); break;
-		case 0x88: opcode_dey(state); break;
-
-		//
-		// SHIFT
-		//
-
-		case 0x0A: opcode_asl_accumulator(state); break;
-		case 0x06: opcode_asl(state, addressing_zeropage(state)); break;
-		case 0x16: opcode_asl(state, addressing_zeropagex(state)); break;
-		case 0x0E: opcode_asl(state, addressing_absolute(state)); break;
-		case 0x1E: opcode_asl(state, addressing_absolutex(state)); break;
-
-		case 0x4A: opcode_lsr_accumulator(state); break;
-		case 0x46: opcode_lsr(state, addressing_zeropage(state)); break;
-		case 0x56: opcode_lsr(state, addressing_zeropagex(state)); break;
-		case 0x4E: opcode_lsr(state, addressing_absolute(state)); break;
-		case 0x5E: opcode_lsr(state, addressing_absolutex(state)); break;
-
-		case 0x2A: opcode_rol_accumulator(state); break;
-		case 0x26: opcode_rol(state, addressing_zeropage(state)); break;
-		case 0x36: opcode_rol(state, addressing_zeropagex(state)); break;
-		case 0x2E: opcode_rol(state, addressing_absolute(state)); break;
-		case 0x3E: opcode_rol(state, addressing_absolutex(state)); break;
-
-		case 0x6A: opcode_ror_accumulator(state); break;
-		case 0x66: opcode_ror(state, addressing_zeropage(state)); break;
-		case 0x76: opcode_ror(state, addressing_zeropagex(state)); break;
-		case 0x6E: opcode_ror(state, addressing_absolute(state)); break;
-		case 0x7E: opcode_ror(state, addressing_absolutex(state)); break;
-
-		//
-		// BITWISE
-		//
-
-		case 0x29: opcode_and(state, addressing_immediate(state)); break;
-		case 0x25: opcode_and(state, addressing_zeropage(state)); break;
-		case 0x35: opcode_and(state, addressing_zeropagex(state)); break;
-		case 0x2D: opcode_and(state, addressing_absolute(state)); break;
-		case 0x3D: opcode_and(state, addressing_absolutex(state)); break;
-		case 0x39: opcode_and(state, addressing_absolutey(state)); break;
-		case 0x21: opcode_and(state, addressing_indexedindirect(state)); break;
-		case 0x31: opcode_and(state, addressing_indirectindexed(state)); break;
-
-		case 0x09: opcode_ora(state, addressing_immediate(state)); break;
-		case 0x05: opcode_ora(state, addressing_zeropage(state)); break;
-		case 0x15: opcode_ora(state, addressing_zeropagex(state)); break;
-		case 0x0D: opcode_ora(state, addressing_absolute(state)); break;
-		case 0x1D: opcode_ora(state, addressing_absolutex(state)); break;
-		case 0x19: opcode_ora(state, addressing_absolutey(state)); break;
-		case 0x01: opcode_ora(state, addressing_indexedindirect(state)); break;
-		case 0x11: opcode_ora(state, addressing_indirectindexed(state)); break;
-
-		case 0x49: opcode_eor(state, addressing_immediate(state)); break;
-		case 0x45: opcode_eor(state, addressing_zeropage(state)); break;
-		case 0x55: opcode_eor(state, addressing_zeropagex(state)); break;
-		case 0x4D: opcode_eor(state, addressing_absolute(state)); break;
-		case 0x5D: opcode_eor(state, addressing_absolutex(state)); break;
-		case 0x59: opcode_eor(state, addressing_absolutey(state)); break;
-		case 0x41: opcode_eor(state, addressing_indexedindirect(state)); break;
-		case 0x51: opcode_eor(state, addressing_indirectindexed(state)); break;
-
-		case 0x24: opcode_bit(state, addressing_zeropage(state)); break;
-		case 0x2c: opcode_bit(state, addressing_absolute(state)); break;
-
-		//
-		// COMPARE
-		//
-
-		case 0xC9: opcode_cmp(state, addressing_immediate(state)); break;
-		case 0xC5: opcode_cmp(state, addressing_zeropage(state)); break;
-		case 0xD5: opcode_cmp(state, addressing_zeropagex(state)); break;
-		case 0xCD: opcode_cmp(state, addressing_absolute(state)); break;
-		case 0xDD: opcode_cmp(state, addressing_absolutex(state)); break;
-		case 0xD9: opcode_cmp(state, addressing_absolutey(state)); break;
-		case 0xC1: opcode_cmp(state, addressing_indexedindirect(state)); break;
-		case 0xD1: opcode_cmp(state, addressing_indirectindexed(state)); break;
-
-		case 0xE0: opcode_cpx(state, addressing_immediate(state)); break;
-		case 0xE4: opcode_cpx(state, addressing_zeropage(state)); break;
-		case 0xEC: opcode_cpx(state, addressing_absolute(state)); break;
-
-		case 0xC0: opcode_cpy(state, addressing_immediate(state)); break;
-		case 0xC4: opcode_cpy(state, addressing_zeropage(state)); break;
-		case 0xCC: opcode_cpy(state, addressing_absolute(state)); break;
-
-		//
-		// BRANCH
-		//
-
-		case 0x90: opcode_bcc(state, addressing_relative(state)); break;
-		case 0xB0: opcode_bcs(state, addressing_relative(state)); break;
-		case 0xF0: opcode_beq(state, addressing_relative(state)); break;
-		case 0xD0: opcode_bne(state, addressing_relative(state)); break;
-		case 0x10: opcode_bpl(state, addressing_relative(state)); break;
-		case 0x30: opcode_bmi(state, addressing_relative(state)); break;
-		case 0x50: opcode_bvc(state, addressing_relative(state)); break;
-		case 0x70: opcode_bvs(state, addressing_relative(state)); break;
-
-		//
-		// JUMP
-		//
-
-		case 0x4C: opcode_jmp(state, addressing_absolute(state)); break;
-		case 0x6C: opcode_jmp(state, addressing_indirect(state)); break;
-
-		case 0x20: opcode_jsr(state, addressing_absolute(state)); break;
-        case 0x60: opcode_rts(state); break;
-        case 0x00: opcode_brk(state); break;
-        case 0x40: opcode_rti(state); break;
-
-		//
-		// STACK
-		//
-		case 0x48: opcode_pha(state); break;
-		case 0x68: opcode_pla(state); break;
-		case 0x08: opcode_php(state); break;
-		case 0x28: opcode_plp(state); break;
-		case 0x9A: opcode_txs(state); break;
-		case 0xBA: opcode_tsx(state); break;
-
-		//
-		// FLAGS
-		//
-
-		case 0x18: opcode_clc(state); break;
-		case 0x38: opcode_sec(state); break;
-		case 0x58: opcode_cli(state); break;
-		case 0x78: opcode_sei(state); break;
-		case 0xD8: opcode_cld(state); break;
-		case 0xF8: opcode_sed(state); break;
-		case 0xB8: opcode_clv(state); break;
-
-		//
-		// OTHER
-		//
-
-		case 0xEA: opcode_nop(state); break;
+	return instruction;
+}
+
+static inline int cpu_breakpoint_reached(const cpu_breakpoints* breakpoints, const cpu* state) {
+	u16 address = state->program_counter;
+	if ((breakpoints->address_bits[address >> 3] & (1 << (address & 7))) == 0) {
+		return 0;
+	}
+
+	if (breakpoints->condition == NULL) {
+		return 1;
 	}
 
+	// Hand the condition a copy so the running state never has its address taken.
+	cpu snapshot = *state;
+	return breakpoints->condition(&snapshot, breakpoints->user_data);
+}
+
+// Runs at least one instruction, then keeps going until the cycle budget is used
+// up or a breakpoint is reached. The registers are worked on in a local copy that
+// is only written back once the batch is finished.
+static int cpu_run(cpu* state, u64 cycle_budget, const cpu_breakpoints* breakpoints) {
+	cpu local = *state;
+	nes_system* system = local.system;
+	system->cpu_stop_cycle = local.total_cycles + cycle_budget;
+	int breakpoint_reached = 0;
+
+#ifdef CPU_DISPATCH_COMPUTED_GOTO
+	// Every handler gets inlined behind its own label and ends with its own copy
+	// of the dispatch, so each opcode has a separately predicted indirect jump.
+	#define LABEL_ENTRY(code, ...) [0x##code] = &&label_##code,
+	static void* const labels[256] = {
+		CPU_OPCODES(LABEL_ENTRY, LABEL_ENTRY)
+	};
+
+	#define NEXT_INSTRUCTION() \
+		local.total_cycles += local.current_instruction_cycles; \
+		if (breakpoints != NULL && cpu_breakpoint_reached(breakpoints, &local)) { \
+			breakpoint_reached = 1; \
+			goto finished; \
+		} \
+		if (local.total_cycles >= system->cpu_stop_cycle) { \
+			goto finished; \
+		} \
+		goto *labels[cpu_fetch(&local)];
+
+	goto *labels[cpu_fetch(&local)];
+
+	#define LABEL_HANDLER(code, ...) label_##code: handler_##code(&local); NEXT_INSTRUCTION()
+	CPU_OPCODES(LABEL_HANDLER, LABEL_HANDLER)
+
+finished:
+#else
+	do {
+		opcode_table[cpu_fetch(&local)](&local);
+		local.total_cycles += local.current_instruction_cycles;
+
+		if (breakpoints != NULL && cpu_breakpoint_reached(breakpoints, &local)) {
+			breakpoint_reached = 1;
+			break;
+		}
+	} while (local.total_cycles < system->cpu_stop_cycle);
+#endif
+
+	*state = local;
+	return breakpoint_reached;
+}
+
+void cpu_execute_instruction(cpu* state) {
+	cpu_run(state, 0, NULL);
+}
+
+u64 cpu_run_cycles(cpu* state, u64 cycle_budget) {
+	u64 start_cycle = state->total_cycles;
+	cpu_run(state, cycle_budget, NULL);
+
+	return state->total_cycles - start_cycle;
+}
+
+int cpu_run_until(cpu* state, const cpu_breakpoints* breakpoints, u64 cycle_budget) {
+	return cpu_run(state, cycle_budget, breakpoints);
+}
+
+// Same as BRK except the opcode fetch is thrown away and the break flag isn't pushed.
+static void cpu_interrupt(cpu* state, u16 vector) {
+	state->current_instruction_cycles = 0;
+	cpu_read(state, state->program_counter);
+	cpu_read(state, state->program_counter);
+
+	cpu_write(state, state->stack_pointer + 0x0100, (state->program_counter & 0xFF00) >> 8);
+	state->stack_pointer--;
+	cpu_write(state, state->stack_pointer + 0x0100, state->program_counter & 0x00FF);
+	state->stack_pointer--;
+	cpu_write(state, state->stack_pointer + 0x0100, state->status.as_byte);
+	state->stack_pointer--;
+
+	state->status.interrupt_disable = 1;
+	state->interrupt_flag_changed = 0;
+
+	u8 low = cpu_read(state, vector);
+	u8 high = cpu_read(state, vector + 1);
+	state->program_counter = (high << 8) | low;
+
 	state->total_cycles += state->current_instruction_cycles;
 }
 
-u16 addressing_immediate(cpu* state) {
+void cpu_nmi(cpu* state) {
+	cpu_interrupt(state, 0xFFFA);
+}
+
+int cpu_irq(cpu* state) {
+	// Right after CLI, SEI or PLP the line was polled against the old flag
+	u8 disabled = state->interrupt_flag_changed ? state->previous_interrupt_flag : state->status.interrupt_disable;
+	if (disabled) {
+		return 0;
+	}
+
+	cpu_interrupt(state, 0xFFFE);
+	return 1;
+}
+
+int cpu_opcode_is_official(u8 opcode) {
+	#define OFFICIAL_ENTRY(code, ...) [0x##code] = 1,
+	static const u8 official[256] = {
+		CPU_OFFICIAL_OPCODES(OFFICIAL_ENTRY, OFFICIAL_ENTRY)
+	};
+
+	return official[opcode];
+}
+
+// How each addressing mode's operand is written, relative ones print the branch target
+typedef struct operand_format {
+	u8 length;
+	u8 relative;
+	const char* format;
+} operand_format;
+
+static const operand_format operand_format_implied = { 1, 0, "" };
+static const operand_format operand_format_immediate = { 2, 0, " #$%02X" };
+static const operand_format operand_format_zeropage = { 2, 0, " $%02X" };
+static const operand_format operand_format_zeropagex = { 2, 0, " $%02X,X" };
+static const operand_format operand_format_zeropagey = { 2, 0, " $%02X,Y" };
+static const operand_format operand_format_absolute = { 3, 0, " $%04X" };
+static const operand_format operand_format_absolutex = { 3, 0, " $%04X,X" };
+static const operand_format operand_format_absolutey = { 3, 0, " $%04X,Y" };
+static const operand_format operand_format_indirect = { 3, 0, " ($%04X)" };
+static const operand_format operand_format_indexedindirect = { 2, 0, " ($%02X,X)" };
+static const operand_format operand_format_indirectindexed = { 2, 0, " ($%02X),Y" };
+static const operand_format operand_format_relative = { 2, 1, " $%04X" };
+#define operand_format_absolutex_write operand_format_absolutex
+#define operand_format_absolutey_write operand_format_absolutey
+#define operand_format_indirectindexed_write operand_format_indirectindexed
+
+typedef struct disassembly_entry {
+	const char* name;
+	const operand_format* operand;
+} disassembly_entry;
+
+u32 cpu_disassemble(u16 address, const u8* bytes, char* text, u32 text_size) {
+	#define DISASSEMBLY_ENTRY(code, opcode, addressing) [0x##code] = { #opcode, &operand_format_##addressing },
+	#define DISASSEMBLY_ENTRY_IMPLIED(code, opcode) [0x##code] = { #opcode, &operand_format_implied },
+	static const disassembly_entry entries[256] = {
+		CPU_OFFICIAL_OPCODES(DISASSEMBLY_ENTRY, DISASSEMBLY_ENTRY_IMPLIED)
+	};
+
+	// Unofficial opcodes run as one byte NOPs here
+	const disassembly_entry* entry = &entries[bytes[0]];
+	if (entry->name == NULL) {
+		snprintf(text, text_size, "*NOP");
+		return 1;
+	}
+
+	// The handler names are the mnemonics, with _accumulator on the shifts that work on A
+	char mnemonic[4];
+	for (u32 i = 0; i < 3; i++) {
+		mnemonic[i] = entry->name[i] - 'a' + 'A';
+	}
+	mnemonic[3] = '\0';
+
+	// JSR only runs with immediate addressing to get its cycles right (see opcode_jsr),
+	// its operand is a whole absolute address
+	const operand_format* operand = bytes[0] == 0x20 ? &operand_format_absolute : entry->operand;
+	u16 value = operand->length == 3 ? (bytes[2] << 8) | bytes[1] : bytes[1];
+	if (operand->relative) {
+		value = address + 2 + (i8)bytes[1];
+	}
+
+	int written = snprintf(text, text_size, "%s", mnemonic);
+	if (entry->name[3] == '_') {
+		snprintf(text + written, text_size - written, " A");
+	}
+	else {
+		snprintf(text + written, text_size - written, operand->format, value);
+	}
+
+	return operand->length;
+}
+
+void cpu_breakpoints_clear(cpu_breakpoints* breakpoints) {
+	for (u32 i = 0; i < sizeof(breakpoints->address_bits); i++) {
+		breakpoints->address_bits[i] = 0x00;
+	}
+
+	breakpoints->condition = NULL;
+	breakpoints->user_data = NULL;
+}
+
+void cpu_breakpoints_add(cpu_breakpoints* breakpoints, u16 address) {
+	breakpoints->address_bits[address >> 3] |= 1 << (address & 7);
+}
+
+void cpu_breakpoints_remove(cpu_breakpoints* breakpoints, u16 address) {
+	breakpoints->address_bits[address >> 3] &= ~(1 << (address & 7));
+}
+
+static inline u16 addressing_immediate(cpu* state) {
 	return state->program_counter++;
 }
 
-u16 addressing_zeropage(cpu* state) {
-	u8 address = cpubus_read(state->program_counter);
+static inline u16 addressing_zeropage(cpu* state) {
+	u8 address = cpu_read(state, state->program_counter);
 	state->program_counter++;
-	state->current_instruction_cycles += 1;
 
 	return address;
 }
 
-u16 addressing_zeropagex(cpu* state) {
-	u8 address = cpubus_read(state->program_counter) + state->register_x;
+// The CPU reads the unindexed address while it adds the index, the result wraps around in the zero page
+static inline u16 addressing_zeropagex(cpu* state) {
+	u8 base = cpu_read(state, state->program_counter);
 	state->program_counter++;
-	state->current_instruction_cycles += 2;
+	cpu_read(state, base);
 
-	return address;
+	return (u8)(base + state->register_x);
 }
 
-u16 addressing_zeropagey(cpu* state) {
-	u8 address = cpubus_read(state->program_counter) + state->register_y;
+static inline u16 addressing_zeropagey(cpu* state) {
+	u8 base = cpu_read(state, state->program_counter);
 	state->program_counter++;
-	state->current_instruction_cycles += 2;
+	cpu_read(state, base);
 
-	return address;
+	return (u8)(base + state->register_y);
 }
 
-u16 addressing_absolute(cpu* state) {
-	u16 address = cpubus_read(state->program_counter) | (cpubus_read(state->program_counter + 1) << 8);
+static inline u16 addressing_absolute(cpu* state) {
+	u8 low = cpu_read(state, state->program_counter);
+	u8 high = cpu_read(state, state->program_counter + 1);
 	state->program_counter += 2;
-	state->current_instruction_cycles += 2;
 
-	return address;
+	return (high << 8) | low;
 }
 
-u16 addressing_absolutex(cpu* state) {
-	u16 base = cpubus_read(state->program_counter) | (cpubus_read(state->program_counter + 1) << 8);
-	u16 address = base + state->register_x;
-	state->program_counter += 2;
-	state->current_instruction_cycles += 3;
+// The index is added to the low byte first and the CPU reads from that address
+// while it carries into the high byte. Reads skip that cycle when no page is
+// crossed, stores and read-modify-write instructions always take it.
+static inline u16 addressing_indexed(cpu* state, u16 base, u8 index, int always_fix) {
+	u16 address = base + index;
 
-	if ((base & 0xFF00) != (address & 0xFF00)) {
-		state->current_instruction_cycles += 1;
+	if (always_fix || (base & 0xFF00) != (address & 0xFF00)) {
+		cpu_read(state, (base & 0xFF00) | (address & 0x00FF));
 	}
 
 	return address;
 }
 
-u16 addressing_absolutey(cpu* state) {
-	u16 base = cpubus_read(state->program_counter) | (cpubus_read(state->program_counter + 1) << 8);
-	u16 address = base + state->register_y;
-	state->program_counter += 2;
-	state->current_instruction_cycles += 3;
+static inline u16 addressing_absolutex(cpu* state) {
+	return addressing_indexed(state, addressing_absolute(state), state->register_x, 0);
+}
 
-	if ((base & 0xFF00) != (address & 0xFF00)) {
-		state->current_instruction_cycles += 1;
-	}
+static inline u16 addressing_absolutex_write(cpu* state) {
+	return addressing_indexed(state, addressing_absolute(state), state->register_x, 1);
+}
 
-	return address;
+static inline u16 addressing_absolutey(cpu* state) {
+	return addressing_indexed(state, addressing_absolute(state), state->register_y, 0);
 }
 
-u16 addressing_indirect(cpu* state) {
-	u16 pointer = cpubus_read(state->program_counter) | (cpubus_read(state->program_counter + 1) << 8);
+static inline u16 addressing_absolutey_write(cpu* state) {
+	return addressing_indexed(state, addressing_absolute(state), state->register_y, 1);
+}
 
-	u8 low = cpubus_read(pointer);
-	u8 high;
+static inline u16 addressing_indirect(cpu* state) {
+	u16 pointer = addressing_absolute(state);
 
 	// Bug where if low byte on page boundary then high byte wraps around to page start
-	if ((pointer & 0x00FF) == 0x00FF) {
-		high = cpubus_read(pointer & 0xFF00);
-	}
-	else {
-		high = cpubus_read(pointer + 1);
-	}
+	u8 low = cpu_read(state, pointer);
+	u8 high = cpu_read(state, (pointer & 0xFF00) | ((pointer + 1) & 0x00FF));
 
 	return (high << 8) | low;
 }
 
-u16 addressing_indexedindirect(cpu* state) {
-	u8 pointer = cpubus_read(state->program_counter) + state->register_x;
+static inline u16 addressing_indexedindirect(cpu* state) {
+	u8 pointer = cpu_read(state, state->program_counter);
 	state->program_counter++;
 
-	u16 address = (u16)cpubus_read(pointer) | (u16)(cpubus_read((pointer + 1) & 0xFF) << 8);
-	state->current_instruction_cycles += 4;
+	cpu_read(state, pointer);
+	pointer += state->register_x;
 
-	return address;
+	u8 low = cpu_read(state, pointer);
+	u8 high = cpu_read(state, (u8)(pointer + 1));
+
+	return (high << 8) | low;
 }
 
-u16 addressing_indirectindexed(cpu* state) {
-	u8 pointer = cpubus_read(state->program_counter);
+static inline u16 addressing_indirectindexed_base(cpu* state) {
+	u8 pointer = cpu_read(state, state->program_counter);
 	state->program_counter++;
 
-	u16 base = (u16)cpubus_read(pointer) | (u16)(cpubus_read((pointer + 1) & 0xFF) << 8);
-	u16 address = base + state->register_y;
+	u8 low = cpu_read(state, pointer);
+	u8 high = cpu_read(state, (u8)(pointer + 1));
 
-	state->current_instruction_cycles += 4;
-	if ((base & 0xFF00) != (address & 0xFF00)) {
-		state->current_instruction_cycles += 1;
-	}
+	return (high << 8) | low;
+}
 
-	return address;
+static inline u16 addressing_indirectindexed(cpu* state) {
+	return addressing_indexed(state, addressing_indirectindexed_base(state), state->register_y, 0);
+}
+
+static inline u16 addressing_indirectindexed_write(cpu* state) {
+	return addressing_indexed(state, addressing_indirectindexed_base(state), state->register_y, 1);
 }
 
-i8 addressing_relative(cpu* state) {
-	i8 value = (i8)cpubus_read(state->program_counter);
+static inline i8 addressing_relative(cpu* state) {
+	i8 value = (i8)cpu_read(state, state->program_counter);
 	state->program_counter++;
-	state->current_instruction_cycles += 1;
 
 	return value;
 }
@@ -477,76 +799,66 @@ i8 addressing_relative(cpu* state) {
 // ACCESS
 //
 
-void opcode_lda(cpu* state, u16 address) {
-	state->accumulator = cpubus_read(address);
-	state->current_instruction_cycles += 1;
+static inline void opcode_lda(cpu* state, u16 address) {
+	state->accumulator = cpu_read(state, address);
 
 	state->status.zero_flag = !state->accumulator;
 	state->status.negative_flag = (state->accumulator & (1 << 7)) != 0;
 }
 
-void opcode_sta(cpu* state, u16 address) {
-	cpubus_write(address, state->accumulator);
-	state->current_instruction_cycles += 1;
+static inline void opcode_sta(cpu* state, u16 address) {
+	cpu_write(state, address, state->accumulator);
 }
 
-void opcode_ldx(cpu* state, u16 address) {
-	state->register_x = cpubus_read(address);
-	state->current_instruction_cycles += 1;
+static inline void opcode_ldx(cpu* state, u16 address) {
+	state->register_x = cpu_read(state, address);
 
 	state->status.zero_flag = !state->register_x;
 	state->status.negative_flag = (state->register_x & (1 << 7)) != 0;
 }
 
-void opcode_stx(cpu* state, u16 address) {
-	cpubus_write(address, state->register_x);
-	state->current_instruction_cycles += 1;
+static inline void opcode_stx(cpu* state, u16 address) {
+	cpu_write(state, address, state->register_x);
 }
 
-void opcode_ldy(cpu* state, u16 address) {
-	state->register_y = cpubus_read(address);
-	state->current_instruction_cycles += 1;
+static inline void opcode_ldy(cpu* state, u16 address) {
+	state->register_y = cpu_read(state, address);
 
 	state->status.zero_flag = !state->register_y;
 	state->status.negative_flag = (state->register_y & (1 << 7)) == (1 << 7);
 }
 
-void opcode_sty(cpu* state, u16 address) {
-	cpubus_write(address, state->register_y);
-	state->current_instruction_cycles += 1;
+static inline void opcode_sty(cpu* state, u16 address) {
+	cpu_write(state, address, state->register_y);
 }
 
 //
 // TRANSFER
 //
 
-void opcode_tax(cpu* state) {
+static inline void opcode_tax(cpu* state) {
 	state->register_x = state->accumulator;
-	state->current_instruction_cycles += 1;
 
 	state->status.zero_flag = !state->register_x;
 	state->status.negative_flag = (state->register_x & (1 << 7)) != 0;
 }
 
-void opcode_tay(cpu* state) {
+static inline void opcode_tay(cpu* state) {
 	state->register_y = state->accumulator;
-	state->current_instruction_cycles += 1;
 
 	state->status.zero_flag = !state->register_y;
 	state->status.negative_flag = (state->register_y & (1 << 7)) == (1 << 7);
 }
 
-void opcode_txa(cpu* state) {
+static inline void opcode_txa(cpu* state) {
 	state->accumulator = state->register_x;
-	state->current_instruction_cycles += 1;
 
 	state->status.zero_flag = !state->accumulator;
 	state->status.negative_flag = (state->accumulator & (1 << 7)) != 0;
 }
 
-void opcode_tya(cpu* state) {
+static inline void opcode_tya(cpu* state) {
 	state->accumulator = state->register_y;
-	state->current_instruction_cycles += 1;
 
 	state->status.zero_flag = !state->accumulator;
 	state->status.negative_flag = (state->accumulator & (1 << 7)) != 0;
@@ -556,10 +868,9 @@ void opcode_tya(cpu* state) {
 // ARITHMETIC
 //
 
-void opcode_adc(cpu* state, u16 address) {
-	u8 memory = cpubus_read(address);
+static inline void opcode_adc(cpu* state, u16 address) {
+	u8 memory = cpu_read(state, address);
 	u16 result = state->accumulator + memory + state->status.carry_flag;
-	state->current_instruction_cycles += 1;
 
 	state->status.carry_flag = result > 0x00FF;
 	state->status.zero_flag = (u8)result == 0x00;
@@ -569,10 +880,9 @@ void opcode_adc(cpu* state, u16 address) {
 	state->accumulator = result & 0xFF;
 }
 
-void opcode_sbc(cpu* state, u16 address) {
-	u8 memory = cpubus_read(address);
+static inline void opcode_sbc(cpu* state, u16 address) {
+	u8 memory = cpu_read(state, address);
 	u16 result = state->accumulator - memory - (1 - state->status.carry_flag);
-	state->current_instruction_cycles += 1;
 
 	state->status.carry_flag = result < 0x0100;
 	state->status.zero_flag = (u8)result == 0x00;
@@ -582,57 +892,51 @@ void opcode_sbc(cpu* state, u16 address) {
 	state->accumulator = result & 0xFF;
 }
 
-void opcode_inc(cpu* state, u16 address) {
-	u8 value = cpubus_read(address);
+static inline void opcode_inc(cpu* state, u16 address) {
+	u8 value = cpu_read(state, address);
 	u8 result = value + 1;
 
-	cpubus_write(address, value);
-	cpubus_write(address, result);
-	state->current_instruction_cycles += 3;
+	cpu_write(state, address, value);
+	cpu_write(state, address, result);
 
 	state->status.zero_flag = !result;
 	state->status.negative_flag = (result & (1 << 7)) != 0;
 }
 
-void opcode_dec(cpu* state, u16 address) {
-	u8 value = cpubus_read(address);
+static inline void opcode_dec(cpu* state, u16 address) {
+	u8 value = cpu_read(state, address);
 	u8 result = value - 1;
 
-	cpubus_write(address, value);
-	cpubus_write(address, result);
-	state->current_instruction_cycles += 3;
+	cpu_write(state, address, value);
+	cpu_write(state, address, result);
 
 	state->status.zero_flag = !result;
 	state->status.negative_flag = (result & (1 << 7)) != 0;
 }
 
-void opcode_inx(cpu* state) {
+static inline void opcode_inx(cpu* state) {
 	state->register_x += 1;
-	state->current_instruction_cycles += 1;
 
 	state->status.zero_flag = !state->register_x;
 	state->status.negative_flag = (state->register_x & (1 << 7)) != 0;
 }
 
-void opcode_dex(cpu* state) {
+static inline void opcode_dex(cpu* state) {
 	state->register_x -= 1;
-	state->current_instruction_cycles += 1;
 
 	state->status.zero_flag = !state->register_x;
 	state->status.negative_flag = (state->register_x & (1 << 7)) != 0;
 }
 
-void opcode_iny(cpu* state) {
+static inline void opcode_iny(cpu* state) {
 	state->register_y += 1;
-	state->current_instruction_cycles += 1;
 
 	state->status.zero_flag = !state->register_y;
 	state->status.negative_flag = (state->register_y & (1 << 7)) != 0;
 }
 
-void opcode_dey(cpu* state) {
+static inline void opcode_dey(cpu* state) {
 	state->register_y -= 1;
-	state->current_instruction_cycles += 1;
 
 	state->status.zero_flag = !state->register_y;
 	state->status.negative_flag = (state->register_y & (1 << 7)) != 0;
@@ -642,44 +946,38 @@ void opcode_dey(cpu* state) {
 // SHIFT
 //
 
-void opcode_asl(cpu* state, u16 address) {
-	u8 value = cpubus_read(address);
+static inline void opcode_asl(cpu* state, u16 address) {
+	u8 value = cpu_read(state, address);
 	u8 result = value << 1;
 
-	cpubus_write(address, value);
-	cpubus_write(address, result);
+	cpu_write(state, address, value);
+	cpu_write(state, address, result);
 
 	state->status.carry_flag = (value & (1 << 7)) == (1 << 7);
 	state->status.zero_flag = !result;
 	state->status.negative_flag = (result & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 3;
 }
 
-void opcode_asl_accumulator(cpu* state) {
+static inline void opcode_asl_accumulator(cpu* state) {
 	state->status.carry_flag = (state->accumulator & (1 << 7)) == (1 << 7);
 	state->accumulator = state->accumulator << 1;
 	state->status.zero_flag = !state->accumulator;
 	state->status.negative_flag = (state->accumulator & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_lsr(cpu* state, u16 address) {
-	u8 value = cpubus_read(address);
+static inline void opcode_lsr(cpu* state, u16 address) {
+	u8 value = cpu_read(state, address);
 	u8 result = value >> 1;
 
-	cpubus_write(address, value);
-	cpubus_write(address, result);
+	cpu_write(state, address, value);
+	cpu_write(state, address, result);
 
 	state->status.carry_flag = (value & 1) == 1;
 	state->status.zero_flag = !result;
 	state->status.negative_flag = (result & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 3;
 }
 
-void opcode_lsr_accumulator(cpu* state) {
+static inline void opcode_lsr_accumulator(cpu* state) {
 	u8 value = state->accumulator;
 	u8 result = value >> 1;
 
@@ -688,25 +986,21 @@ void opcode_lsr_accumulator(cpu* state) {
 	state->status.carry_flag = value & 1;
 	state->status.zero_flag = !result;
 	state->status.negative_flag = (result & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 3;
 }
 
-void opcode_rol(cpu* state, u16 address) {
-	u8 value = cpubus_read(address);
+static inline void opcode_rol(cpu* state, u16 address) {
+	u8 value = cpu_read(state, address);
 	u8 result = (value << 1) | state->status.carry_flag;
 
-	cpubus_write(address, value);
-	cpubus_write(address, result);
+	cpu_write(state, address, value);
+	cpu_write(state, address, result);
 
 	state->status.carry_flag = (value & (1 << 7)) == (1 << 7);
 	state->status.zero_flag = !result;
 	state->status.negative_flag = (result & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 3;
 }
 
-void opcode_rol_accumulator(cpu* state) {
+static inline void opcode_rol_accumulator(cpu* state) {
 	u8 value = state->accumulator;
 	u8 result = (value << 1) | state->status.carry_flag;
 
@@ -717,20 +1011,19 @@ void opcode_rol_accumulator(cpu* state) {
 	state->status.negative_flag = (result & (1 << 7)) != 0;
 }
 
-void opcode_ror(cpu* state, u16 address) {
-	u8 value = cpubus_read(address);
+static inline void opcode_ror(cpu* state, u16 address) {
+	u8 value = cpu_read(state, address);
 	u8 result = (value >> 1) | (state->status.carry_flag << 7);
 
-	cpubus_write(address, value);
-	cpubus_write(address, result);
+	cpu_write(state, address, value);
+	cpu_write(state, address, result);
 
 	state->status.carry_flag = (value & 1) != 0;
 	state->status.zero_flag = !result;
 	state->status.negative_flag = (result & (1 << 7)) != 0;
-
 }
 
-void opcode_ror_accumulator(cpu* state) {
+static inline void opcode_ror_accumulator(cpu* state) {
 	u8 value = state->accumulator;
 	u8 result = (value >> 1) | (state->status.carry_flag << 7);
 
@@ -745,190 +1038,126 @@ void opcode_ror_accumulator(cpu* state) {
 // BITWISE
 //
 
-void opcode_and(cpu* state, u16 address) {
-	state->accumulator = state->accumulator & cpubus_read(address);
+static inline void opcode_and(cpu* state, u16 address) {
+	state->accumulator = state->accumulator & cpu_read(state, address);
 
 	state->status.zero_flag = !state->accumulator;
 	state->status.negative_flag = (state->accumulator & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_ora(cpu* state, u16 address) {
-	state->accumulator = state->accumulator | cpubus_read(address);
+static inline void opcode_ora(cpu* state, u16 address) {
+	state->accumulator = state->accumulator | cpu_read(state, address);
 
 	state->status.zero_flag = !state->accumulator;
 	state->status.negative_flag = (state->accumulator & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_eor(cpu* state, u16 address) {
-	state->accumulator = state->accumulator ^ cpubus_read(address);
+static inline void opcode_eor(cpu* state, u16 address) {
+	state->accumulator = state->accumulator ^ cpu_read(state, address);
 
 	state->status.zero_flag = !state->accumulator;
 	state->status.negative_flag = (state->accumulator & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_bit(cpu* state, u16 address) {
-	u8 value = cpubus_read(address);
+static inline void opcode_bit(cpu* state, u16 address) {
+	u8 value = cpu_read(state, address);
 
 	state->status.zero_flag = !(state->accumulator & value);
 	state->status.negative_flag = (value & (1 << 7)) != 0;
 	state->status.overflow_flag = (value & (1 << 6)) == (1 << 6);
-
-	state->current_instruction_cycles += 1;
 }
 
 //
 // COMPARE
 //
 
-void opcode_cmp(cpu* state, u16 address) {
-	u8 value = cpubus_read(address);
+static inline void opcode_cmp(cpu* state, u16 address) {
+	u8 value = cpu_read(state, address);
 
 	state->status.carry_flag = state->accumulator >= value;
 	state->status.zero_flag = state->accumulator == value;
 	state->status.negative_flag = ((state->accumulator - value) & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_cpx(cpu* state, u16 address) {
-	u8 value = cpubus_read(address);
+static inline void opcode_cpx(cpu* state, u16 address) {
+	u8 value = cpu_read(state, address);
 
 	state->status.carry_flag = state->register_x >= value;
 	state->status.zero_flag = state->register_x == value;
 	state->status.negative_flag = ((state->register_x - value) & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_cpy(cpu* state, u16 address) {
-	u8 value = cpubus_read(address);
+static inline void opcode_cpy(cpu* state, u16 address) {
+	u8 value = cpu_read(state, address);
 
 	state->status.carry_flag = state->register_y >= value;
 	state->status.zero_flag = state->register_y == value;
 	state->status.negative_flag = ((state->register_y - value) & (1 << 7)) != 0;
-
-	state->current_instruction_cycles += 1;
 }
 
 //
 // BRANCH
 //
 
-void opcode_bcc(cpu* state, i8 address) {
+// A taken branch reads the next opcode while it adds the offset, and reads once
+// more from the old page if the high byte of the program counter has to change.
+static inline void cpu_branch(cpu* state, i8 offset) {
+	u16 base = state->program_counter;
+	u16 target = base + offset;
+
+	cpu_read(state, base);
+	if ((base & 0xFF00) != (target & 0xFF00)) {
+		cpu_read(state, (base & 0xFF00) | (target & 0x00FF));
+	}
+
+	state->program_counter = target;
+}
+
+static inline void opcode_bcc(cpu* state, i8 address) {
 	if (!state->status.carry_flag) {
-		u16 base = state->program_counter;
-		u16 target = base + address;
-		
-		state->program_counter = target;
-
-		state->current_instruction_cycles += 1;
-		if ((base & 0x00FF) != (base & 0x00FF)) {
-			state->current_instruction_cycles += 1;
-		}
+		cpu_branch(state, address);
 	}
 }
 
-void opcode_bcs(cpu* state, i8 address) {
+static inline void opcode_bcs(cpu* state, i8 address) {
 	if (state->status.carry_flag) {
-		u16 base = state->program_counter;
-		u16 target = base + address;
-		
-		state->program_counter = target;
-
-		state->current_instruction_cycles += 1;
-		if ((base & 0x00FF) != (base & 0x00FF)) {
-			state->current_instruction_cycles += 1;
-		}
+		cpu_branch(state, address);
 	}
 }
 
-void opcode_beq(cpu* state, i8 address) {
+static inline void opcode_beq(cpu* state, i8 address) {
 	if (state->status.zero_flag) {
-		u16 base = state->program_counter;
-		u16 target = base + address;
-		
-		state->program_counter = target;
-
-		state->current_instruction_cycles += 1;
-		if ((base & 0x00FF) != (base & 0x00FF)) {
-			state->current_instruction_cycles += 1;
-		}
+		cpu_branch(state, address);
 	}
 }
 
-void opcode_bne(cpu* state, i8 address) {
+static inline void opcode_bne(cpu* state, i8 address) {
 	if (!state->status.zero_flag) {
-		u16 base = state->program_counter;
-		u16 target = base + address;
-		
-		state->program_counter = target;
-
-		state->current_instruction_cycles += 1;
-		if ((base & 0x00FF) != (base & 0x00FF)) {
-			state->current_instruction_cycles += 1;
-		}
+		cpu_branch(state, address);
 	}
 }
 
-void opcode_bpl(cpu* state, i8 address) {
+static inline void opcode_bpl(cpu* state, i8 address) {
 	if (!state->status.negative_flag) {
-		u16 base = state->program_counter;
-		u16 target = base + (i16)address;
-		
-		state->program_counter = target;
-
-		state->current_instruction_cycles += 1;
-		if ((base & 0x00FF) != (target & 0x00FF)) {
-			state->current_instruction_cycles += 1;
-		}
+		cpu_branch(state, address);
 	}
 }
 
-void opcode_bmi(cpu* state, i8 address) {
+static inline void opcode_bmi(cpu* state, i8 address) {
 	if (state->status.negative_flag) {
-		u16 base = state->program_counter;
-		u16 target = base + address;
-		
-		state->program_counter = target;
-
-		state->current_instruction_cycles += 1;
-		if ((base & 0x00FF) != (base & 0x00FF)) {
-			state->current_instruction_cycles += 1;
-		}
+		cpu_branch(state, address);
 	}
 }
 
-void opcode_bvc(cpu* state, i8 address) {
+static inline void opcode_bvc(cpu* state, i8 address) {
 	if (!state->status.overflow_flag) {
-		u16 base = state->program_counter;
-		u16 target = base + address;
-		
-		state->program_counter = target;
-
-		state->current_instruction_cycles += 1;
-		if ((base & 0x00FF) != (base & 0x00FF)) {
-			state->current_instruction_cycles += 1;
-		}
+		cpu_branch(state, address);
 	}
 }
 
-void opcode_bvs(cpu* state, i8 address) {
+static inline void opcode_bvs(cpu* state, i8 address) {
 	if (state->status.overflow_flag) {
-		u16 base = state->program_counter;
-		u16 target = base + address;
-		
-		state->program_counter = target;
-
-		state->current_instruction_cycles += 1;
-		if ((base & 0x00FF) != (base & 0x00FF)) {
-			state->current_instruction_cycles += 1;
-		}
+		cpu_branch(state, address);
 	}
 }
 
@@ -936,172 +1165,167 @@ void opcode_bvs(cpu* state, i8 address) {
 // JUMP
 //
 
-void opcode_jmp(cpu* state, u16 address) {
+static inline void opcode_jmp(cpu* state, u16 address) {
 	state->program_counter = address;
 }
 
-void opcode_jsr(cpu* state, u16 address) {
-	state->program_counter--;
-	cpubus_write(state->stack_pointer + 0x0100, (state->program_counter & 0xFF00) >> 8);
+// JSR reads the high byte of its target only after pushing the return address,
+// so it's decoded with immediate addressing and `address` points at the low byte.
+static inline void opcode_jsr(cpu* state, u16 address) {
+	u8 low = cpu_read(state, address);
+	cpu_read(state, state->stack_pointer + 0x0100);
+
+	cpu_write(state, state->stack_pointer + 0x0100, (state->program_counter & 0xFF00) >> 8);
 	state->stack_pointer--;
-	cpubus_write(state->stack_pointer + 0x0100, state->program_counter & 0x00FF);
+	cpu_write(state, state->stack_pointer + 0x0100, state->program_counter & 0x00FF);
 	state->stack_pointer--;
 
-	state->program_counter = address;
-
-	state->current_instruction_cycles += 3;
+	u8 high = cpu_read(state, state->program_counter);
+	state->program_counter = (high << 8) | low;
 }
 
-void opcode_rts(cpu* state) {
+static inline void opcode_rts(cpu* state) {
+	cpu_read(state, state->stack_pointer + 0x0100);
+
 	state->stack_pointer++;
-	u8 low = cpubus_read(state->stack_pointer + 0x0100);
+	u8 low = cpu_read(state, state->stack_pointer + 0x0100);
 	state->stack_pointer++;
-	u8 high = cpubus_read(state->stack_pointer + 0x0100);
+	u8 high = cpu_read(state, state->stack_pointer + 0x0100);
 
-	u16 address = (high << 8) | low;
-	state->program_counter = address + 1;
-
-	state->current_instruction_cycles += 3;
+	state->program_counter = (high << 8) | low;
+	cpu_read(state, state->program_counter);
+	state->program_counter++;
 }
 
-void opcode_brk(cpu* state) {
+static inline void opcode_brk(cpu* state) {
 	state->program_counter++;
-	cpubus_write(state->stack_pointer + 0x0100, (state->program_counter & 0xFF00) >> 8);
+	cpu_write(state, state->stack_pointer + 0x0100, (state->program_counter & 0xFF00) >> 8);
 	state->stack_pointer--;
-	cpubus_write(state->stack_pointer + 0x0100, state->program_counter & 0x00FF);
+	cpu_write(state, state->stack_pointer + 0x0100, state->program_counter & 0x00FF);
 	state->stack_pointer--;
 
 	state->status.break_flag = 1;
-	cpubus_write(state->stack_pointer + 0x0100, state->status.as_byte);
+	cpu_write(state, state->stack_pointer + 0x0100, state->status.as_byte);
 	state->stack_pointer--;
 	state->status.break_flag = 0;
 
 	state->status.interrupt_disable = 1;
 
-	u8 low = cpubus_read(0xFFFE);
-	u8 high = cpubus_read(0xFFFF);
+	u8 low = cpu_read(state, 0xFFFE);
+	u8 high = cpu_read(state, 0xFFFF);
 	state->program_counter = (high << 8) | low;
-
-	state->current_instruction_cycles += 6;
 }
 
-void opcode_rti(cpu* state) {
+static inline void opcode_rti(cpu* state) {
+	cpu_read(state, state->stack_pointer + 0x0100);
+
 	state->stack_pointer++;
-	state->status.as_byte = cpubus_read(state->stack_pointer + 0x0100);
+	state->status.as_byte = cpu_read(state, state->stack_pointer + 0x0100);
 	state->status.unused = 1;
 	state->status.break_flag = 0;
 
 	state->stack_pointer++;
-    u8 low = cpubus_read(state->stack_pointer + 0x0100);
-    state->stack_pointer++;
-    u8 high = cpubus_read(state->stack_pointer + 0x0100);
+	u8 low = cpu_read(state, state->stack_pointer + 0x0100);
+	state->stack_pointer++;
+	u8 high = cpu_read(state, state->stack_pointer + 0x0100);
 
 	state->program_counter = (high << 8) | low;
-	state->current_instruction_cycles += 5;
+
+	// Unlike CLI and PLP the restored flag counts straight away
+	cpu_poll_irq(state);
 }
 
 //
 // STACK
 //
 
-void opcode_pha(cpu* state) {
-	cpubus_write(state->stack_pointer + 0x0100, state->accumulator);
+static inline void opcode_pha(cpu* state) {
+	cpu_write(state, state->stack_pointer + 0x0100, state->accumulator);
 	state->stack_pointer--;
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_pla(cpu* state) {
+static inline void opcode_pla(cpu* state) {
+	cpu_read(state, state->stack_pointer + 0x0100);
 	state->stack_pointer++;
-	state->accumulator = cpubus_read(state->stack_pointer + 0x0100);
+	state->accumulator = cpu_read(state, state->stack_pointer + 0x0100);
 
 	state->status.zero_flag = !state->accumulator;
 	state->status.negative_flag = (state->accumulator & (1 << 7)) == (1 << 7);
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_php(cpu* state) {
+static inline void opcode_php(cpu* state) {
 	state->status.break_flag = 1;
-	cpubus_write(state->stack_pointer + 0x0100, state->status.as_byte);
+	cpu_write(state, state->stack_pointer + 0x0100, state->status.as_byte);
 	state->status.break_flag = 0;
 	state->stack_pointer--;
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_plp(cpu* state) {
+static inline void opcode_plp(cpu* state) {
+	cpu_read(state, state->stack_pointer + 0x0100);
 	state->stack_pointer++;
-	state->status.as_byte = cpubus_read(state->stack_pointer + 0x0100);
+
+	state->previous_interrupt_flag = state->status.interrupt_disable;
+	state->status.as_byte = cpu_read(state, state->stack_pointer + 0x0100);
+	state->interrupt_flag_changed = 1;
 
 	state->status.break_flag = 0;
 	state->status.unused = 1;
-
-	state->current_instruction_cycles += 4;
 }
 
-void opcode_tsx(cpu* state) {
+static inline void opcode_tsx(cpu* state) {
 	state->register_x = state->stack_pointer;
-	state->current_instruction_cycles += 1;
 
 	state->status.zero_flag = !state->register_x;
 	state->status.negative_flag = ((state->register_x) & (1 << 7)) != 0;
 }
 
-void opcode_txs(cpu* state) {
+static inline void opcode_txs(cpu* state) {
 	state->stack_pointer = state->register_x;
-	state->current_instruction_cycles += 1;
 }
 
 //
 // FLAGS
 //
 
-void opcode_clc(cpu* state) {
+static inline void opcode_clc(cpu* state) {
 	state->status.carry_flag = 0;
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_sec(cpu* state) {
+static inline void opcode_sec(cpu* state) {
 	state->status.carry_flag = 1;
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_cli(cpu* state) {
+static inline void opcode_cli(cpu* state) {
 	state->previous_interrupt_flag = state->status.interrupt_disable;
 	state->status.interrupt_disable = 0;
 	state->interrupt_flag_changed = 1;
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_sei(cpu* state) {
+static inline void opcode_sei(cpu* state) {
 	state->previous_interrupt_flag = state->status.interrupt_disable;
 	state->status.interrupt_disable = 1;
 	state->interrupt_flag_changed = 1;
-
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_cld(cpu* state) {
+static inline void opcode_cld(cpu* state) {
 	state->status.decimal_flag = 0;
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_sed(cpu* state) {
+static inline void opcode_sed(cpu* state) {
 	state->status.decimal_flag = 1;
-	state->current_instruction_cycles += 1;
 }
 
-void opcode_clv(cpu* state) {
+static inline void opcode_clv(cpu* state) {
 	state->status.overflow_flag = 0;
-	state->current_instruction_cycles += 1;
 }
 
 //
 // OTHER
 //
 
-void opcode_nop(cpu* state) {
-	state->current_instruction_cycles += 1;
+static inline void opcode_nop(cpu* state) {
+}
+
+// Unofficial opcodes aren't implemented yet, they only consume the opcode byte.
+static inline void opcode_unofficial(cpu* state) {
 }
\ No newline at end of file
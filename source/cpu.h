@@ -2,6 +2,9 @@
 
 #include "types.h"
 
+typedef struct nes_system nes_system;
+typedef struct trace_ring trace_ring;
+
 union status {
 	struct {
 		u8 carry_flag : 1;
@@ -17,6 +20,8 @@ union status {
 };
 
 typedef struct cpu {
+	nes_system* system;
+
 	u64 total_cycles;
 	u64 current_instruction_cycles;
 
@@ -28,7 +33,41 @@ typedef struct cpu {
 
 	u8 interrupt_flag_changed;
 	u8 previous_interrupt_flag;
+
+	// Every instruction is logged here before it runs, NULL when not tracing
+	trace_ring* trace;
 } cpu;
 
-void cpu_init(cpu* state);
-void cpu_execute_instruction(cpu* state);
\ No newline at end of file
+// Set of program counter addresses to stop at, with an optional condition that
+// is only checked once one of the addresses is reached.
+typedef struct cpu_breakpoints {
+	u8 address_bits[0x10000 / 8];
+
+	int (*condition)(const cpu* state, void* user_data);
+	void* user_data;
+} cpu_breakpoints;
+
+void cpu_init(cpu* state, nes_system* system);
+void cpu_execute_instruction(cpu* state);
+
+// Runs the 7 cycle NMI sequence, pushing PC and the status and jumping through $FFFA.
+void cpu_nmi(cpu* state);
+// Same through $FFFE, unless interrupts are disabled. Returns 1 if it was taken.
+// While the IRQ line is low the run stops as soon as interrupts get enabled.
+int cpu_irq(cpu* state);
+
+// Both run whole instructions, so they can finish a few cycles past the budget.
+// cpu_run_cycles returns the amount of cycles that were actually run.
+u64 cpu_run_cycles(cpu* state, u64 cycle_budget);
+// Returns 1 if a breakpoint was reached or 0 if the cycle budget ran out first.
+int cpu_run_until(cpu* state, const cpu_breakpoints* breakpoints, u64 cycle_budget);
+
+int cpu_opcode_is_official(u8 opcode);
+// Writes the instruction in `bytes` (the opcode and up to two operands) the way
+// nestest.log shows it, `address` is where it sits for branch targets. Returns
+// the instruction's length in bytes.
+u32 cpu_disassemble(u16 address, const u8* bytes, char* text, u32 text_size);
+
+void cpu_breakpoints_clear(cpu_breakpoints* breakpoints);
+void cpu_breakpoints_add(cpu_breakpoints* breakpoints, u16 address);
+void cpu_breakpoints_remove(cpu_breakpoints* breakpoints, u16 address);
\ No newline at end of file
@@ -0,0 +1,22 @@
+#include "crc32.h"
+
+// Half byte lookup table, small enough to be a constant so there is nothing to
+// initialise before crc32 can be used from several threads.
+static const u32 crc32_table[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+u32 crc32_update(u32 crc, const u8* data, u64 length) {
+	crc = ~crc;
+	for (u64 i = 0; i < length; i++) {
+		crc = crc32_table[(crc ^ data[i]) & 0x0F] ^ (crc >> 4);
+		crc = crc32_table[(crc ^ (data[i] >> 4)) & 0x0F] ^ (crc >> 4);
+	}
+
+	return ~crc;
+}
+
+u32 crc32(const u8* data, u64 length) {
+	return crc32_update(0, data, length);
+}
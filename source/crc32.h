@@ -0,0 +1,7 @@
+#pragma once
+
+#include "types.h"
+
+// Standard CRC-32 (the one zip and the NES rom databases use).
+u32 crc32(const u8* data, u64 length);
+u32 crc32_update(u32 crc, const u8* data, u64 length);
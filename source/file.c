@@ -0,0 +1,260 @@
+// ftruncate and friends, when building with a strict C standard
+#ifndef _WIN32
+	#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "file.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <dirent.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+static int compare_names(const void* a, const void* b) {
+	return strcmp(*(const char**)a, *(const char**)b);
+}
+
+static void list_append(char*** names, u32* count, u32* capacity, const char* name) {
+	if (*count == *capacity) {
+		*capacity = *capacity == 0 ? 64 : *capacity * 2;
+		*names = realloc(*names, *capacity * sizeof(char*));
+	}
+
+	u64 length = strlen(name);
+	char* copy = malloc(length + 1);
+	memcpy(copy, name, length + 1);
+
+	(*names)[(*count)++] = copy;
+}
+
+char** file_list_directory(const char* path, u32* count) {
+	char** names = NULL;
+	u32 capacity = 0;
+	*count = 0;
+
+#ifdef _WIN32
+	char pattern[MAX_PATH];
+	snprintf(pattern, sizeof(pattern), "%s\\*", path);
+
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA(pattern, &data);
+	if (find == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+
+	do {
+		if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+			list_append(&names, count, &capacity, data.cFileName);
+		}
+	} while (FindNextFileA(find, &data));
+
+	FindClose(find);
+#else
+	DIR* directory = opendir(path);
+	if (directory == NULL) {
+		return NULL;
+	}
+
+	struct dirent* entry;
+	while ((entry = readdir(directory)) != NULL) {
+		char full_path[4096];
+		snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
+
+		struct stat info;
+		if (stat(full_path, &info) == 0 && S_ISREG(info.st_mode)) {
+			list_append(&names, count, &capacity, entry->d_name);
+		}
+	}
+
+	closedir(directory);
+#endif
+
+	if (*count > 0) {
+		qsort(names, *count, sizeof(char*), compare_names);
+	}
+	else if (names == NULL) {
+		// An empty directory still gets a list so it can be told apart from an error
+		names = malloc(sizeof(char*));
+	}
+
+	return names;
+}
+
+void file_list_free(char** names, u32 count) {
+	for (u32 i = 0; i < count; i++) {
+		free(names[i]);
+	}
+
+	free(names);
+}
+
+int file_stat(const char* path, u64* length, u64* modified_time, u64* file_id) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(
+		path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL
+	);
+	if (file == INVALID_HANDLE_VALUE) {
+		return -1;
+	}
+
+	BY_HANDLE_FILE_INFORMATION info;
+	int result = GetFileInformationByHandle(file, &info);
+	CloseHandle(file);
+	if (!result) {
+		return -1;
+	}
+
+	*length = ((u64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	// In 100 nanosecond steps
+	*modified_time = ((u64)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+	*file_id = ((u64)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+#else
+	struct stat info;
+	if (stat(path, &info) != 0) {
+		return -1;
+	}
+
+	*length = info.st_size;
+	// Whole seconds would miss a rom rewritten by a build script right after the last load
+	*modified_time = (u64)info.st_mtim.tv_sec * 1000000000 + (u64)info.st_mtim.tv_nsec;
+	*file_id = (u64)info.st_ino;
+#endif
+
+	return 0;
+}
+
+const u8* file_map(const char* path, u64* length) {
+	*length = 0;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return NULL;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		return NULL;
+	}
+
+	// The view keeps the mapping alive after its handle is closed
+	const u8* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (data == NULL) {
+		return NULL;
+	}
+
+	*length = size.QuadPart;
+#else
+	int file = open(path, O_RDONLY);
+	if (file == -1) {
+		return NULL;
+	}
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || info.st_size == 0) {
+		close(file);
+		return NULL;
+	}
+
+	const u8* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+
+	*length = info.st_size;
+#endif
+
+	return data;
+}
+
+void file_unmap(const u8* data, u64 length) {
+#ifdef _WIN32
+	(void)length;
+	UnmapViewOfFile(data);
+#else
+	munmap((void*)data, length);
+#endif
+}
+
+u8* file_map_writable(const char* path, u64 length) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+
+	// Only a new or empty file is sized, new space reads as zero. One that's
+	// already there with another size is left alone
+	LARGE_INTEGER existing;
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG)length;
+	if (!GetFileSizeEx(file, &existing) || (existing.QuadPart != 0 && existing.QuadPart != size.QuadPart)) {
+		CloseHandle(file);
+		return NULL;
+	}
+	if (existing.QuadPart == 0 && (!SetFilePointerEx(file, size, NULL, FILE_BEGIN) || !SetEndOfFile(file))) {
+		CloseHandle(file);
+		return NULL;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) {
+		return NULL;
+	}
+
+	u8* data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+	CloseHandle(mapping);
+	return data;
+#else
+	int file = open(path, O_RDWR | O_CREAT, 0644);
+	if (file == -1) {
+		return NULL;
+	}
+
+	// Only a new or empty file is extended, which fills it with zeroes. One
+	// that's already there with another size is left alone
+	struct stat info;
+	if (fstat(file, &info) != 0 || (info.st_size != 0 && (u64)info.st_size != length)) {
+		close(file);
+		return NULL;
+	}
+	if (info.st_size == 0 && ftruncate(file, (off_t)length) != 0) {
+		close(file);
+		return NULL;
+	}
+
+	u8* data = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+	close(file);
+	return data != MAP_FAILED ? data : NULL;
+#endif
+}
+
+void file_flush(u8* data, u64 length, int wait) {
+#ifdef _WIN32
+	// The view only starts the writes, waiting on them would need the file's handle
+	(void)wait;
+	FlushViewOfFile(data, length);
+#else
+	msync(data, length, wait ? MS_SYNC : MS_ASYNC);
+#endif
+}
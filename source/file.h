@@ -0,0 +1,27 @@
+#pragma once
+
+#include "types.h"
+
+// Lists the names of the regular files in a directory in alphabetical order.
+// Returns NULL if the directory can't be opened, free the list with file_list_free.
+char** file_list_directory(const char* path, u32* count);
+void file_list_free(char** names, u32 count);
+
+// Size, last modification time and inode (or file index) of a file, returns -1
+// if it doesn't exist. The time and id are only good for telling whether the
+// file changed or was replaced.
+int file_stat(const char* path, u64* length, u64* modified_time, u64* file_id);
+
+// Maps a whole file read-only into memory, returns NULL if it can't be mapped.
+// Empty files can't be mapped either. Unmap it with file_unmap.
+const u8* file_map(const char* path, u64* length);
+void file_unmap(const u8* data, u64 length);
+
+// Maps `length` bytes of a file for reading and writing. A new or empty file is
+// created at that length, an existing one has to be exactly that long or NULL
+// is returned. Writes land in the file as they're made, the OS writes them out
+// even if the process dies. NULL on failure, unmap it with file_unmap.
+u8* file_map_writable(const char* path, u64 length);
+// Starts writing a writable mapping's changes out to disk, with `wait` it
+// returns once they're there.
+void file_flush(u8* data, u64 length, int wait);
@@ -0,0 +1,35 @@
+#include "frame_buffer.h"
+
+#include <string.h>
+
+#include "thread.h"
+
+#define FRAME_BUFFER_FRESH 0x04
+#define FRAME_BUFFER_INDEX 0x03
+
+void frame_buffer_init(frame_buffer* buffer) {
+	memset(buffer->frames, 0, sizeof(buffer->frames));
+
+	buffer->back = 0;
+	buffer->shared = 1;
+	buffer->front = 2;
+}
+
+void frame_buffer_publish(frame_buffer* buffer, const u8* frame) {
+	memcpy(buffer->frames[buffer->back], frame, FRAME_BUFFER_SIZE);
+
+	// The finished frame becomes the shared one and whatever was shared before,
+	// taken by the reader or not, is drawn over next
+	u32 previous = atomic_exchange(&buffer->shared, buffer->back | FRAME_BUFFER_FRESH);
+	buffer->back = previous & FRAME_BUFFER_INDEX;
+}
+
+const u8* frame_buffer_acquire(frame_buffer* buffer) {
+	if ((atomic_load_acquire(&buffer->shared) & FRAME_BUFFER_FRESH) == 0) {
+		return NULL;
+	}
+
+	u32 previous = atomic_exchange(&buffer->shared, buffer->front);
+	buffer->front = previous & FRAME_BUFFER_INDEX;
+	return buffer->frames[buffer->front];
+}
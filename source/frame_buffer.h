@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.h"
+#include "ppu.h"
+
+// Finished frames on their way from the emulation thread to the render thread.
+// With three buffers the emulation always has one to draw into and the renderer
+// always has the newest finished one, so neither side ever waits on the other.
+// Frames the renderer doesn't get to in time are simply replaced.
+
+#define FRAME_BUFFER_SIZE (PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT)
+
+typedef struct frame_buffer {
+	// Palette indices like ppu.framebuffer
+	u8 frames[3][FRAME_BUFFER_SIZE];
+
+	// The buffer between the two sides, FRAME_BUFFER_FRESH is set while it
+	// holds a frame the reader hasn't taken yet
+	volatile u32 shared;
+
+	// Owned by the writer and the reader respectively
+	u32 back;
+	u32 front;
+} frame_buffer;
+
+void frame_buffer_init(frame_buffer* buffer);
+
+// Copies a finished frame in and hands it over, never blocks.
+void frame_buffer_publish(frame_buffer* buffer, const u8* frame);
+
+// Takes the newest published frame, NULL if nothing was published since the last call.
+const u8* frame_buffer_acquire(frame_buffer* buffer);
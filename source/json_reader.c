@@ -0,0 +1,196 @@
+#include "json_reader.h"
+
+#include <string.h>
+
+int json_reader_open(json_reader* reader, const char* path) {
+	reader->file = fopen(path, "rb");
+	reader->position = 0;
+	reader->length = 0;
+	reader->string[0] = '\0';
+	reader->number = 0;
+
+	return reader->file != NULL ? 0 : -1;
+}
+
+void json_reader_close(json_reader* reader) {
+	if (reader->file != NULL) {
+		fclose(reader->file);
+		reader->file = NULL;
+	}
+}
+
+// Returns the next character without consuming it, -1 at the end of the file.
+static int json_reader_peek(json_reader* reader) {
+	if (reader->position == reader->length) {
+		reader->length = (u32)fread(reader->buffer, 1, sizeof(reader->buffer), reader->file);
+		reader->position = 0;
+
+		if (reader->length == 0) {
+			return -1;
+		}
+	}
+
+	return (u8)reader->buffer[reader->position];
+}
+
+static int json_reader_get(json_reader* reader) {
+	int character = json_reader_peek(reader);
+	if (character != -1) {
+		reader->position++;
+	}
+
+	return character;
+}
+
+static int json_reader_skip_whitespace(json_reader* reader) {
+	int character = json_reader_peek(reader);
+	while (character == ' ' || character == '\t' || character == '\r' || character == '\n') {
+		reader->position++;
+		character = json_reader_peek(reader);
+	}
+
+	return character;
+}
+
+static json_token json_reader_read_string(json_reader* reader) {
+	u32 length = 0;
+
+	while (1) {
+		int character = json_reader_get(reader);
+		if (character == -1) {
+			return JSON_ERROR;
+		}
+		if (character == '"') {
+			break;
+		}
+
+		// Escapes are kept as the escaped character, \u sequences aren't decoded
+		if (character == '\\') {
+			character = json_reader_get(reader);
+			if (character == -1) {
+				return JSON_ERROR;
+			}
+		}
+
+		if (length + 1 < sizeof(reader->string)) {
+			reader->string[length++] = (char)character;
+		}
+	}
+
+	reader->string[length] = '\0';
+
+	// A string followed by a colon is an object key
+	if (json_reader_skip_whitespace(reader) == ':') {
+		reader->position++;
+		return JSON_KEY;
+	}
+
+	return JSON_STRING;
+}
+
+// Only the integer part is kept, fractions and exponents are read and dropped.
+static json_token json_reader_read_number(json_reader* reader) {
+	int negative = 0;
+	if (json_reader_peek(reader) == '-') {
+		negative = 1;
+		reader->position++;
+	}
+
+	i64 number = 0;
+	int character = json_reader_peek(reader);
+	if (character < '0' || character > '9') {
+		return JSON_ERROR;
+	}
+
+	while (character >= '0' && character <= '9') {
+		number = number * 10 + (character - '0');
+		reader->position++;
+		character = json_reader_peek(reader);
+	}
+
+	while (character == '.' || character == 'e' || character == 'E' || character == '+' || character == '-' ||
+		(character >= '0' && character <= '9')) {
+		reader->position++;
+		character = json_reader_peek(reader);
+	}
+
+	reader->number = negative ? -number : number;
+	return JSON_NUMBER;
+}
+
+static json_token json_reader_read_literal(json_reader* reader, const char* literal, json_token token) {
+	for (const char* expected = literal; *expected != '\0'; expected++) {
+		if (json_reader_get(reader) != *expected) {
+			return JSON_ERROR;
+		}
+	}
+
+	return token;
+}
+
+json_token json_reader_next(json_reader* reader) {
+	int character = json_reader_skip_whitespace(reader);
+	while (character == ',' || character == ':') {
+		reader->position++;
+		character = json_reader_skip_whitespace(reader);
+	}
+
+	switch (character) {
+	case -1:
+		return JSON_END;
+	case '{':
+		reader->position++;
+		return JSON_OBJECT_BEGIN;
+	case '}':
+		reader->position++;
+		return JSON_OBJECT_END;
+	case '[':
+		reader->position++;
+		return JSON_ARRAY_BEGIN;
+	case ']':
+		reader->position++;
+		return JSON_ARRAY_END;
+	case '"':
+		reader->position++;
+		return json_reader_read_string(reader);
+	case 't':
+		return json_reader_read_literal(reader, "true", JSON_TRUE);
+	case 'f':
+		return json_reader_read_literal(reader, "false", JSON_FALSE);
+	case 'n':
+		return json_reader_read_literal(reader, "null", JSON_NULL);
+	default:
+		return json_reader_read_number(reader);
+	}
+}
+
+int json_reader_skip(json_reader* reader, json_token token) {
+	u32 depth = 0;
+
+	while (1) {
+		switch (token) {
+		case JSON_ERROR:
+		case JSON_END:
+			return -1;
+		case JSON_OBJECT_BEGIN:
+		case JSON_ARRAY_BEGIN:
+			depth++;
+			break;
+		case JSON_OBJECT_END:
+		case JSON_ARRAY_END:
+			if (depth == 0) {
+				return -1;
+			}
+			depth--;
+			break;
+		default:
+			break;
+		}
+
+		if (depth == 0) {
+			return 0;
+		}
+
+		token = json_reader_next(reader);
+	}
+}
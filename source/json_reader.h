@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "types.h"
+
+// A small pull parser that reads JSON from a file one token at a time through a
+// fixed buffer, so big files never have to be loaded or turned into a tree.
+
+#define JSON_READER_BUFFER_SIZE 0x4000
+#define JSON_READER_STRING_SIZE 64
+
+typedef enum json_token {
+	JSON_ERROR,
+	JSON_END,
+	JSON_OBJECT_BEGIN,
+	JSON_OBJECT_END,
+	JSON_ARRAY_BEGIN,
+	JSON_ARRAY_END,
+	JSON_KEY,
+	JSON_STRING,
+	JSON_NUMBER,
+	JSON_TRUE,
+	JSON_FALSE,
+	JSON_NULL,
+} json_token;
+
+typedef struct json_reader {
+	FILE* file;
+	u32 position;
+	u32 length;
+	char buffer[JSON_READER_BUFFER_SIZE];
+
+	// Value of the last JSON_KEY/JSON_STRING (cut off if it's too long) or JSON_NUMBER
+	char string[JSON_READER_STRING_SIZE];
+	i64 number;
+} json_reader;
+
+// Returns 0 on success and -1 if the file can't be opened.
+int json_reader_open(json_reader* reader, const char* path);
+void json_reader_close(json_reader* reader);
+
+// Reads the next token, commas and colons are skipped. An object's keys come back
+// as JSON_KEY and every other string as JSON_STRING.
+json_token json_reader_next(json_reader* reader);
+
+// Skips the rest of a value whose first token was `token`, returns -1 on bad JSON.
+int json_reader_skip(json_reader* reader, json_token token);
@@ -5,95 +5,362 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "memory_bus.h"
-#include "cartridge.h"
-#include "cpu.h"
+#include "nes.h"
+#include "cli.h"
+#include "audio_ring.h"
+#include "frame_buffer.h"
+#include "thread.h"
+#include "trace.h"
 
 int video_scale = 1;
+// How many times faster than normal fast-forward runs
+int fast_forward_multiplier = 4;
+
+#define AUDIO_SAMPLE_RATE 48000
+
+// Battery backed saves are pushed out to disk this often, they're in the mapped file either way
+#define SAVE_FLUSH_INTERVAL_FRAMES 60
+
+// Around 35 frames of instructions, the trace writer has that long to catch up
+#define TRACE_RING_CAPACITY (1 << 20)
+
+// Filled by the emulation at the end of every frame, drained by SDL's audio thread
+static audio_ring audio_output;
 
 void config_load();
 void config_reset();
 
-int run_cpu_test(char* filename);
+int run_window(const char* rom_path, const char* trace_path);
+
+typedef enum emulation_speed {
+	// Paced to the console's frame rate
+	SPEED_NORMAL,
+	// Paced to fast_forward_multiplier times the frame rate, while Tab is held
+	SPEED_FAST_FORWARD,
+	// As fast as the host can go, toggled with T
+	SPEED_TURBO,
+} emulation_speed;
+
+// Shared between the main thread and the emulation thread
+typedef struct emulation_context {
+	nes_system* system;
+	frame_buffer frames;
+	volatile u32 running;
+	volatile u32 speed;
+
+	// Only with --trace, filled by the emulation thread and written out by the trace thread
+	trace_ring trace;
+	FILE* trace_file;
+	volatile u32 tracing;
+} emulation_context;
+
+static int emulation_thread(void* argument);
+static int trace_thread(void* argument);
+static void attach_save_file(nes_system* system, const char* rom_path);
+static void upload_frame(SDL_Texture* texture, const u8* frame);
+static void SDLCALL audio_callback(void* userdata, SDL_AudioStream* stream, int additional_amount, int total_amount);
+
 
 int main(int argc, char* argv[]) {
-	if (argc >= 2) {
-		if (strcmp(argv[1], "--single-step-test") == 0) {
-			u8* memory = malloc(0xFFFF);
-			cpubus_enable_testmode(memory);
-			int return_code = run_cpu_test(argv[2]);
-			return return_code;
-		}
-		else {
-			config_load();
+	if (cli_is_command(argc, argv)) {
+		return cli_run(argc, argv);
+	}
+	else if (argc >= 2) {
+		const char* trace_path = argc >= 4 && strcmp(argv[2], "--trace") == 0 ? argv[3] : NULL;
+		return run_window(argv[1], trace_path);
+	}
+	else {
+		printf("Not enough arguments. Use one of the following:\n");
+		printf("%s <path/to/rom.nes> [--trace <path/to/out.trace>]\n", argv[0]);
+		cli_print_usage(argv[0]);
 
-			cpu cpu_state;
+		return -1;
+	}
+}
 
-			if (cartridge_init(argv[1]) != 0) {
-				printf("Error loading rom '%s'.\n", argv[1]);
-				return -1;
-			}
+// The emulation runs on its own thread and only hands frames over, SDL stays on the
+// main thread since windows, events and rendering have to be used from there. A
+// slow present or vsync wait never holds the emulation up.
+int run_window(const char* rom_path, const char* trace_path) {
+	config_load();
+
+	emulation_context* context = malloc(sizeof(emulation_context));
+	context->system = malloc(sizeof(nes_system));
+	if (nes_init(context->system, rom_path) != 0) {
+		printf("Error loading rom '%s'.\n", rom_path);
+		free(context->system);
+		free(context);
+		return -1;
+	}
 
-			cpubus_init();
-			cpu_init(&cpu_state);
-
-			SDL_SetAppMetadata("Nes-Emulator", "v0.1", "com.rustygrape238.nesemulator");
-			SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
-		
-			SDL_Window* window = SDL_CreateWindow(
-				"Nes-Emulator",
-				256 * video_scale, 240 * video_scale,
-				0
-			);
-		
-			if (window == NULL) {
-				SDL_Quit();
-				SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "SDL2: Failed to open a window");
-				return -1;
+	attach_save_file(context->system, rom_path);
+
+	context->trace_file = NULL;
+	if (trace_path != NULL) {
+		context->trace_file = fopen(trace_path, "wb");
+		if (context->trace_file == NULL || trace_ring_init(&context->trace, TRACE_RING_CAPACITY) != 0) {
+			printf("Couldn't create '%s'.\n", trace_path);
+			if (context->trace_file != NULL) {
+				fclose(context->trace_file);
 			}
+			nes_free(context->system);
+			free(context->system);
+			free(context);
+			return -1;
+		}
+
+		trace_write_header(context->trace_file);
+		context->system->cpu.trace = &context->trace;
+	}
+
+	SDL_SetAppMetadata("Nes-Emulator", "v0.1", "com.rustygrape238.nesemulator");
+	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_EVENTS);
+
+	SDL_Window* window = NULL;
+	SDL_Renderer* renderer = NULL;
+	if (!SDL_CreateWindowAndRenderer("Nes-Emulator", PPU_SCREEN_WIDTH * video_scale, PPU_SCREEN_HEIGHT * video_scale, 0, &window, &renderer)) {
+		SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "SDL3: Failed to open a window: %s", SDL_GetError());
+		SDL_Quit();
+		nes_free(context->system);
+		free(context->system);
+		free(context);
+		return -1;
+	}
+
+	// Without vsync the loop below waits for new frames instead
+	SDL_SetRenderVSync(renderer, 1);
+
+	SDL_Texture* texture = SDL_CreateTexture(
+		renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, PPU_SCREEN_WIDTH, PPU_SCREEN_HEIGHT
+	);
+	SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+
+	// Without an audio device the emulation still runs, just silently
+	audio_ring_init(&audio_output);
+	SDL_AudioSpec audio_spec = { SDL_AUDIO_S16, 1, AUDIO_SAMPLE_RATE };
+	SDL_AudioStream* audio_stream = SDL_OpenAudioDeviceStream(
+		SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &audio_spec, audio_callback, &audio_output
+	);
+
+	if (audio_stream != NULL) {
+		apu_set_output(context->system, &audio_output, AUDIO_SAMPLE_RATE);
+		SDL_ResumeAudioStreamDevice(audio_stream);
+	}
+	else {
+		SDL_Log("Failed to open an audio device: %s", SDL_GetError());
+	}
+
+	frame_buffer_init(&context->frames);
+	context->running = 1;
+	context->speed = SPEED_NORMAL;
+	int fast_forward = 0;
+	int turbo = 0;
+
+	thread emulation;
+	int emulation_started = thread_create(&emulation, emulation_thread, context) == 0;
+	if (!emulation_started) {
+		printf("Failed to start the emulation thread.\n");
+		context->running = 0;
+	}
 
-			bool running = true;
-			while (running == true) {
-				SDL_Event event;
-				while (SDL_PollEvent(&event)) {
-					if (event.type == SDL_EVENT_QUIT) {
-						running = false;
-					}
+	thread tracer;
+	context->tracing = 1;
+	int tracer_started = emulation_started && context->trace_file != NULL && thread_create(&tracer, trace_thread, context) == 0;
+
+	while (atomic_load_acquire(&context->running)) {
+		SDL_Event event;
+		while (SDL_PollEvent(&event)) {
+			if (event.type == SDL_EVENT_QUIT) {
+				atomic_store_release(&context->running, 0);
+			}
+			else if ((event.type == SDL_EVENT_KEY_DOWN || event.type == SDL_EVENT_KEY_UP) && !event.key.repeat) {
+				int down = event.type == SDL_EVENT_KEY_DOWN;
+				if (event.key.key == SDLK_TAB) {
+					fast_forward = down;
 				}
-		
-				#ifndef NDEBUG
-					printf( "CPU State:\n");
-					printf(
-						"PC: 0x%04X, SP: 0x%02X\n",
-						cpu_state.program_counter, cpu_state.stack_pointer
-					);
-					printf(
-						"A: 0x%02X, X: 0x%02X, Y: 0x%02X\n",
-						cpu_state.accumulator, cpu_state.register_x, cpu_state.register_y
-					);
-					printf(
-						"N: %i, V: %i, B: %i, D: %i, I: %i, Z: %i, C: %i\n\n",
-						cpu_state.status.negative_flag, cpu_state.status.overflow_flag, cpu_state.status.break_flag,
-						cpu_state.status.decimal_flag, cpu_state.status.interrupt_disable, cpu_state.status.zero_flag,
-						cpu_state.status.carry_flag
-					);
-				#endif
-				system("pause");
-		
-				cpu_execute_instruction(&cpu_state);
+				else if (event.key.key == SDLK_T && down) {
+					turbo = !turbo;
+				}
+
+				atomic_store_release(&context->speed, turbo ? SPEED_TURBO : fast_forward ? SPEED_FAST_FORWARD : SPEED_NORMAL);
 			}
-		
-			SDL_Quit();
-			return 0;
 		}
+
+		const u8* frame = frame_buffer_acquire(&context->frames);
+		if (frame == NULL) {
+			SDL_Delay(1);
+			continue;
+		}
+
+		upload_frame(texture, frame);
+		SDL_RenderClear(renderer);
+		SDL_RenderTexture(renderer, texture, NULL, NULL);
+		SDL_RenderPresent(renderer);
 	}
-	else {
-		printf("Not enough arguments. Use one of the following:\n");
-		printf("./NesEmu <path/to/rom.nes>\n");
-		printf("./NesEmu --single-step-test <path/to/test.json>\n");
 
-		return -1;
+	if (emulation_started) {
+		thread_join(&emulation);
+	}
+
+	// Only stopped once the emulation is, so it gets the last records too
+	atomic_store_release(&context->tracing, 0);
+	if (tracer_started) {
+		thread_join(&tracer);
+	}
+
+	if (context->trace_file != NULL) {
+		fclose(context->trace_file);
+		trace_ring_free(&context->trace);
+	}
+
+	if (audio_stream != NULL) {
+		SDL_DestroyAudioStream(audio_stream);
+	}
+
+	SDL_DestroyTexture(texture);
+	SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+	SDL_Quit();
+
+	nes_free(context->system);
+	free(context->system);
+	free(context);
+	return 0;
+}
+
+// Frames are paced against a deadline that moves on by one frame period each
+// frame, so time lost to a late wakeup is made up on the next one instead of
+// adding up. SDL_DelayPrecise sleeps most of the wait and spins the rest.
+static int emulation_thread(void* argument) {
+	emulation_context* context = argument;
+	nes_system* system = context->system;
+
+	u64 frame_period = (u64)(1e9 / nes_frame_rate(system) + 0.5);
+	u64 deadline = SDL_GetTicksNS();
+	u32 frames_since_flush = 0;
+
+	while (atomic_load_acquire(&context->running)) {
+		nes_run_frame(system);
+		frame_buffer_publish(&context->frames, system->ppu.framebuffer);
+
+		if (++frames_since_flush == SAVE_FLUSH_INTERVAL_FRAMES) {
+			cartridge_flush_save(system);
+			frames_since_flush = 0;
+		}
+
+		u32 speed = atomic_load_acquire(&context->speed);
+		u64 now = SDL_GetTicksNS();
+		if (speed == SPEED_TURBO) {
+			deadline = now;
+			continue;
+		}
+
+		deadline += speed == SPEED_FAST_FORWARD ? frame_period / fast_forward_multiplier : frame_period;
+		if (now < deadline) {
+			SDL_DelayPrecise(deadline - now);
+		}
+		// Far behind (a slow host or the process being suspended), start over instead of rushing to catch up
+		else if (now - deadline > frame_period * 4) {
+			deadline = now;
+		}
+	}
+
+	return 0;
+}
+
+// Drains the trace ring into the file while the emulation runs, the emulation
+// never waits on it. Records it falls too far behind on are lost and counted.
+static int trace_thread(void* argument) {
+	emulation_context* context = argument;
+	u64 dropped = 0;
+
+	int tracing = 1;
+	while (tracing) {
+		// Read before draining, so the records from before the stop all get written
+		tracing = atomic_load_acquire(&context->tracing);
+
+		i64 written = trace_ring_drain(&context->trace, context->trace_file, &dropped);
+		if (written < 0) {
+			printf("Couldn't write the trace, stopped writing it.\n");
+			return -1;
+		}
+		if (written == 0 && tracing) {
+			SDL_Delay(1);
+		}
+	}
+
+	if (dropped != 0) {
+		printf("The trace writer fell behind, %llu instructions are missing from the trace.\n", (unsigned long long)dropped);
+	}
+
+	return 0;
+}
+
+// Battery backed carts keep their RAM in a .sav next to the rom, without one
+// the game still runs but its saves are lost on exit.
+static void attach_save_file(nes_system* system, const char* rom_path) {
+	if (!system->cartridge.info.battery) {
+		return;
+	}
+
+	char save_path[4096];
+	snprintf(save_path, sizeof(save_path), "%s", rom_path);
+
+	// Only an extension in the file name itself is replaced
+	char* extension = strrchr(save_path, '.');
+	char* separator = strrchr(save_path, '/');
+	char* windows_separator = strrchr(save_path, '\\');
+	if (windows_separator > separator) {
+		separator = windows_separator;
+	}
+	if (extension == NULL || (separator != NULL && extension < separator)) {
+		extension = save_path + strlen(save_path);
+	}
+
+	if (extension + sizeof(".sav") > save_path + sizeof(save_path)) {
+		return;
+	}
+	memcpy(extension, ".sav", sizeof(".sav"));
+
+	cartridge_attach_save(system, save_path);
+}
+
+// Turns the palette indices into colours straight in the texture's memory.
+static void upload_frame(SDL_Texture* texture, const u8* frame) {
+	void* pixels;
+	int pitch;
+	if (!SDL_LockTexture(texture, NULL, &pixels, &pitch)) {
+		return;
+	}
+
+	for (u32 y = 0; y < PPU_SCREEN_HEIGHT; y++) {
+		u32* row = (u32*)((u8*)pixels + y * pitch);
+		const u8* source = frame + y * PPU_SCREEN_WIDTH;
+
+		for (u32 x = 0; x < PPU_SCREEN_WIDTH; x++) {
+			row[x] = ppu_palette_rgb[source[x] & 0x3F];
+		}
+	}
+
+	SDL_UnlockTexture(texture);
+}
+
+// Runs on SDL's audio thread whenever the stream wants more samples. Whatever the
+// ring can't cover is padded with silence so the device never stalls.
+static void SDLCALL audio_callback(void* userdata, SDL_AudioStream* stream, int additional_amount, int total_amount) {
+	audio_ring* ring = userdata;
+	i16 samples[1024];
+
+	u32 sample_count = (u32)additional_amount / sizeof(i16);
+	while (sample_count > 0) {
+		u32 count = sample_count < 1024 ? sample_count : 1024;
+		u32 read = audio_ring_read(ring, samples, count);
+		memset(samples + read, 0, (count - read) * sizeof(i16));
+
+		SDL_PutAudioStreamData(stream, samples, count * sizeof(i16));
+		sample_count -= count;
 	}
 }
 
@@ -120,6 +387,11 @@ void config_load() {
 			config_reset();
 		}
 
+		cJSON* fast_forward_obj = cJSON_GetObjectItemCaseSensitive(root, "fast_forward_multiplier");
+		if (cJSON_IsNumber(fast_forward_obj) && fast_forward_obj->valueint >= 1) {
+			fast_forward_multiplier = fast_forward_obj->valueint;
+		}
+
 		fclose(file);
 	}
 }
@@ -129,6 +401,7 @@ void config_reset() {
 	if (!root) return;
 
 	cJSON_AddNumberToObject(root, "video_scale", 1);
+	cJSON_AddNumberToObject(root, "fast_forward_multiplier", 4);
 
 	char* json_string = cJSON_Print(root);
 
@@ -139,127 +412,4 @@ void config_reset() {
 	}
 
 	cJSON_Delete(root);
-}
-
-int run_cpu_test(char* filename) {
-	printf("Running test: %s\n", filename);
-	FILE* file = fopen(filename, "r");
-	fseek(file, 0, SEEK_END);
-	u64 length = ftell(file);
-	rewind(file);
-
-	char* string = malloc(length + 1);
-	fread(string, 1, length, file);
-	string[length] = '\0';
-
-	cJSON* root = cJSON_Parse(string);
-	if (cJSON_IsArray(root)) {
-		printf("Starting tests.\n\n");
-
-		u64 size = cJSON_GetArraySize(root);
-		for (u64 i = 0; i < size; i++) {
-			bool passed = true;
-			cJSON* test = cJSON_GetArrayItem(root, i);
-
-			cpu cpu_state;
-			cpubus_init();
-			cpu_init(&cpu_state);
-
-			cJSON* name_obj = cJSON_GetObjectItemCaseSensitive(test, "name");
-			char* name = cJSON_GetStringValue(name_obj);
-			printf("Starting test '%s'\n", name);
-
-			cJSON* initial = cJSON_GetObjectItemCaseSensitive(test, "initial");
-
-			cpu_state.program_counter = cJSON_GetObjectItemCaseSensitive(initial, "pc")->valueint;
-			cpu_state.stack_pointer = cJSON_GetObjectItemCaseSensitive(initial, "s")->valueint;
-			cpu_state.accumulator = cJSON_GetObjectItemCaseSensitive(initial, "a")->valueint;
-			cpu_state.register_x = cJSON_GetObjectItemCaseSensitive(initial, "x")->valueint;
-			cpu_state.register_y = cJSON_GetObjectItemCaseSensitive(initial, "y")->valueint;
-			cpu_state.status.as_byte = cJSON_GetObjectItemCaseSensitive(initial, "p")->valueint;
-
-			cJSON* ram = cJSON_GetObjectItemCaseSensitive(initial, "ram");
-			if (cJSON_IsArray(ram)) {
-				u64 size = cJSON_GetArraySize(ram);
-				for (u64 i = 0; i < size; i++) {
-					cJSON* array = cJSON_GetArrayItem(ram, i);
-					cpubus_write(cJSON_GetArrayItem(array, 0)->valueint, cJSON_GetArrayItem(array, 1)->valueint);
-				}
-			}
-			else {
-				printf("Error reading 1.\n");
-				return -1;
-			}
-
-			cpu_execute_instruction(&cpu_state);
-
-			cJSON* result = cJSON_GetObjectItemCaseSensitive(test, "final");
-			u16 program_counter = cJSON_GetObjectItemCaseSensitive(result, "pc")->valueint;
-			u8 stack_pointer = cJSON_GetObjectItemCaseSensitive(result, "s")->valueint;
-			u8 accumulator = cJSON_GetObjectItemCaseSensitive(result, "a")->valueint;
-			u8 register_x = cJSON_GetObjectItemCaseSensitive(result, "x")->valueint;
-			u8 register_y = cJSON_GetObjectItemCaseSensitive(result, "y")->valueint;
-			u8 status = cJSON_GetObjectItemCaseSensitive(result, "p")->valueint;
-
-			cJSON* result_ram = cJSON_GetObjectItemCaseSensitive(result, "ram");
-			if (cJSON_IsArray(ram)) {
-				u64 size = cJSON_GetArraySize(result_ram);
-				for (u64 i = 0; i < size; i++) {
-					cJSON* array = cJSON_GetArrayItem(result_ram, i);
-					u16 address = cJSON_GetArrayItem(array, 0)->valueint;
-					u8 should_be = cJSON_GetArrayItem(array, 1)->valueint;
-					u8 is = cpubus_read(address);
-					if (is != should_be) {
-						printf("Ram 0x%04X should be 0x%02X but is 0x%02X\n", address, should_be, is);
-						passed = false;
-					}
-				}
-			}
-			else {
-				printf("Error reading 2.\n");
-				return -1;
-			}
-
-			if (program_counter != cpu_state.program_counter) {
-				printf("PC should be 0x%04X but is 0x%04X\n", program_counter, cpu_state.program_counter);
-				passed = false;
-			}
-
-			if (accumulator != cpu_state.accumulator) {
-				printf("A should be 0x%02X but is 0x%02X\n", accumulator, cpu_state.accumulator);
-				passed = false;
-			}
-
-			if (register_x != cpu_state.register_x) {
-				printf("X should be 0x%02X but is 0x%02X\n", register_x, cpu_state.register_x);
-				passed = false;
-			}
-
-			if (register_y != cpu_state.register_y) {
-				printf("Y should be 0x%02X but is 0x%02X\n", register_y, cpu_state.register_y);
-				passed = false;
-			}
-
-			if (status != cpu_state.status.as_byte) {
-				printf("Status should be 0x%02X but is 0x%02X\n", status, cpu_state.status.as_byte);
-				passed = false;
-			}
-
-			if (passed) {
-				printf("Test Passed.\n\n");
-			}
-			else {
-				printf("Test Failed.\n");
-				return -1;
-			}
-
-			cJSON_free(test);
-		}
-	}
-	else {
-		printf("Wrong file.\n");
-		return -1;
-	}
-
-	return 0;
 }
\ No newline at end of file
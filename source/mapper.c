@@ -1,23 +1,133 @@
 #include "mapper.h"
 
-u8 mapper0_read(u16 address, u8* prg_ram, u8* prg_rom, u8 prg_rom_size) {
-	if (address < 0x8000) {
-		return prg_ram[address - 0x4020];
+#include <stddef.h>
+
+#include "nes.h"
+#include "memory_bus.h"
+
+static const mapper_interface mappers[] = {
+	{ 0, "NROM", mapper0_init, mapper_open_bus_read, mapper_ignore_write, NULL, NULL, NULL },
+	{ 1, "MMC1", mmc1_init, mapper_open_bus_read, mmc1_write, NULL, NULL, NULL },
+	{ 2, "UxROM", uxrom_init, mapper_open_bus_read, uxrom_write, NULL, NULL, NULL },
+	{ 3, "CNROM", cnrom_init, mapper_open_bus_read, cnrom_write, NULL, NULL, NULL },
+	{ 4, "MMC3", mmc3_init, mapper_open_bus_read, mmc3_write, mmc3_scanline, mmc3_irq_event, mmc3_ppu_changed },
+};
+
+const mapper_interface* mapper_find(u16 number) {
+	for (u32 i = 0; i < sizeof(mappers) / sizeof(mappers[0]); i++) {
+		if (mappers[i].number == number) {
+			return &mappers[i];
+		}
 	}
-	else {
-		if (prg_rom_size == 2) {
-			// 32k rom
-			return prg_rom[address - 0x4020];
+
+	return NULL;
+}
+
+void mapper_map_prg(nes_system* system, u16 address, u32 size, u32 bank) {
+	cartridge* cart = &system->cartridge;
+
+	u32 bank_count = cart->prg_rom_length / size;
+	if (bank_count == 0) {
+		// Smaller roms are mirrored to fill the bank, the last copy is cut short
+		// when the size isn't a power of two
+		for (u32 offset = 0; offset < size; offset += cart->prg_rom_length) {
+			u32 length = size - offset < cart->prg_rom_length ? size - offset : cart->prg_rom_length;
+			cpubus_map(system, (address + offset) >> 8, length >> 8, cart->prg_rom, NULL);
 		}
-		else {
-			// 16k rom, needs mirroring
-			return prg_rom[(address - 0x4020) & (16 * 1024)];
+		return;
+	}
+
+	cpubus_map(system, address >> 8, size >> 8, cart->prg_rom + (bank % bank_count) * size, NULL);
+}
+
+void mapper_map_chr(nes_system* system, u16 address, u32 size, u32 bank) {
+	cartridge* cart = &system->cartridge;
+
+	u8* memory = cart->chr_rom != NULL ? cart->chr_rom : cart->chr_ram;
+	u32 length = cart->chr_rom != NULL ? cart->chr_rom_length : cart->chr_ram_length;
+	u8* write = cart->chr_ram != NULL ? memory : NULL;
+	u32 bank_count = length / size;
+	if (bank_count == 0) {
+		for (u32 offset = 0; length > 0 && offset < size; offset += length) {
+			u32 span = size - offset < length ? size - offset : length;
+			ppubus_map(system, (address + offset) >> 10, span >> 10, memory, write);
 		}
+		return;
+	}
+
+	u32 bank_offset = (bank % bank_count) * size;
+	ppubus_map(system, address >> 10, size >> 10, memory + bank_offset, write != NULL ? write + bank_offset : NULL);
+}
+
+void mapper_map_prg_ram(nes_system* system, int enabled, int writable) {
+	cartridge* cart = &system->cartridge;
+
+	u8* memory = enabled ? cart->prg_ram : NULL;
+	if (memory == NULL || cart->prg_ram_length >= 0x2000) {
+		cpubus_map(system, 0x60, 0x20, memory, writable ? memory : NULL);
+		return;
+	}
+
+	// Less than 8KB is mirrored, without running into PRG ROM at $8000
+	u32 page_count = cart->prg_ram_length >> 8;
+	for (u32 page = 0x60; page < 0x80; page += page_count) {
+		u32 span = 0x80 - page < page_count ? 0x80 - page : page_count;
+		cpubus_map(system, page, span, memory, writable ? memory : NULL);
 	}
 }
 
-void mapper0_write(u16 address, u8 value, u8* prg_ram) {
-	if (address < 0x8000) {
-		prg_ram[address] = value;
+// Only reached for the pages a mapper leaves unmapped.
+u8 mapper_open_bus_read(nes_system* system, u16 address) {
+	return 0x00;
+}
+
+void mapper_ignore_write(nes_system* system, u16 address, u8 value) {
+	// PRG ROM can't be written to
+}
+
+static void mapper_set_header_mirroring(nes_system* system) {
+	ppubus_set_mirroring(system, system->cartridge.info.vertical_mirroring ? MIRRORING_VERTICAL : MIRRORING_HORIZONTAL);
+}
+
+//
+// NROM (0), 16k roms are mirrored into $C000-$FFFF
+//
+
+void mapper0_init(nes_system* system) {
+	mapper_map_prg_ram(system, 1, 1);
+	mapper_map_prg(system, 0x8000, 0x8000, 0);
+	mapper_map_chr(system, 0x0000, 0x2000, 0);
+	mapper_set_header_mirroring(system);
+}
+
+//
+// UxROM (2), 16k bank at $8000 and the last one fixed at $C000
+//
+
+void uxrom_init(nes_system* system) {
+	mapper_map_prg_ram(system, 1, 1);
+	mapper_map_prg(system, 0x8000, 0x4000, 0);
+	mapper_map_prg(system, 0xC000, 0x4000, system->cartridge.prg_rom_length / 0x4000 - 1);
+	mapper_map_chr(system, 0x0000, 0x2000, 0);
+	mapper_set_header_mirroring(system);
+}
+
+void uxrom_write(nes_system* system, u16 address, u8 value) {
+	if (address >= 0x8000) {
+		mapper_map_prg(system, 0x8000, 0x4000, value);
+	}
+}
+
+//
+// CNROM (3), NROM with an 8k CHR bank
+//
+
+void cnrom_init(nes_system* system) {
+	mapper0_init(system);
+}
+
+void cnrom_write(nes_system* system, u16 address, u8 value) {
+	if (address >= 0x8000) {
+		mapper_map_chr(system, 0x0000, 0x2000, value);
 	}
 }
\ No newline at end of file
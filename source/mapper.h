@@ -2,5 +2,83 @@
 
 #include "types.h"
 
-u8 mapper0_read(u16 address, u8* prg_ram, u8* prg_rom, u8 prg_rom_size);
-void mapper0_write(u16 address, u8 value, u8* prg_ram);
\ No newline at end of file
+typedef struct nes_system nes_system;
+
+// Banking registers of the mappers that have any, they live in the cartridge
+// so save states and forks carry them along with the rest of the system.
+
+typedef struct mapper_mmc1 {
+	u8 shift;
+	u8 shift_count;
+	u8 control;
+	u8 chr_bank[2];
+	u8 prg_bank;
+	// Writes on the cycle right after another one are ignored (RMW instructions)
+	u64 last_write_cycle;
+} mapper_mmc1;
+
+typedef struct mapper_mmc3 {
+	u8 bank_select;
+	u8 banks[8];
+	u8 mirroring;
+	u8 prg_ram_protect;
+
+	u8 irq_latch;
+	u8 irq_counter;
+	u8 irq_reload;
+	u8 irq_enabled;
+} mapper_mmc3;
+
+typedef union mapper_state {
+	mapper_mmc1 mmc1;
+	mapper_mmc3 mmc3;
+} mapper_state;
+
+// What a mapper does. Banks are switched by remapping the bus page tables, so
+// only the accesses that hit an unmapped page (registers mostly) reach it.
+typedef struct mapper_interface {
+	u16 number;
+	const char* name;
+
+	// Maps the banks the cart powers on with
+	void (*init)(nes_system* system);
+	// $4020-$FFFF accesses the page tables leave to the mapper
+	u8 (*read)(nes_system* system, u16 address);
+	void (*write)(nes_system* system, u16 address, u8 value);
+
+	// The rest are optional. PPU A12 rising once on a rendered scanline, see ppu_next_a12_rise
+	void (*scanline)(nes_system* system);
+	// EVENT_MAPPER_IRQ came due
+	void (*irq_event)(nes_system* system);
+	// PPUCTRL or PPUMASK was written, which can move when the next scanline is counted
+	void (*ppu_changed)(nes_system* system);
+} mapper_interface;
+
+// The mapper with that iNES number, NULL if it isn't supported.
+const mapper_interface* mapper_find(u16 number);
+
+// Bank switching helpers. `address` is where the bank goes and `size` its size
+// in bytes, bank numbers wrap around the size of the memory. CHR banks come from
+// CHR RAM on carts without CHR ROM.
+void mapper_map_prg(nes_system* system, u16 address, u32 size, u32 bank);
+void mapper_map_chr(nes_system* system, u16 address, u32 size, u32 bank);
+// $6000-$7FFF, disabled RAM is left unmapped and reads back as 0
+void mapper_map_prg_ram(nes_system* system, int enabled, int writable);
+
+u8 mapper_open_bus_read(nes_system* system, u16 address);
+void mapper_ignore_write(nes_system* system, u16 address, u8 value);
+
+void mapper0_init(nes_system* system);
+void uxrom_init(nes_system* system);
+void uxrom_write(nes_system* system, u16 address, u8 value);
+void cnrom_init(nes_system* system);
+void cnrom_write(nes_system* system, u16 address, u8 value);
+
+void mmc1_init(nes_system* system);
+void mmc1_write(nes_system* system, u16 address, u8 value);
+
+void mmc3_init(nes_system* system);
+void mmc3_write(nes_system* system, u16 address, u8 value);
+void mmc3_scanline(nes_system* system);
+void mmc3_irq_event(nes_system* system);
+void mmc3_ppu_changed(nes_system* system);
\ No newline at end of file
@@ -0,0 +1,100 @@
+#include "mapper.h"
+
+#include "nes.h"
+#include "memory_bus.h"
+
+// MMC1 (1). Registers are loaded one bit at a time through a 5 bit shift
+// register (https://www.nesdev.org/wiki/MMC1)
+
+static void mmc1_update_banks(nes_system* system) {
+	mapper_mmc1* mmc1 = &system->cartridge.mapper_state.mmc1;
+
+	static const nametable_mirroring mirroring[4] = {
+		MIRRORING_SINGLE_LOWER, MIRRORING_SINGLE_UPPER, MIRRORING_VERTICAL, MIRRORING_HORIZONTAL,
+	};
+	ppubus_set_mirroring(system, mirroring[mmc1->control & 0x03]);
+
+	// 512k roms (SUROM) pick the 256k half with a CHR bank bit
+	u32 outer = system->cartridge.prg_rom_length > 0x40000 ? (mmc1->chr_bank[0] & 0x10) : 0;
+	u32 bank = mmc1->prg_bank & 0x0F;
+	switch ((mmc1->control >> 2) & 0x03) {
+	case 0:
+	case 1:
+		mapper_map_prg(system, 0x8000, 0x8000, (outer | bank) >> 1);
+		break;
+	case 2:
+		mapper_map_prg(system, 0x8000, 0x4000, outer);
+		mapper_map_prg(system, 0xC000, 0x4000, outer | bank);
+		break;
+	case 3:
+		mapper_map_prg(system, 0x8000, 0x4000, outer | bank);
+		mapper_map_prg(system, 0xC000, 0x4000, outer | 0x0F);
+		break;
+	}
+
+	if (mmc1->control & 0x10) {
+		mapper_map_chr(system, 0x0000, 0x1000, mmc1->chr_bank[0]);
+		mapper_map_chr(system, 0x1000, 0x1000, mmc1->chr_bank[1]);
+	}
+	else {
+		mapper_map_chr(system, 0x0000, 0x2000, mmc1->chr_bank[0] >> 1);
+	}
+
+	int ram_enabled = (mmc1->prg_bank & 0x10) == 0;
+	mapper_map_prg_ram(system, ram_enabled, ram_enabled);
+}
+
+void mmc1_init(nes_system* system) {
+	mapper_mmc1* mmc1 = &system->cartridge.mapper_state.mmc1;
+
+	// Powers on with the last bank fixed at $C000
+	mmc1->control = 0x0C;
+	mmc1_update_banks(system);
+}
+
+void mmc1_write(nes_system* system, u16 address, u8 value) {
+	mapper_mmc1* mmc1 = &system->cartridge.mapper_state.mmc1;
+
+	if (address < 0x8000) {
+		return;
+	}
+
+	u64 last_write_cycle = mmc1->last_write_cycle;
+	mmc1->last_write_cycle = system->cpu_bus_cycle;
+	if (system->cpu_bus_cycle == last_write_cycle + 1) {
+		return;
+	}
+
+	if (value & 0x80) {
+		mmc1->shift = 0;
+		mmc1->shift_count = 0;
+		mmc1->control |= 0x0C;
+		mmc1_update_banks(system);
+		return;
+	}
+
+	mmc1->shift |= (value & 0x01) << mmc1->shift_count;
+	mmc1->shift_count++;
+	if (mmc1->shift_count < 5) {
+		return;
+	}
+
+	switch ((address >> 13) & 0x03) {
+	case 0:
+		mmc1->control = mmc1->shift;
+		break;
+	case 1:
+		mmc1->chr_bank[0] = mmc1->shift;
+		break;
+	case 2:
+		mmc1->chr_bank[1] = mmc1->shift;
+		break;
+	case 3:
+		mmc1->prg_bank = mmc1->shift;
+		break;
+	}
+
+	mmc1->shift = 0;
+	mmc1->shift_count = 0;
+	mmc1_update_banks(system);
+}
@@ -0,0 +1,151 @@
+#include "mapper.h"
+
+#include <stdint.h>
+
+#include "nes.h"
+#include "memory_bus.h"
+
+// MMC3 (4), 8k PRG and 1k/2k CHR banks plus an IRQ counting scanlines through
+// PPU A12 (https://www.nesdev.org/wiki/MMC3)
+
+static void mmc3_update_banks(nes_system* system) {
+	mapper_mmc3* mmc3 = &system->cartridge.mapper_state.mmc3;
+
+	u32 last = system->cartridge.prg_rom_length / 0x2000 - 1;
+	if (mmc3->bank_select & 0x40) {
+		mapper_map_prg(system, 0x8000, 0x2000, last - 1);
+		mapper_map_prg(system, 0xC000, 0x2000, mmc3->banks[6]);
+	}
+	else {
+		mapper_map_prg(system, 0x8000, 0x2000, mmc3->banks[6]);
+		mapper_map_prg(system, 0xC000, 0x2000, last - 1);
+	}
+	mapper_map_prg(system, 0xA000, 0x2000, mmc3->banks[7]);
+	mapper_map_prg(system, 0xE000, 0x2000, last);
+
+	// The 2k banks are at $0000 and the 1k ones at $1000, or swapped with A12 inversion
+	u16 inversion = (mmc3->bank_select & 0x80) ? 0x1000 : 0x0000;
+	mapper_map_chr(system, 0x0000 ^ inversion, 0x0800, mmc3->banks[0] >> 1);
+	mapper_map_chr(system, 0x0800 ^ inversion, 0x0800, mmc3->banks[1] >> 1);
+	for (u32 i = 0; i < 4; i++) {
+		mapper_map_chr(system, (0x1000 + i * 0x0400) ^ inversion, 0x0400, mmc3->banks[2 + i]);
+	}
+}
+
+static void mmc3_update_prg_ram(nes_system* system) {
+	mapper_mmc3* mmc3 = &system->cartridge.mapper_state.mmc3;
+
+	int enabled = (mmc3->prg_ram_protect & 0x80) != 0;
+	mapper_map_prg_ram(system, enabled, enabled && (mmc3->prg_ram_protect & 0x40) == 0);
+}
+
+// Queues EVENT_MAPPER_IRQ for the scanline the counter reaches 0 on. The PPU
+// has to be caught up, the prediction starts from where it is.
+static void mmc3_schedule_irq(nes_system* system) {
+	mapper_mmc3* mmc3 = &system->cartridge.mapper_state.mmc3;
+
+	if (!mmc3->irq_enabled) {
+		scheduler_cancel(system, EVENT_MAPPER_IRQ);
+		return;
+	}
+
+	// A reload takes one clock, after it the latch counts down
+	u32 clocks = (mmc3->irq_counter == 0 || mmc3->irq_reload) ? mmc3->irq_latch + 1 : mmc3->irq_counter;
+	u64 cycle = ppu_next_a12_rise(&system->ppu, clocks);
+	if (cycle == UINT64_MAX) {
+		scheduler_cancel(system, EVENT_MAPPER_IRQ);
+		return;
+	}
+
+	scheduler_schedule(system, EVENT_MAPPER_IRQ, cycle * SCHEDULER_TICKS_PER_PPU_DOT);
+}
+
+void mmc3_init(nes_system* system) {
+	mapper_mmc3* mmc3 = &system->cartridge.mapper_state.mmc3;
+
+	static const u8 banks[8] = { 0, 2, 4, 5, 6, 7, 0, 1 };
+	for (u32 i = 0; i < 8; i++) {
+		mmc3->banks[i] = banks[i];
+	}
+	mmc3->prg_ram_protect = 0x80;
+
+	mmc3_update_banks(system);
+	mmc3_update_prg_ram(system);
+	ppubus_set_mirroring(system, system->cartridge.info.vertical_mirroring ? MIRRORING_VERTICAL : MIRRORING_HORIZONTAL);
+}
+
+void mmc3_write(nes_system* system, u16 address, u8 value) {
+	mapper_mmc3* mmc3 = &system->cartridge.mapper_state.mmc3;
+
+	if (address < 0x8000) {
+		return;
+	}
+
+	// The IRQ registers act on the counter as the PPU has it right now
+	if (address >= 0xC000) {
+		ppu_run(system, system->cpu_bus_cycle * 3);
+	}
+
+	switch (address & 0xE001) {
+	case 0x8000:
+		mmc3->bank_select = value;
+		mmc3_update_banks(system);
+		break;
+	case 0x8001:
+		mmc3->banks[mmc3->bank_select & 0x07] = value;
+		mmc3_update_banks(system);
+		break;
+	case 0xA000:
+		mmc3->mirroring = value & 0x01;
+		ppubus_set_mirroring(system, mmc3->mirroring ? MIRRORING_HORIZONTAL : MIRRORING_VERTICAL);
+		break;
+	case 0xA001:
+		mmc3->prg_ram_protect = value;
+		mmc3_update_prg_ram(system);
+		break;
+	case 0xC000:
+		mmc3->irq_latch = value;
+		mmc3_schedule_irq(system);
+		break;
+	case 0xC001:
+		mmc3->irq_counter = 0;
+		mmc3->irq_reload = 1;
+		mmc3_schedule_irq(system);
+		break;
+	case 0xE000:
+		mmc3->irq_enabled = 0;
+		system->irq_line &= ~NES_IRQ_MAPPER;
+		mmc3_schedule_irq(system);
+		break;
+	case 0xE001:
+		mmc3->irq_enabled = 1;
+		mmc3_schedule_irq(system);
+		break;
+	}
+}
+
+void mmc3_scanline(nes_system* system) {
+	mapper_mmc3* mmc3 = &system->cartridge.mapper_state.mmc3;
+
+	if (mmc3->irq_counter == 0 || mmc3->irq_reload) {
+		mmc3->irq_counter = mmc3->irq_latch;
+		mmc3->irq_reload = 0;
+	}
+	else {
+		mmc3->irq_counter--;
+	}
+
+	if (mmc3->irq_counter == 0 && mmc3->irq_enabled) {
+		system->irq_line |= NES_IRQ_MAPPER;
+	}
+}
+
+// The PPU running up to the event raises the IRQ, after that the next one is queued.
+void mmc3_irq_event(nes_system* system) {
+	ppu_run(system, system->cpu.total_cycles * 3);
+	mmc3_schedule_irq(system);
+}
+
+void mmc3_ppu_changed(nes_system* system) {
+	mmc3_schedule_irq(system);
+}
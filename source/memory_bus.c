@@ -1,102 +1,229 @@
 #include "memory_bus.h"
 #include "cartridge.h"
+#include "controller.h"
+#include "ppu.h"
+#include "apu.h"
 
 #include <stdlib.h>
 
-static u8 cpu_memory[0xFFFF];
-static u8 ppu_memory[0x07FF];
-
-u8* testmode_memory = NULL;
-u8 testmode_enabled = 0;
+void cpubus_init(nes_system* system) {
+	for (u16 i = 0; i < 0x0800; i++) {
+		system->cpu_memory[i] = 0x00;
+	}
 
-void cpubus_init() {
-	for (u16 i = 0; i < 0x07FF; i++) {
-		cpu_memory[i] = 0x00;
+	if (system->testmode_enabled == 0) {
+		// 0x0000-0x1FFF CPU RAM, 2KB mirrored 4 times
+		for (u16 page = 0x00; page < 0x20; page += 0x08) {
+			cpubus_map(system, page, 0x08, system->cpu_memory, system->cpu_memory);
+		}
 	}
 }
 
-void cpubus_enable_testmode(u8* memory) {
-	testmode_memory = memory; // Must be 0xFFFF size
-	testmode_enabled = 1;
+void cpubus_enable_testmode(nes_system* system, u8* memory) {
+	system->testmode_memory = memory; // Must be 0x10000 size
+	system->testmode_enabled = 1;
 
-	for (u16 i = 0; i < 0xFFFF; i++) {
-		testmode_memory[i] = 0x00;
+	for (u32 i = 0; i < 0x10000; i++) {
+		system->testmode_memory[i] = 0x00;
 	}
+
+	cpubus_map(system, 0x00, 256, system->testmode_memory, system->testmode_memory);
 }
 
-u8 cpubus_read(u16 address) {
-	if (testmode_enabled == 0) {
-		// 0x0000-0x1FFF CPU RAM
-		if ((address & 0x07FF) < 0x07FF && address < 0x1FFF) {
-			return cpu_memory[address & 0x07FF];
-		}
-		// 0x2000-0x3FFF PPU Registers
-		else if (address >= 0x2000 && address <= 0x3FFF) {
-			return 0x00;
-		}
-		// 0x4000-0x4017 APU & I/O Registers
-		else if (address >= 0x4000 && address <= 0x4017) {
-			return 0x00;
-		}
-		// 0x4018-0x401F APU & I/O functionality from test mode
-		else if (address >= 0x4018 && address <= 0x401F) {
-			return 0x00;
+void cpubus_set_testmode_logging(nes_system* system, u8 enabled) {
+	// Writes made through the page table aren't tracked, start from clean memory
+	cpubus_reset_testmode(system);
+
+	system->testmode_logging = enabled;
+	system->testmode_log_count = 0;
+
+	u8* memory = enabled ? NULL : system->testmode_memory;
+	cpubus_map(system, 0x00, 256, memory, memory);
+}
+
+void cpubus_reset_testmode(nes_system* system) {
+	if (system->testmode_logging && system->testmode_dirty_count <= NES_TESTMODE_DIRTY_SIZE) {
+		for (u32 i = 0; i < system->testmode_dirty_count; i++) {
+			system->testmode_memory[system->testmode_dirty[i]] = 0x00;
 		}
-		// 0x4020-0xFFFF Cartridge use
-		else {
-			return cartridge_read(address);
+	}
+	else {
+		for (u32 i = 0; i < 0x10000; i++) {
+			system->testmode_memory[i] = 0x00;
 		}
 	}
+
+	system->testmode_dirty_count = 0;
+}
+
+void cpubus_map(nes_system* system, u8 first_page, u16 page_count, u8* read_memory, u8* write_memory) {
+	// Whatever would go past $FFFF is cut off
+	if (first_page + page_count > 0x100) {
+		page_count = 0x100 - first_page;
+	}
+
+	for (u16 i = 0; i < page_count; i++) {
+		u16 page = first_page + i;
+		u8* read = read_memory != NULL ? read_memory + i * 0x100 : NULL;
+		u8* write = write_memory != NULL ? write_memory + i * 0x100 : NULL;
+
+		// RAM that's still shared with a fork reads from the snapshot until it's written
+		bus_set_cow_page(system->cpu_cow_pages, page, cartridge_cow_redirect(system, &read, &write));
+
+		system->cpu_read_pages[page] = read;
+		system->cpu_write_pages[page] = write;
+	}
+}
+
+static void cpubus_log(nes_system* system, u16 address, u8 value, u8 is_write) {
+	if (system->testmode_log_count < NES_TESTMODE_LOG_SIZE) {
+		bus_access* access = &system->testmode_log[system->testmode_log_count];
+		access->address = address;
+		access->value = value;
+		access->is_write = is_write;
+	}
+
+	system->testmode_log_count++;
+}
+
+u8 cpubus_read_slow(nes_system* system, u16 address) {
+	if (system->testmode_logging) {
+		u8 value = system->testmode_memory[address];
+		cpubus_log(system, address, value, 0);
+		return value;
+	}
+
+	// 0x2000-0x3FFF PPU Registers, the PPU is caught up to the CPU first
+	if (address >= 0x2000 && address <= 0x3FFF) {
+		ppu_run(system, system->cpu_bus_cycle * 3);
+		return ppu_read_register(system, address);
+	}
+	// 0x4016-0x4017 Controllers
+	else if (address == 0x4016 || address == 0x4017) {
+		return controller_read(system, address - 0x4016);
+	}
+	// 0x4015 APU status, the APU is caught up to the CPU first
+	else if (address == 0x4015) {
+		apu_run(system, system->cpu_bus_cycle);
+		return apu_read_status(system);
+	}
+	// 0x4000-0x4014 APU & I/O Registers
+	else if (address >= 0x4000 && address <= 0x4014) {
+		return 0x00;
+	}
+	// 0x4018-0x401F APU & I/O functionality from test mode
+	else if (address >= 0x4018 && address <= 0x401F) {
+		return 0x00;
+	}
+	// 0x4020-0xFFFF Cartridge use
 	else {
-		return testmode_memory[address];
+		return cartridge_read(system, address);
 	}
 }
 
-void cpubus_write(u16 address, u8 value) {
-	if (testmode_enabled == 0) {
-		// 0x0000-0x1FFF CPU RAM
-		if ((address & 0x07FF) < 0x07FF && address < 0x1FFF) {
-			cpu_memory[address & 0x07FF] = value;
-		}
-		// 0x2000-0x3FFF PPU Registers
-		else if (address >= 0x2000 && address <= 0x3FFF) {
-			// Write to PPU Registers
-		}
-		// 0x4000-0x4017 APU & I/O Registers
-		else if (address >= 0x4000 && address <= 0x4017) {
-			// Write to APU or I/O Registers
-		}
-		// 0x4018-0x401F APU & I/O functionality from test mode
-		else if (address >= 0x4018 && address <= 0x401F) {
-			// test mode
+void cpubus_write_slow(nes_system* system, u16 address, u8 value) {
+	if (system->testmode_logging) {
+		// Past the end of the list the next reset clears everything
+		if (system->testmode_dirty_count < NES_TESTMODE_DIRTY_SIZE) {
+			system->testmode_dirty[system->testmode_dirty_count] = address;
 		}
-		// 0x4020-0xFFFF Cartridge use
-		else {
-			cartridge_write(address, value);
+		system->testmode_dirty_count++;
+
+		system->testmode_memory[address] = value;
+		cpubus_log(system, address, value, 1);
+		return;
+	}
+
+	// 0x2000-0x3FFF PPU Registers, the PPU is caught up to the CPU first
+	if (address >= 0x2000 && address <= 0x3FFF) {
+		ppu_run(system, system->cpu_bus_cycle * 3);
+		ppu_write_register(system, address, value);
+
+		// The pattern tables and rendering being on decide when scanline counters clock
+		const mapper_interface* mapper = system->cartridge.mapper_functions;
+		if ((address & 0x0006) == 0 && mapper != NULL && mapper->ppu_changed != NULL) {
+			mapper->ppu_changed(system);
 		}
 	}
+	// 0x4014 OAM DMA, it starts once the writing instruction is done
+	else if (address == 0x4014) {
+		system->oam_dma_page = value;
+		scheduler_schedule(system, EVENT_OAM_DMA, system->cpu_bus_cycle * SCHEDULER_TICKS_PER_CPU_CYCLE);
+	}
+	// 0x4016 Controller strobe
+	else if (address == 0x4016) {
+		controller_write(system, value);
+	}
+	// 0x4000-0x4017 APU Registers, the APU is caught up to the CPU first
+	else if (address >= 0x4000 && address <= 0x4017) {
+		apu_run(system, system->cpu_bus_cycle);
+		apu_write_register(system, address, value);
+	}
+	// 0x4018-0x401F APU & I/O functionality from test mode
+	else if (address >= 0x4018 && address <= 0x401F) {
+		// test mode
+	}
+	// 0x4020-0xFFFF Cartridge RAM still shared with a fork, the page is copied first
+	else if (bus_cow_page(system->cpu_cow_pages, address >> 8)) {
+		cartridge_cow_write(system, system->cpu_read_pages[address >> 8], address & 0xFF, value);
+	}
+	// 0x4020-0xFFFF Cartridge use
 	else {
-		testmode_memory[address] = value;
+		cartridge_write(system, address, value);
 	}
 }
 
-void ppubus_init() {
-	for (u16 i = 0; i < 0x07FF; i++) {
-		ppu_memory[i] = 0x00;
+void ppubus_init(nes_system* system) {
+	for (u16 i = 0; i < 0x0800; i++) {
+		system->ppu_memory[i] = 0x00;
 	}
+
+	ppubus_map(system, 0, 16, NULL, NULL);
+	ppubus_set_mirroring(system, MIRRORING_HORIZONTAL);
 }
 
-u8 ppubus_read(u16 address) {
-	if (address < 0x07FF) {
-		return ppu_memory[address];
+void ppubus_map(nes_system* system, u8 first_page, u8 page_count, u8* read_memory, u8* write_memory) {
+	// The 16 pages end at $3FFF, whatever would go past that is cut off
+	if (first_page >= 16) {
+		return;
 	}
-	else {
-		return 0x00;
+	if (first_page + page_count > 16) {
+		page_count = 16 - first_page;
+	}
+
+	for (u8 i = 0; i < page_count; i++) {
+		u8 page = first_page + i;
+		u8* read = read_memory != NULL ? read_memory + i * 0x400 : NULL;
+		u8* write = write_memory != NULL ? write_memory + i * 0x400 : NULL;
+
+		bus_set_cow_page(system->ppu_cow_pages, page, cartridge_cow_redirect(system, &read, &write));
+
+		system->ppu_read_pages[page] = read;
+		system->ppu_write_pages[page] = write;
 	}
 }
 
-void ppubus_write(u16 address, u8 value) {
-	if (address < 0x07FF) {
-		ppu_memory[address] = value;
+void ppubus_write_slow(nes_system* system, u16 address, u8 value) {
+	// Writes to CHR ROM are dropped, only RAM shared with a fork ends up here
+	if (bus_cow_page(system->ppu_cow_pages, address >> 10)) {
+		cartridge_cow_write(system, system->ppu_read_pages[address >> 10], address & 0x3FF, value);
 	}
-}
\ No newline at end of file
+}
+
+void ppubus_set_mirroring(nes_system* system, nametable_mirroring mirroring) {
+	// Which of the two 1KB nametables each of $2000/$2400/$2800/$2C00 shows
+	static const u8 layouts[4][4] = {
+		[MIRRORING_HORIZONTAL] = { 0, 0, 1, 1 },
+		[MIRRORING_VERTICAL] = { 0, 1, 0, 1 },
+		[MIRRORING_SINGLE_LOWER] = { 0, 0, 0, 0 },
+		[MIRRORING_SINGLE_UPPER] = { 1, 1, 1, 1 },
+	};
+
+	for (u8 i = 0; i < 4; i++) {
+		u8* nametable = system->ppu_memory + layouts[mirroring][i] * 0x400;
+
+		// $3000-$3EFF mirrors $2000-$2EFF
+		ppubus_map(system, 0x08 + i, 1, nametable, nametable);
+		ppubus_map(system, 0x0C + i, 1, nametable, nametable);
+	}
+}
@@ -1,12 +1,101 @@
 #pragma once
 
 #include "types.h"
+#include "nes.h"
 
-void cpubus_init();
-void cpubus_enable_testmode(u8* memory);
-u8 cpubus_read(u16 address);
-void cpubus_write(u16 address, u8 value);
+#include <stddef.h>
 
-void ppubus_init();
-u8 ppubus_read(u16 address);
-void ppubus_write(u16 address, u8 value);
\ No newline at end of file
+// The CPU address space is split into 256 byte pages. Pages backed by plain memory
+// point straight at it, pages that are NULL go through the slow path which
+// handles the I/O registers and anything the cartridge has to decide per access.
+
+void cpubus_init(nes_system* system);
+void cpubus_enable_testmode(nes_system* system, u8* memory);
+// Unmaps the test memory so every access takes the slow path, which records it
+// in the system's test mode log.
+void cpubus_set_testmode_logging(nes_system* system, u8 enabled);
+// Zeroes the test memory again. While logging only the addresses written since
+// the last reset are cleared, otherwise it falls back to clearing all of it.
+void cpubus_reset_testmode(nes_system* system);
+void cpubus_map(nes_system* system, u8 first_page, u16 page_count, u8* read_memory, u8* write_memory);
+
+// Bits of cpu_cow_pages/ppu_cow_pages, set for pages whose writes are held back
+// because they still read from a fork's snapshot.
+static inline int bus_cow_page(const u8* bits, u32 page) {
+	return (bits[page >> 3] >> (page & 7)) & 1;
+}
+
+static inline void bus_set_cow_page(u8* bits, u32 page, int held) {
+	bits[page >> 3] = (bits[page >> 3] & ~(1 << (page & 7))) | (held << (page & 7));
+}
+
+u8 cpubus_read_slow(nes_system* system, u16 address);
+void cpubus_write_slow(nes_system* system, u16 address, u8 value);
+
+static inline u8 cpubus_read(nes_system* system, u16 address) {
+	u8* page = system->cpu_read_pages[address >> 8];
+	if (page != NULL) {
+		return page[address & 0xFF];
+	}
+
+	return cpubus_read_slow(system, address);
+}
+
+static inline void cpubus_write(nes_system* system, u16 address, u8 value) {
+	u8* page = system->cpu_write_pages[address >> 8];
+	if (page != NULL) {
+		page[address & 0xFF] = value;
+	}
+	else {
+		cpubus_write_slow(system, address, value);
+	}
+}
+
+// The PPU address space works the same way with 16 pages of 1KB, so mappers can
+// bank CHR in 1KB steps. $2000-$2FFF (mirrored at $3000) holds the nametables and
+// palette RAM at $3F00-$3FFF lives in the PPU itself.
+
+typedef enum nametable_mirroring {
+	MIRRORING_HORIZONTAL,
+	MIRRORING_VERTICAL,
+	MIRRORING_SINGLE_LOWER,
+	MIRRORING_SINGLE_UPPER,
+} nametable_mirroring;
+
+void ppubus_init(nes_system* system);
+void ppubus_map(nes_system* system, u8 first_page, u8 page_count, u8* read_memory, u8* write_memory);
+void ppubus_set_mirroring(nes_system* system, nametable_mirroring mirroring);
+
+void ppubus_write_slow(nes_system* system, u16 address, u8 value);
+
+// $3F10/$3F14/$3F18/$3F1C are mirrors of $3F00/$3F04/$3F08/$3F0C.
+static inline u8 ppubus_palette_index(u16 address) {
+	u8 index = address & 0x1F;
+	return (index & 0x13) == 0x10 ? index & 0x0F : index;
+}
+
+static inline u8 ppubus_read(nes_system* system, u16 address) {
+	address &= 0x3FFF;
+	if (address >= 0x3F00) {
+		return system->ppu.palette[ppubus_palette_index(address)];
+	}
+
+	u8* page = system->ppu_read_pages[address >> 10];
+	return page != NULL ? page[address & 0x3FF] : 0x00;
+}
+
+static inline void ppubus_write(nes_system* system, u16 address, u8 value) {
+	address &= 0x3FFF;
+	if (address >= 0x3F00) {
+		system->ppu.palette[ppubus_palette_index(address)] = value & 0x3F;
+		return;
+	}
+
+	u8* page = system->ppu_write_pages[address >> 10];
+	if (page != NULL) {
+		page[address & 0x3FF] = value;
+	}
+	else {
+		ppubus_write_slow(system, address, value);
+	}
+}
@@ -0,0 +1,149 @@
+#include "nes.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "memory_bus.h"
+
+int nes_init(nes_system* system, const char* rom_path) {
+	memset(system, 0, sizeof(nes_system));
+	scheduler_init(&system->scheduler);
+
+	// The cartridge maps itself into both buses, so they're set up first
+	cpubus_init(system);
+	ppubus_init(system);
+	ppu_init(system);
+	apu_init(system);
+
+	if (cartridge_init(system, rom_path) != 0) {
+		return -1;
+	}
+
+	cpu_init(&system->cpu, system);
+
+	return 0;
+}
+
+void nes_init_testmode(nes_system* system, u8* memory) {
+	memset(system, 0, sizeof(nes_system));
+	scheduler_init(&system->scheduler);
+
+	cpubus_enable_testmode(system, memory);
+	cpubus_init(system);
+	ppubus_init(system);
+	ppu_init(system);
+	apu_init(system);
+	cpu_init(&system->cpu, system);
+}
+
+void nes_free(nes_system* system) {
+	cartridge_free(system);
+}
+
+int nes_fork(nes_system* parent, nes_system* child) {
+	if (cartridge_freeze_ram(parent) != 0) {
+		return -1;
+	}
+
+	memcpy(child, parent, sizeof(nes_system));
+	child->cpu.system = child;
+	child->cpu.trace = NULL;
+	child->apu.output = NULL;
+
+	// Pages mapped to the parent's internal RAM and nametables move to the child's
+	const u8* parent_start = (const u8*)parent;
+	const u8* parent_end = parent_start + sizeof(nes_system);
+	u8** pages[4] = { child->cpu_read_pages, child->cpu_write_pages, child->ppu_read_pages, child->ppu_write_pages };
+	u32 page_counts[4] = { 256, 256, 16, 16 };
+
+	for (u32 table = 0; table < 4; table++) {
+		for (u32 page = 0; page < page_counts[table]; page++) {
+			u8* memory = pages[table][page];
+			if (memory >= parent_start && memory < parent_end) {
+				pages[table][page] = (u8*)child + (memory - parent_start);
+			}
+		}
+	}
+
+	return cartridge_share(child);
+}
+
+// The CPU is halted while the DMA copies, 513 cycles plus one more to line up
+// with a read cycle when it starts on an odd one. Events that come due during
+// the stall are handled right after it by nes_run_events. That's soon enough:
+// the PPU and APU catch up to the exact cycle anyway, and the CPU couldn't take
+// an NMI or IRQ before the DMA is done.
+static void nes_run_oam_dma(nes_system* system) {
+	u64 cycle = system->cpu.total_cycles;
+
+	ppu_run(system, cycle * 3);
+	ppu_oam_dma(system, system->oam_dma_page);
+
+	system->cpu.total_cycles += 513 + (cycle & 1);
+}
+
+static void nes_run_events(nes_system* system) {
+	while (1) {
+		u64 cycle = system->cpu.total_cycles;
+
+		switch (scheduler_pop_due(&system->scheduler, cycle * SCHEDULER_TICKS_PER_CPU_CYCLE)) {
+		case EVENT_PPU:
+			ppu_run(system, cycle * 3);
+			scheduler_schedule(system, EVENT_PPU, ppu_next_event(&system->ppu) * SCHEDULER_TICKS_PER_PPU_DOT);
+			break;
+		case EVENT_APU_FRAME_IRQ:
+		case EVENT_APU_DMC_IRQ:
+			apu_run(system, cycle);
+			apu_schedule_irqs(system);
+			break;
+		case EVENT_MAPPER_IRQ:
+			system->cartridge.mapper_functions->irq_event(system);
+			break;
+		case EVENT_OAM_DMA:
+			nes_run_oam_dma(system);
+			break;
+		default:
+			return;
+		}
+	}
+}
+
+// The CPU runs freely until the next scheduled event, the PPU and APU only
+// catch up to it there and when one of their registers is accessed. Interrupts
+// are looked at between runs, the CPU stops early when something raises one.
+void nes_run_frame(nes_system* system) {
+	ppu* ppu_state = &system->ppu;
+	u64 frame = ppu_state->frame_count;
+
+	while (ppu_state->frame_count == frame) {
+		// The PPU event is what ends the frame, without it the loop would never get there
+		if (scheduler_next_time(&system->scheduler) == UINT64_MAX) {
+			scheduler_schedule(system, EVENT_PPU, ppu_next_event(ppu_state) * SCHEDULER_TICKS_PER_PPU_DOT);
+		}
+
+		u64 next_time = scheduler_next_time(&system->scheduler);
+		u64 target_cycle = next_time / SCHEDULER_TICKS_PER_CPU_CYCLE + (next_time % SCHEDULER_TICKS_PER_CPU_CYCLE != 0);
+
+		if (system->cpu.total_cycles < target_cycle) {
+			cpu_run_cycles(&system->cpu, target_cycle - system->cpu.total_cycles);
+		}
+
+		nes_run_events(system);
+
+		if (ppu_state->nmi_pending) {
+			ppu_state->nmi_pending = 0;
+			cpu_nmi(&system->cpu);
+		}
+		else if (system->irq_line != 0) {
+			cpu_irq(&system->cpu);
+		}
+	}
+
+	apu_end_frame(system);
+}
+
+double nes_frame_rate(const nes_system* system) {
+	// The timing itself is always emulated as NTSC, Dendy consoles run at the PAL rate
+	u8 timing = system->cartridge.info.timing;
+	return (timing == ROM_TIMING_PAL || timing == ROM_TIMING_DENDY) ? NES_PAL_FRAMES_PER_SECOND : NES_NTSC_FRAMES_PER_SECOND;
+}
\ No newline at end of file
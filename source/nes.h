@@ -0,0 +1,108 @@
+#pragma once
+
+#include "types.h"
+#include "cpu.h"
+#include "cartridge.h"
+#include "ppu.h"
+#include "apu.h"
+#include "scheduler.h"
+
+// NTSC CPU runs at 1.789773 MHz, a frame is 29780.5 CPU cycles.
+#define NES_NTSC_CPU_CYCLES_PER_SECOND 1789773
+#define NES_NTSC_CPU_CYCLES_PER_FRAME 29781
+
+// Real consoles' frame rates, what the frontend paces frames to.
+#define NES_NTSC_FRAMES_PER_SECOND 60.0988
+#define NES_PAL_FRAMES_PER_SECOND 50.0070
+
+// Everything that can pull the CPU's IRQ line, as bits of nes_system.irq_line.
+#define NES_IRQ_APU_FRAME 0x01
+#define NES_IRQ_MAPPER 0x02
+#define NES_IRQ_DMC 0x04
+
+#define NES_TESTMODE_LOG_SIZE 16
+#define NES_TESTMODE_DIRTY_SIZE 64
+
+// One CPU bus access as recorded in test mode.
+typedef struct bus_access {
+	u16 address;
+	u8 value;
+	u8 is_write;
+} bus_access;
+
+// Everything one emulated console owns. Nothing is shared between systems so
+// any number of them can run in the same process.
+typedef struct nes_system {
+	cpu cpu;
+
+	// CPU bus, see memory_bus.h for the page table
+	u8* cpu_read_pages[256];
+	u8* cpu_write_pages[256];
+	u8 cpu_memory[0x0800];
+	// Pages whose writes are held back because they still read from a fork's
+	// snapshot, one bit each. The first write copies the page (see nes_fork)
+	u8 cpu_cow_pages[256 / 8];
+
+	// CPU cycle of the access currently in the slow path, counting the access itself
+	u64 cpu_bus_cycle;
+	// cpu_run returns once an instruction finishes at or past this cycle, the
+	// scheduler pulls it in when an event is queued before it
+	u64 cpu_stop_cycle;
+
+	scheduler scheduler;
+
+	// The IRQ line is low while any of these bits are set
+	u8 irq_line;
+	// Page the queued OAM DMA copies from
+	u8 oam_dma_page;
+
+	u8* testmode_memory;
+	u8 testmode_enabled;
+
+	// While logging every CPU bus access is recorded, the count keeps going
+	// past the end of the log so overflowing it can be noticed
+	u8 testmode_logging;
+	u32 testmode_log_count;
+	bus_access testmode_log[NES_TESTMODE_LOG_SIZE];
+
+	// Addresses written while logging, so a reset only has to clear those
+	u32 testmode_dirty_count;
+	u16 testmode_dirty[NES_TESTMODE_DIRTY_SIZE];
+
+	// PPU bus, see memory_bus.h. ppu_memory is the 2KB of nametable RAM
+	u8* ppu_read_pages[16];
+	u8* ppu_write_pages[16];
+	u8 ppu_memory[0x0800];
+	u8 ppu_cow_pages[16 / 8];
+
+	ppu ppu;
+	apu apu;
+
+	// Standard controllers on $4016/$4017
+	u8 controller_buttons[2];
+	u8 controller_shift[2];
+	u8 controller_strobe;
+
+	cartridge cartridge;
+} nes_system;
+
+// Loads the rom and powers the system on, returns 0 on success.
+int nes_init(nes_system* system, const char* rom_path);
+// Powers the system on with the whole CPU bus mapped to `memory` (0x10000 bytes).
+void nes_init_testmode(nes_system* system, u8* memory);
+void nes_free(nes_system* system);
+
+// Makes `child` a copy of `parent` that runs on independently. The ROM is shared
+// and so is the cartridge RAM, page by page until one of the two writes to it,
+// so a fork costs about a copy of nes_system no matter how big the rom is. The
+// 2KB of internal RAM and VRAM are part of nes_system and copied with it. The
+// child has no audio output and shares the parent's test mode memory. Free it
+// with nes_free like any other system. Returns 0 on success.
+int nes_fork(nes_system* parent, nes_system* child);
+
+// Runs the system for one video frame.
+void nes_run_frame(nes_system* system);
+
+// Frames per second of the console the rom was made for, from the timing in
+// rom_info (the NES 2.0 header, the iNES TV system bit or the rom database).
+double nes_frame_rate(const nes_system* system);
@@ -0,0 +1,553 @@
+#include "ppu.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "nes.h"
+#include "memory_bus.h"
+
+const u32 ppu_palette_rgb[64] = {
+	0xFF666666, 0xFF002A88, 0xFF1412A7, 0xFF3B00A4, 0xFF5C007E, 0xFF6E0040, 0xFF6C0600, 0xFF561D00,
+	0xFF333500, 0xFF0B4800, 0xFF005200, 0xFF004F08, 0xFF00404D, 0xFF000000, 0xFF000000, 0xFF000000,
+	0xFFADADAD, 0xFF155FD9, 0xFF4240FF, 0xFF7527FE, 0xFFA01ACC, 0xFFB71E7B, 0xFFB53120, 0xFF994E00,
+	0xFF6B6D00, 0xFF388700, 0xFF0C9300, 0xFF008F32, 0xFF007C8D, 0xFF000000, 0xFF000000, 0xFF000000,
+	0xFFFFFEFF, 0xFF64B0FF, 0xFF9290FF, 0xFFC676FF, 0xFFF36AFF, 0xFFFE6ECC, 0xFFFE8170, 0xFFEA9E22,
+	0xFFBCBE00, 0xFF88D800, 0xFF5CE430, 0xFF45E082, 0xFF48CDDE, 0xFF4F4F4F, 0xFF000000, 0xFF000000,
+	0xFFFFFEFF, 0xFFC0DFFF, 0xFFD3D2FF, 0xFFE8C8FF, 0xFFFBC2FF, 0xFFFEC4EA, 0xFFFECCC5, 0xFFF7D8A5,
+	0xFFE4E594, 0xFFCFEF96, 0xFFBDF4AB, 0xFFB3F3CC, 0xFFB5EBF2, 0xFFB8B8B8, 0xFF000000, 0xFF000000,
+};
+
+void ppu_init(nes_system* system) {
+	memset(&system->ppu, 0, sizeof(ppu));
+	scheduler_schedule(system, EVENT_PPU, ppu_next_event(&system->ppu) * SCHEDULER_TICKS_PER_PPU_DOT);
+}
+
+static inline void ppu_increment_address(ppu* state) {
+	state->vram_address = (state->vram_address + (state->control.increment_32 ? 32 : 1)) & 0x7FFF;
+}
+
+u8 ppu_read_register(nes_system* system, u16 address) {
+	ppu* state = &system->ppu;
+
+	switch (address & 0x0007) {
+	// PPUSTATUS, the low bits are whatever was last on the PPU's data bus
+	case 2: {
+		u8 value = (state->status.as_byte & 0xE0) | (state->io_latch & 0x1F);
+		state->status.vblank = 0;
+		state->write_toggle = 0;
+		state->io_latch = value;
+		break;
+	}
+	// OAMDATA
+	case 4:
+		state->io_latch = state->oam[state->oam_address];
+		break;
+	// PPUDATA, reads below the palette come from a buffer that's one read behind
+	case 7: {
+		u16 vram_address = state->vram_address & 0x3FFF;
+		if (vram_address >= 0x3F00) {
+			state->io_latch = ppubus_read(system, vram_address);
+			state->read_buffer = ppubus_read(system, vram_address - 0x1000);
+		}
+		else {
+			state->io_latch = state->read_buffer;
+			state->read_buffer = ppubus_read(system, vram_address);
+		}
+
+		ppu_increment_address(state);
+		break;
+	}
+	// The write only registers read back the data bus
+	default:
+		break;
+	}
+
+	return state->io_latch;
+}
+
+void ppu_write_register(nes_system* system, u16 address, u8 value) {
+	ppu* state = &system->ppu;
+	state->io_latch = value;
+
+	switch (address & 0x0007) {
+	// PPUCTRL
+	case 0: {
+		u8 nmi_was_enabled = state->control.nmi_enable;
+		state->control.as_byte = value;
+		state->temp_address = (state->temp_address & 0xF3FF) | ((value & 0x03) << 10);
+
+		// Turning NMIs on during vblank raises one straight away
+		if (!nmi_was_enabled && state->control.nmi_enable && state->status.vblank) {
+			state->nmi_pending = 1;
+			scheduler_schedule(system, EVENT_PPU, state->cycle * SCHEDULER_TICKS_PER_PPU_DOT);
+		}
+		break;
+	}
+	// PPUMASK
+	case 1:
+		state->mask.as_byte = value;
+		break;
+	// OAMADDR
+	case 3:
+		state->oam_address = value;
+		break;
+	// OAMDATA
+	case 4:
+		state->oam[state->oam_address] = value;
+		state->oam_address++;
+		break;
+	// PPUSCROLL
+	case 5:
+		if (state->write_toggle == 0) {
+			state->temp_address = (state->temp_address & 0xFFE0) | (value >> 3);
+			state->fine_x = value & 0x07;
+		}
+		else {
+			state->temp_address = (state->temp_address & 0x8C1F) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+		}
+		state->write_toggle ^= 1;
+		break;
+	// PPUADDR
+	case 6:
+		if (state->write_toggle == 0) {
+			state->temp_address = (state->temp_address & 0x00FF) | ((value & 0x3F) << 8);
+		}
+		else {
+			state->temp_address = (state->temp_address & 0xFF00) | value;
+			state->vram_address = state->temp_address;
+		}
+		state->write_toggle ^= 1;
+		break;
+	// PPUDATA
+	case 7:
+		ppubus_write(system, state->vram_address, value);
+		ppu_increment_address(state);
+		break;
+	default:
+		break;
+	}
+}
+
+void ppu_oam_dma(nes_system* system, u8 page) {
+	ppu* state = &system->ppu;
+
+	for (u16 i = 0; i < 256; i++) {
+		state->oam[state->oam_address] = cpubus_read(system, (page << 8) | i);
+		state->oam_address++;
+	}
+}
+
+static inline int ppu_rendering_enabled(const ppu* state) {
+	return state->mask.background_enable || state->mask.sprites_enable;
+}
+
+// Dot of a rendered scanline where PPU A12 goes high after being low for a
+// while, which is when MMC3 style scanline counters clock. Sprite patterns from
+// $1000 are fetched from dot 257 on, background tiles from $1000 (after sprites
+// from $0000) from dot 321 on. 8x16 sprites are assumed to come from $1000.
+// 0 if the tables don't make A12 rise once per line.
+static inline u32 ppu_a12_rise_dot(const ppu* state) {
+	if (state->control.sprite_size_16 || (state->control.sprite_table && !state->control.background_table)) {
+		return 260;
+	}
+	else if (state->control.background_table && !state->control.sprite_table) {
+		return 324;
+	}
+	return 0;
+}
+
+// Moves v one tile right, going into the nametable next to it after the 32nd tile.
+static inline void ppu_increment_x(ppu* state) {
+	if ((state->vram_address & 0x001F) == 31) {
+		state->vram_address = (state->vram_address & ~0x001F) ^ 0x0400;
+	}
+	else {
+		state->vram_address++;
+	}
+}
+
+// Moves v down a pixel row, going into the nametable below after the 30th tile row.
+static void ppu_increment_y(ppu* state) {
+	u16 address = state->vram_address;
+
+	if ((address & 0x7000) != 0x7000) {
+		state->vram_address = address + 0x1000;
+		return;
+	}
+
+	address &= ~0x7000;
+	u16 coarse_y = (address & 0x03E0) >> 5;
+	if (coarse_y == 29) {
+		coarse_y = 0;
+		address ^= 0x0800;
+	}
+	else if (coarse_y == 31) {
+		// Rows 30 and 31 hold the attributes, scrolling into them wraps without switching nametables
+		coarse_y = 0;
+	}
+	else {
+		coarse_y++;
+	}
+
+	state->vram_address = (address & ~0x03E0) | (coarse_y << 5);
+}
+
+static inline void ppu_copy_horizontal(ppu* state) {
+	state->vram_address = (state->vram_address & ~0x041F) | (state->temp_address & 0x041F);
+}
+
+static inline void ppu_copy_vertical(ppu* state) {
+	state->vram_address = (state->vram_address & ~0x7BE0) | (state->temp_address & 0x7BE0);
+}
+
+static inline void ppu_shift_background(ppu* state) {
+	state->pattern_low <<= 1;
+	state->pattern_high <<= 1;
+	state->attribute_low <<= 1;
+	state->attribute_high <<= 1;
+}
+
+// The real PPU spreads the four fetches of a tile over 8 dots, here they all
+// happen on the last one, right before v moves on to the next tile.
+static inline void ppu_fetch_tile(nes_system* system) {
+	ppu* state = &system->ppu;
+	u16 address = state->vram_address;
+
+	u8 tile_index = ppubus_read(system, 0x2000 | (address & 0x0FFF));
+	u8 attribute = ppubus_read(system, 0x23C0 | (address & 0x0C00) | ((address >> 4) & 0x38) | ((address >> 2) & 0x07));
+	u8 palette = attribute >> (((address >> 4) & 0x04) | (address & 0x02));
+
+	u16 pattern_address = (state->control.background_table ? 0x1000 : 0x0000) + tile_index * 16 + ((address >> 12) & 0x07);
+	state->pattern_low |= ppubus_read(system, pattern_address);
+	state->pattern_high |= ppubus_read(system, pattern_address + 8);
+	state->attribute_low |= (palette & 0x01) ? 0x00FF : 0x0000;
+	state->attribute_high |= (palette & 0x02) ? 0x00FF : 0x0000;
+}
+
+static u8 ppu_reverse_bits(u8 value) {
+	value = (value & 0xF0) >> 4 | (value & 0x0F) << 4;
+	value = (value & 0xCC) >> 2 | (value & 0x33) << 2;
+	value = (value & 0xAA) >> 1 | (value & 0x55) << 1;
+	return value;
+}
+
+// Picks the first 8 sprites on the next scanline out of OAM and fetches their
+// patterns, the real PPU does this over dots 65-320.
+static void ppu_evaluate_sprites(nes_system* system) {
+	ppu* state = &system->ppu;
+
+	int height = state->control.sprite_size_16 ? 16 : 8;
+	state->sprite_count = 0;
+	state->sprite_zero_on_line = 0;
+
+	for (u32 sprite = 0; sprite < 64; sprite++) {
+		const u8* entry = &state->oam[sprite * 4];
+
+		// OAM holds the sprite's Y minus one, so this is the row on the next scanline
+		int row = (int)state->scanline - entry[0];
+		if (row < 0 || row >= height) {
+			continue;
+		}
+
+		if (state->sprite_count == 8) {
+			state->status.sprite_overflow = 1;
+			break;
+		}
+
+		u8 tile = entry[1];
+		u8 attributes = entry[2];
+
+		if (attributes & 0x80) {
+			row = height - 1 - row;
+		}
+
+		u16 pattern_base;
+		if (height == 16) {
+			pattern_base = (tile & 0x01) ? 0x1000 : 0x0000;
+			tile &= 0xFE;
+			if (row >= 8) {
+				tile++;
+				row -= 8;
+			}
+		}
+		else {
+			pattern_base = state->control.sprite_table ? 0x1000 : 0x0000;
+		}
+
+		u16 pattern_address = pattern_base + tile * 16 + row;
+		u8 low = ppubus_read(system, pattern_address);
+		u8 high = ppubus_read(system, pattern_address + 8);
+
+		if (attributes & 0x40) {
+			low = ppu_reverse_bits(low);
+			high = ppu_reverse_bits(high);
+		}
+
+		u8 index = state->sprite_count++;
+		state->sprite_x[index] = entry[3];
+		state->sprite_attributes[index] = attributes;
+		state->sprite_pattern_low[index] = low;
+		state->sprite_pattern_high[index] = high;
+
+		if (sprite == 0) {
+			state->sprite_zero_on_line = 1;
+		}
+	}
+}
+
+// Lower OAM entries win overlaps, even when they're behind the background.
+static inline u8 ppu_sprite_pixel(nes_system* system, u32 x, u8 background) {
+	ppu* state = &system->ppu;
+
+	for (u32 i = 0; i < state->sprite_count; i++) {
+		u32 offset = x - state->sprite_x[i];
+		if (offset >= 8) {
+			continue;
+		}
+
+		u32 shift = 7 - offset;
+		u8 pixel = ((state->sprite_pattern_low[i] >> shift) & 0x01) | (((state->sprite_pattern_high[i] >> shift) & 0x01) << 1);
+		if (pixel == 0) {
+			continue;
+		}
+
+		if (i == 0 && state->sprite_zero_on_line && background != 0 && x != 255) {
+			state->status.sprite_zero_hit = 1;
+		}
+
+		if (background == 0 || !(state->sprite_attributes[i] & 0x20)) {
+			return 0x10 | ((state->sprite_attributes[i] & 0x03) << 2) | pixel;
+		}
+		return background;
+	}
+
+	return background;
+}
+
+// Dots [start, end) within 1-256, where the pixels come out while the background
+// shifts along and a new tile is fetched every 8 dots. The shift registers are
+// kept in locals, the framebuffer writes would make the compiler reload them otherwise.
+static void ppu_run_pixels(nes_system* system, u32 start, u32 end, int visible) {
+	ppu* state = &system->ppu;
+	u8* out = &state->framebuffer[state->scanline * PPU_SCREEN_WIDTH];
+	u8 color_mask = state->mask.grayscale ? 0x30 : 0x3F;
+
+	// Pixels left of these columns are hidden
+	u32 background_from = !state->mask.background_enable ? PPU_SCREEN_WIDTH : state->mask.background_left ? 0 : 8;
+	u32 sprites_from = !state->mask.sprites_enable || state->sprite_count == 0 ? PPU_SCREEN_WIDTH : state->mask.sprites_left ? 0 : 8;
+	u32 shift = 15 - state->fine_x;
+
+	u16 pattern_low = state->pattern_low;
+	u16 pattern_high = state->pattern_high;
+	u16 attribute_low = state->attribute_low;
+	u16 attribute_high = state->attribute_high;
+
+	for (u32 dot = start; dot < end; dot++) {
+		if (visible) {
+			u32 x = dot - 1;
+
+			u8 color = 0;
+			if (x >= background_from) {
+				color = ((pattern_low >> shift) & 0x01) | (((pattern_high >> shift) & 0x01) << 1);
+				if (color != 0) {
+					color |= (((attribute_low >> shift) & 0x01) | (((attribute_high >> shift) & 0x01) << 1)) << 2;
+				}
+			}
+
+			if (x >= sprites_from) {
+				color = ppu_sprite_pixel(system, x, color);
+			}
+
+			out[x] = state->palette[color] & color_mask;
+		}
+
+		pattern_low <<= 1;
+		pattern_high <<= 1;
+		attribute_low <<= 1;
+		attribute_high <<= 1;
+
+		if ((dot & 0x07) == 0) {
+			state->pattern_low = pattern_low;
+			state->pattern_high = pattern_high;
+			state->attribute_low = attribute_low;
+			state->attribute_high = attribute_high;
+
+			ppu_fetch_tile(system);
+			ppu_increment_x(state);
+
+			pattern_low = state->pattern_low;
+			pattern_high = state->pattern_high;
+			attribute_low = state->attribute_low;
+			attribute_high = state->attribute_high;
+		}
+	}
+
+	state->pattern_low = pattern_low;
+	state->pattern_high = pattern_high;
+	state->attribute_low = attribute_low;
+	state->attribute_high = attribute_high;
+}
+
+// Dots [start, end) of a visible or the pre-render scanline with rendering on.
+static void ppu_run_rendering(nes_system* system, u32 start, u32 end) {
+	ppu* state = &system->ppu;
+	int visible = state->scanline < PPU_SCREEN_HEIGHT;
+
+	// Scanline counting mappers see A12 rise once per line
+	const mapper_interface* mapper = system->cartridge.mapper_functions;
+	if (mapper != NULL && mapper->scanline != NULL) {
+		u32 a12_dot = ppu_a12_rise_dot(state);
+		if (a12_dot != 0 && start <= a12_dot && a12_dot < end) {
+			mapper->scanline(system);
+		}
+	}
+
+	if (start <= 256) {
+		u32 first = start < 1 ? 1 : start;
+		u32 last = end > 257 ? 257 : end;
+		if (first < last) {
+			ppu_run_pixels(system, first, last, visible);
+		}
+
+		if (first <= 256 && last > 256) {
+			ppu_increment_y(state);
+		}
+
+		start = last;
+	}
+
+	for (u32 dot = start; dot < end; dot++) {
+		if (dot == 257) {
+			ppu_copy_horizontal(state);
+			state->oam_address = 0;
+
+			if (visible) {
+				ppu_evaluate_sprites(system);
+			}
+			else {
+				state->sprite_count = 0;
+			}
+		}
+		// The first two tiles of the next scanline
+		else if (dot >= 321 && dot <= 336) {
+			ppu_shift_background(state);
+			if ((dot & 0x07) == 0) {
+				ppu_fetch_tile(system);
+				ppu_increment_x(state);
+			}
+		}
+		else if (!visible && dot >= 280 && dot <= 304) {
+			ppu_copy_vertical(state);
+		}
+	}
+}
+
+// Dots [start, end) of the current scanline. Register accesses only happen between
+// spans, so the registers are the same for every dot in one.
+static void ppu_run_span(nes_system* system, u32 start, u32 end) {
+	ppu* state = &system->ppu;
+	int covers_first_dot = start <= 1 && end > 1;
+
+	if (state->scanline == PPU_VBLANK_SCANLINE && covers_first_dot) {
+		state->status.vblank = 1;
+		if (state->control.nmi_enable) {
+			state->nmi_pending = 1;
+		}
+	}
+	else if (state->scanline == PPU_PRERENDER_SCANLINE && covers_first_dot) {
+		state->status.vblank = 0;
+		state->status.sprite_zero_hit = 0;
+		state->status.sprite_overflow = 0;
+	}
+
+	if (state->scanline >= PPU_SCREEN_HEIGHT && state->scanline != PPU_PRERENDER_SCANLINE) {
+		return;
+	}
+
+	if (ppu_rendering_enabled(state)) {
+		ppu_run_rendering(system, start, end);
+	}
+	else if (state->scanline < PPU_SCREEN_HEIGHT) {
+		// Nothing but the backdrop colour
+		u32 first = start < 1 ? 1 : start;
+		u32 last = end > 257 ? 257 : end;
+		if (first < last) {
+			u8* out = &state->framebuffer[state->scanline * PPU_SCREEN_WIDTH + first - 1];
+			memset(out, state->palette[0] & (state->mask.grayscale ? 0x30 : 0x3F), last - first);
+		}
+	}
+}
+
+void ppu_run(nes_system* system, u64 target_cycle) {
+	ppu* state = &system->ppu;
+
+	while (state->cycle < target_cycle) {
+		// Odd frames skip the last dot of the pre-render scanline while rendering
+		u32 line_length = PPU_DOTS_PER_SCANLINE;
+		if (state->scanline == PPU_PRERENDER_SCANLINE && (state->frame_count & 1) && ppu_rendering_enabled(state)) {
+			line_length--;
+		}
+
+		u32 start = state->dot;
+		u32 end = line_length;
+		if (target_cycle - state->cycle < end - start) {
+			end = start + (u32)(target_cycle - state->cycle);
+		}
+
+		ppu_run_span(system, start, end);
+
+		state->cycle += end - start;
+		state->dot = end;
+
+		if (state->dot >= line_length) {
+			state->dot = 0;
+			state->scanline++;
+			if (state->scanline == PPU_SCANLINES_PER_FRAME) {
+				state->scanline = 0;
+				state->frame_count++;
+			}
+		}
+	}
+}
+
+u64 ppu_next_a12_rise(const ppu* state, u32 count) {
+	u32 a12_dot = ppu_a12_rise_dot(state);
+	if (a12_dot == 0 || count == 0 || !ppu_rendering_enabled(state)) {
+		return UINT64_MAX;
+	}
+
+	u64 cycle = state->cycle;
+	u32 scanline = state->scanline;
+	u32 dot = state->dot;
+	u64 frame = state->frame_count;
+	while (1) {
+		if ((scanline < PPU_SCREEN_HEIGHT || scanline == PPU_PRERENDER_SCANLINE) && dot <= a12_dot) {
+			count--;
+			if (count == 0) {
+				return cycle + (a12_dot - dot) + 1;
+			}
+		}
+
+		u32 line_length = PPU_DOTS_PER_SCANLINE;
+		if (scanline == PPU_PRERENDER_SCANLINE && (frame & 1)) {
+			line_length--;
+		}
+
+		cycle += line_length - dot;
+		dot = 0;
+		scanline++;
+		if (scanline == PPU_SCANLINES_PER_FRAME) {
+			scanline = 0;
+			frame++;
+		}
+	}
+}
+
+u64 ppu_next_event(const ppu* state) {
+	u32 position = state->scanline * PPU_DOTS_PER_SCANLINE + state->dot;
+	// Vblank starts on dot 1, so that dot has to have run too
+	u32 vblank = PPU_VBLANK_SCANLINE * PPU_DOTS_PER_SCANLINE + 2;
+	u32 frame_end = PPU_SCANLINES_PER_FRAME * PPU_DOTS_PER_SCANLINE;
+
+	return state->cycle + (position < vblank ? vblank : frame_end) - position;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "types.h"
+
+typedef struct nes_system nes_system;
+
+#define PPU_SCREEN_WIDTH 256
+#define PPU_SCREEN_HEIGHT 240
+#define PPU_SCANLINES_PER_FRAME 262
+#define PPU_DOTS_PER_SCANLINE 341
+
+#define PPU_VBLANK_SCANLINE 241
+#define PPU_PRERENDER_SCANLINE 261
+
+typedef struct ppu {
+	// $2000 PPUCTRL
+	union ppu_control {
+		struct {
+			u8 nametable : 2;
+			u8 increment_32 : 1;
+			u8 sprite_table : 1;
+			u8 background_table : 1;
+			u8 sprite_size_16 : 1;
+			u8 master_slave : 1;
+			u8 nmi_enable : 1;
+		};
+		u8 as_byte;
+	} control;
+
+	// $2001 PPUMASK
+	union ppu_mask {
+		struct {
+			u8 grayscale : 1;
+			u8 background_left : 1;
+			u8 sprites_left : 1;
+			u8 background_enable : 1;
+			u8 sprites_enable : 1;
+			u8 emphasis : 3;
+		};
+		u8 as_byte;
+	} mask;
+
+	// $2002 PPUSTATUS
+	union ppu_status {
+		struct {
+			u8 unused : 5;
+			u8 sprite_overflow : 1;
+			u8 sprite_zero_hit : 1;
+			u8 vblank : 1;
+		};
+		u8 as_byte;
+	} status;
+
+	u8 oam_address;
+
+	// Internal scroll registers, v is the current VRAM address and t the one
+	// $2005/$2006 writes build up (https://www.nesdev.org/wiki/PPU_scrolling)
+	u16 vram_address;
+	u16 temp_address;
+	u8 fine_x;
+	u8 write_toggle;
+
+	u8 read_buffer;
+	u8 io_latch;
+
+	u16 scanline;
+	u16 dot;
+	u64 frame_count;
+
+	// Dots run since power on, three for every CPU cycle
+	u64 cycle;
+
+	// Set when vblank starts with NMIs enabled, cleared by whoever delivers it to the CPU
+	u8 nmi_pending;
+
+	// Background shift registers, the top byte is the tile being drawn and the
+	// bottom byte the next one. The attribute bits are spread out the same way
+	u16 pattern_low, pattern_high;
+	u16 attribute_low, attribute_high;
+
+	// Sprites picked for the current scanline at dot 257 of the previous one,
+	// horizontal flipping is already applied to the patterns
+	u8 sprite_count;
+	u8 sprite_zero_on_line;
+	u8 sprite_x[8];
+	u8 sprite_attributes[8];
+	u8 sprite_pattern_low[8];
+	u8 sprite_pattern_high[8];
+
+	u8 oam[256];
+	u8 palette[32];
+
+	// One palette index (0x00-0x3F) per pixel, see ppu_palette_rgb
+	u8 framebuffer[PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT];
+} ppu;
+
+// 2C02 colours as 0xAARRGGBB for every palette index.
+extern const u32 ppu_palette_rgb[64];
+
+void ppu_init(nes_system* system);
+
+// Register access for $2000-$3FFF, the address is mirrored down to $2000-$2007.
+u8 ppu_read_register(nes_system* system, u16 address);
+void ppu_write_register(nes_system* system, u16 address, u8 value);
+
+// Copies a 256 byte CPU page into OAM ($4014).
+void ppu_oam_dma(nes_system* system, u8 page);
+
+// Runs the PPU until `target_cycle` dots have passed since power on. The dots in
+// between are handled as one span, register accesses in the middle of a scanline
+// catch the PPU up first so their effect starts at the right pixel.
+void ppu_run(nes_system* system, u64 target_cycle);
+
+// Dot count by which PPU A12 will have risen `count` more times, assuming the
+// rendering settings stay as they are. Scanline counting mappers (MMC3) are
+// clocked by it once per rendered line, UINT64_MAX if it doesn't rise that way.
+u64 ppu_next_a12_rise(const ppu* state, u32 count);
+
+// Dot count at which vblank starts or the next frame begins, whichever comes
+// first. On odd frames the frame can begin a dot earlier than this.
+u64 ppu_next_event(const ppu* state);
@@ -0,0 +1,127 @@
+#include "rom_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "file.h"
+#include "thread.h"
+
+// Every image that's loaded. Lookups and dropping the last reference happen
+// under the lock, so an image can't be found while it's being unmapped
+static rom_image* cache_images = NULL;
+static mutex cache_lock = MUTEX_INITIALIZER;
+
+static rom_image* rom_cache_find_file(const char* path, u64 length, u64 modified_time, u64 file_id) {
+	for (rom_image* image = cache_images; image != NULL; image = image->next) {
+		if (
+			image->length == length && image->modified_time == modified_time && image->file_id == file_id &&
+			strcmp(image->path, path) == 0
+		) {
+			return image;
+		}
+	}
+
+	return NULL;
+}
+
+static rom_image* rom_cache_find_contents(const u8* data, u64 length, u32 crc) {
+	for (rom_image* image = cache_images; image != NULL; image = image->next) {
+		if (image->crc32 == crc && image->length == length && memcmp(image->data, data, length) == 0) {
+			return image;
+		}
+	}
+
+	return NULL;
+}
+
+rom_image* rom_cache_load(const char* path) {
+	u64 length = 0;
+	u64 modified_time = 0;
+	u64 file_id = 0;
+	if (file_stat(path, &length, &modified_time, &file_id) != 0) {
+		return NULL;
+	}
+
+	mutex_lock(&cache_lock);
+	rom_image* image = rom_cache_find_file(path, length, modified_time, file_id);
+	if (image != NULL) {
+		atomic_add(&image->reference_count, 1);
+	}
+	mutex_unlock(&cache_lock);
+
+	if (image != NULL) {
+		return image;
+	}
+
+	// Hashing happens outside the lock, other systems can keep loading meanwhile
+	const u8* data = file_map(path, &length);
+	if (data == NULL) {
+		return NULL;
+	}
+	u32 crc = crc32(data, length);
+
+	mutex_lock(&cache_lock);
+	image = rom_cache_find_contents(data, length, crc);
+	if (image != NULL) {
+		atomic_add(&image->reference_count, 1);
+		mutex_unlock(&cache_lock);
+
+		file_unmap(data, length);
+		return image;
+	}
+
+	image = malloc(sizeof(rom_image));
+	u64 path_length = strlen(path);
+	char* path_copy = malloc(path_length + 1);
+	if (image == NULL || path_copy == NULL) {
+		mutex_unlock(&cache_lock);
+
+		free(image);
+		free(path_copy);
+		file_unmap(data, length);
+		return NULL;
+	}
+	memcpy(path_copy, path, path_length + 1);
+
+	image->reference_count = 1;
+	image->crc32 = crc;
+	image->data = data;
+	image->length = length;
+	image->path = path_copy;
+	image->modified_time = modified_time;
+	image->file_id = file_id;
+	image->next = cache_images;
+	cache_images = image;
+	mutex_unlock(&cache_lock);
+
+	return image;
+}
+
+rom_image* rom_image_retain(rom_image* image) {
+	atomic_add(&image->reference_count, 1);
+	return image;
+}
+
+void rom_image_release(rom_image* image) {
+	if (image == NULL) {
+		return;
+	}
+
+	mutex_lock(&cache_lock);
+	if (atomic_add(&image->reference_count, -1) != 0) {
+		mutex_unlock(&cache_lock);
+		return;
+	}
+
+	rom_image** link = &cache_images;
+	while (*link != image) {
+		link = &(*link)->next;
+	}
+	*link = image->next;
+	mutex_unlock(&cache_lock);
+
+	file_unmap(image->data, image->length);
+	free(image->path);
+	free(image);
+}
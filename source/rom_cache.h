@@ -0,0 +1,29 @@
+#pragma once
+
+#include "types.h"
+
+// A rom file mapped read-only into memory. Every system running the same rom
+// shares one image, found by the CRC32 of the file's contents, and the PRG/CHR
+// banks point straight into the mapping. The image is unmapped once the last
+// system lets go of it.
+typedef struct rom_image {
+	volatile u32 reference_count;
+	u32 crc32;
+	const u8* data;
+	u64 length;
+
+	// File the image was mapped from, loading it again skips the mapping and
+	// hashing as long as it hasn't changed
+	char* path;
+	u64 modified_time;
+	u64 file_id;
+
+	struct rom_image* next;
+} rom_image;
+
+// Maps the rom at `path`, or takes a reference to the image already loaded with
+// the same contents. NULL if the file can't be mapped. Thread safe.
+rom_image* rom_cache_load(const char* path);
+rom_image* rom_image_retain(rom_image* image);
+// NULL is ignored.
+void rom_image_release(rom_image* image);
@@ -0,0 +1,33 @@
+#include "rom_database.h"
+
+#include <stddef.h>
+
+#include "cartridge.h"
+
+// Sorted by CRC32 for the binary search. --rom-info prints the line for a rom,
+// only add dumps that are known to be good (like the ones nes20db lists).
+static const rom_database_entry rom_database[] = {
+	// CRC32     mapper sub  timing            PRG RAM NVRAM CHR RAM NVRAM vertical
+	{ 0x3337EC46, 0, 0, ROM_TIMING_NTSC, 0, 0, 0, 0, 1 }, // Super Mario Bros. (World)
+};
+
+const rom_database_entry* rom_database_find(u32 crc32) {
+	u32 low = 0;
+	u32 high = sizeof(rom_database) / sizeof(rom_database[0]);
+
+	while (low < high) {
+		u32 middle = low + (high - low) / 2;
+		if (rom_database[middle].crc32 < crc32) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+
+	if (low < sizeof(rom_database) / sizeof(rom_database[0]) && rom_database[low].crc32 == crc32) {
+		return &rom_database[low];
+	}
+
+	return NULL;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "types.h"
+
+// Roms whose headers are known to be wrong or missing information, with the
+// configuration the cart really has. Looked up by the CRC32 of the PRG and CHR
+// ROM, so the header itself doesn't matter. RAM sizes are NES 2.0 style shift
+// counts, 64 << shift bytes or 0 for none.
+typedef struct rom_database_entry {
+	u32 crc32;
+	u16 mapper;
+	u8 submapper;
+	u8 timing;
+	u8 prg_ram_shift;
+	u8 prg_nvram_shift;
+	u8 chr_ram_shift;
+	u8 chr_nvram_shift;
+	u8 vertical_mirroring;
+} rom_database_entry;
+
+// NULL if the rom isn't in the database.
+const rom_database_entry* rom_database_find(u32 crc32);
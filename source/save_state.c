@@ -0,0 +1,241 @@
+#include "save_state.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "nes.h"
+#include "memory_bus.h"
+
+// Everything a page table entry can point into
+typedef enum save_state_region_type {
+	REGION_CPU_MEMORY = 1,
+	REGION_PPU_MEMORY,
+	REGION_PRG_ROM,
+	REGION_PRG_RAM,
+	REGION_CHR_ROM,
+	REGION_CHR_RAM,
+	REGION_TESTMODE,
+	// RAM pages still read from a fork's snapshot, they load as the RAM itself
+	REGION_PRG_RAM_SNAPSHOT,
+	REGION_CHR_RAM_SNAPSHOT,
+	REGION_COUNT,
+} save_state_region_type;
+
+typedef struct save_state_region {
+	u8* memory;
+	u32 length;
+} save_state_region;
+
+#define SAVE_STATE_PAGE_COUNT (256 + 256 + 16 + 16)
+
+// Page table entries are stored as the region in the top byte and the offset into it below
+#define SAVE_STATE_REGION_SHIFT 24
+#define SAVE_STATE_OFFSET_MASK 0x00FFFFFF
+
+static void save_state_regions(const nes_system* system, save_state_region regions[REGION_COUNT]) {
+	const cartridge* cart = &system->cartridge;
+
+	regions[0] = (save_state_region){ NULL, 0 };
+	regions[REGION_CPU_MEMORY] = (save_state_region){ (u8*)system->cpu_memory, sizeof(system->cpu_memory) };
+	regions[REGION_PPU_MEMORY] = (save_state_region){ (u8*)system->ppu_memory, sizeof(system->ppu_memory) };
+	regions[REGION_PRG_ROM] = (save_state_region){ cart->prg_rom, cart->prg_rom_length };
+	regions[REGION_PRG_RAM] = (save_state_region){ cart->prg_ram, cart->prg_ram_length };
+	regions[REGION_CHR_ROM] = (save_state_region){ cart->chr_rom, cart->chr_rom_length };
+	regions[REGION_CHR_RAM] = (save_state_region){ cart->chr_ram, cart->chr_ram_length };
+	regions[REGION_TESTMODE] = (save_state_region){ system->testmode_memory, system->testmode_memory != NULL ? 0x10000 : 0 };
+
+	const shared_memory* prg_snapshot = cart->prg_ram_cow.snapshot;
+	const shared_memory* chr_snapshot = cart->chr_ram_cow.snapshot;
+	regions[REGION_PRG_RAM_SNAPSHOT] = (save_state_region){ prg_snapshot ? (u8*)prg_snapshot->data : NULL, prg_snapshot ? prg_snapshot->length : 0 };
+	regions[REGION_CHR_RAM_SNAPSHOT] = (save_state_region){ chr_snapshot ? (u8*)chr_snapshot->data : NULL, chr_snapshot ? chr_snapshot->length : 0 };
+}
+
+// Every page table in one list, CPU read/write then PPU read/write.
+static inline u8** save_state_page(nes_system* system, u32 index) {
+	if (index < 256) {
+		return &system->cpu_read_pages[index];
+	}
+	else if (index < 512) {
+		return &system->cpu_write_pages[index - 256];
+	}
+	else if (index < 528) {
+		return &system->ppu_read_pages[index - 512];
+	}
+	return &system->ppu_write_pages[index - 528];
+}
+
+// Where a write page entry should be saved as pointing. Writes held back for a
+// fork are saved as going where the page reads from, since a loaded state's RAM
+// is all the system's own.
+static const u8* save_state_write_page(nes_system* system, u32 index) {
+	if (index >= 256 && index < 512 && bus_cow_page(system->cpu_cow_pages, index - 256)) {
+		return system->cpu_read_pages[index - 256];
+	}
+	else if (index >= 528 && bus_cow_page(system->ppu_cow_pages, index - 528)) {
+		return system->ppu_read_pages[index - 528];
+	}
+	return *save_state_page(system, index);
+}
+
+// The RAM as the system sees it, pages that weren't copied yet come from the snapshot.
+static void save_state_copy_ram(const cartridge_cow* cow, const u8* memory, u32 length, u8* destination) {
+	memcpy(destination, memory, length);
+
+	if (cow->snapshot != NULL) {
+		for (u32 page = 0; page < length / cow->page_size; page++) {
+			if (!cow->page_copied[page]) {
+				memcpy(destination + page * cow->page_size, cow->snapshot->data + page * cow->page_size, cow->page_size);
+			}
+		}
+	}
+}
+
+static u32 save_state_encode_page(const save_state_region regions[REGION_COUNT], const u8* page) {
+	if (page == NULL) {
+		return 0;
+	}
+
+	uintptr_t address = (uintptr_t)page;
+	for (u32 region = 1; region < REGION_COUNT; region++) {
+		uintptr_t start = (uintptr_t)regions[region].memory;
+		if (start != 0 && address >= start && address < start + regions[region].length) {
+			return (region << SAVE_STATE_REGION_SHIFT) | (u32)(address - start);
+		}
+	}
+
+	return 0;
+}
+
+static u8* save_state_decode_page(const save_state_region regions[REGION_COUNT], u32 location) {
+	u32 region = location >> SAVE_STATE_REGION_SHIFT;
+	u32 offset = location & SAVE_STATE_OFFSET_MASK;
+	if (region == REGION_PRG_RAM_SNAPSHOT) {
+		region = REGION_PRG_RAM;
+	}
+	else if (region == REGION_CHR_RAM_SNAPSHOT) {
+		region = REGION_CHR_RAM;
+	}
+
+	if (region == 0 || region >= REGION_COUNT || regions[region].memory == NULL || offset >= regions[region].length) {
+		return NULL;
+	}
+
+	return regions[region].memory + offset;
+}
+
+u32 nes_save_state_size(const nes_system* system) {
+	return sizeof(save_state_header) + sizeof(nes_system) + SAVE_STATE_PAGE_COUNT * sizeof(u32) +
+		system->cartridge.prg_ram_length + system->cartridge.chr_ram_length;
+}
+
+static void save_state_fill_header(const nes_system* system, save_state_header* header) {
+	memset(header, 0, sizeof(save_state_header));
+	memcpy(header->magic, SAVE_STATE_MAGIC, sizeof(header->magic));
+	header->version = SAVE_STATE_VERSION;
+	header->system_size = sizeof(nes_system);
+
+	const cartridge* cart = &system->cartridge;
+	header->mapper = cart->info.mapper;
+	header->submapper = cart->info.submapper;
+	header->rom_crc32 = cart->info.crc32;
+	header->prg_rom_length = cart->prg_rom_length;
+	header->chr_rom_length = cart->chr_rom_length;
+	header->prg_ram_length = cart->prg_ram_length;
+	header->chr_ram_length = cart->chr_ram_length;
+}
+
+u32 nes_save_state(const nes_system* system, u8* buffer, u32 buffer_size) {
+	u32 size = nes_save_state_size(system);
+	if (buffer_size < size) {
+		return 0;
+	}
+
+	save_state_fill_header(system, (save_state_header*)buffer);
+	u8* position = buffer + sizeof(save_state_header);
+
+	memcpy(position, system, sizeof(nes_system));
+	position += sizeof(nes_system);
+
+	save_state_region regions[REGION_COUNT];
+	save_state_regions(system, regions);
+
+	u32* pages = (u32*)position;
+	for (u32 i = 0; i < SAVE_STATE_PAGE_COUNT; i++) {
+		pages[i] = save_state_encode_page(regions, save_state_write_page((nes_system*)system, i));
+	}
+	position += SAVE_STATE_PAGE_COUNT * sizeof(u32);
+
+	const cartridge* cart = &system->cartridge;
+	if (cart->prg_ram_length > 0) {
+		save_state_copy_ram(&cart->prg_ram_cow, cart->prg_ram, cart->prg_ram_length, position);
+		position += cart->prg_ram_length;
+	}
+	if (cart->chr_ram_length > 0) {
+		save_state_copy_ram(&cart->chr_ram_cow, cart->chr_ram, cart->chr_ram_length, position);
+	}
+
+	return size;
+}
+
+int nes_load_state(nes_system* system, const u8* buffer, u32 buffer_size) {
+	save_state_header expected;
+	save_state_fill_header(system, &expected);
+	if (buffer_size < nes_save_state_size(system) || memcmp(buffer, &expected, sizeof(save_state_header)) != 0) {
+		return -1;
+	}
+
+	const u8* position = buffer + sizeof(save_state_header);
+
+	// What belongs to this system rather than the machine's state. The RAM is
+	// loaded in full, so anything still shared with a fork is let go
+	cartridge cart = system->cartridge;
+	u8* testmode_memory = system->testmode_memory;
+	audio_ring* audio_output = system->apu.output;
+	trace_ring* trace = system->cpu.trace;
+	u32 sample_rate = system->apu.sample_rate;
+	shared_memory_release(cart.prg_ram_cow.snapshot);
+	shared_memory_release(cart.chr_ram_cow.snapshot);
+
+	memcpy(system, position, sizeof(nes_system));
+	position += sizeof(nes_system);
+
+	system->cpu.system = system;
+	system->cpu.trace = trace;
+	system->testmode_memory = testmode_memory;
+	system->cartridge.mapper_functions = cart.mapper_functions;
+	system->cartridge.prg_ram = cart.prg_ram;
+	system->cartridge.prg_rom = cart.prg_rom;
+	system->cartridge.chr_rom = cart.chr_rom;
+	system->cartridge.chr_ram = cart.chr_ram;
+	system->cartridge.prg_ram_block = cart.prg_ram_block;
+	system->cartridge.rom = cart.rom;
+	system->cartridge.save_file = cart.save_file;
+	system->cartridge.save_file_length = cart.save_file_length;
+	system->cartridge.chr_ram_block = cart.chr_ram_block;
+	memset(&system->cartridge.prg_ram_cow, 0, sizeof(cartridge_cow));
+	memset(&system->cartridge.chr_ram_cow, 0, sizeof(cartridge_cow));
+	memset(system->cpu_cow_pages, 0, sizeof(system->cpu_cow_pages));
+	memset(system->ppu_cow_pages, 0, sizeof(system->ppu_cow_pages));
+
+	save_state_region regions[REGION_COUNT];
+	save_state_regions(system, regions);
+
+	const u32* pages = (const u32*)position;
+	for (u32 i = 0; i < SAVE_STATE_PAGE_COUNT; i++) {
+		*save_state_page(system, i) = save_state_decode_page(regions, pages[i]);
+	}
+	position += SAVE_STATE_PAGE_COUNT * sizeof(u32);
+
+	if (cart.prg_ram_length > 0) {
+		memcpy(cart.prg_ram, position, cart.prg_ram_length);
+		position += cart.prg_ram_length;
+	}
+	if (cart.chr_ram_length > 0) {
+		memcpy(cart.chr_ram, position, cart.chr_ram_length);
+	}
+
+	// The synthesis in progress came with the state, it starts over from the loaded cycle
+	apu_set_output(system, audio_output, sample_rate);
+
+	return 0;
+}
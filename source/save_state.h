@@ -0,0 +1,42 @@
+#pragma once
+
+#include "types.h"
+
+typedef struct nes_system nes_system;
+
+// A save state is a header, the nes_system exactly as it's laid out in memory
+// and the cartridge's RAM. Pointers are stored separately as a region and an
+// offset, so a state can be loaded into any system running the same rom. Like
+// the compiled single step tests they're only portable between builds with the
+// same struct layout, which the header checks.
+#define SAVE_STATE_MAGIC "NSAV"
+#define SAVE_STATE_VERSION 4
+
+typedef struct save_state_header {
+	char magic[4];
+	u32 version;
+	u32 system_size;
+
+	// The rom the state belongs to
+	u16 mapper;
+	u8 submapper;
+	u8 unused;
+	u32 rom_crc32;
+	u32 prg_rom_length;
+	u32 chr_rom_length;
+	u32 prg_ram_length;
+	u32 chr_ram_length;
+} save_state_header;
+
+// Size of a state of this system, the same for every state of one rom.
+u32 nes_save_state_size(const nes_system* system);
+
+// Writes the machine into `buffer`, which has to be 8 byte aligned (as malloc's
+// are). Nothing is allocated, so it's fine to call every frame. Returns the
+// amount of bytes written, 0 if the buffer is too small.
+u32 nes_save_state(const nes_system* system, u8* buffer, u32 buffer_size);
+
+// Replaces the machine with a state saved by nes_save_state, returns 0 on success
+// or -1 if the state is from another rom or build. The audio output, test mode
+// memory and loaded rom are the system's own and stay as they are.
+int nes_load_state(nes_system* system, const u8* buffer, u32 buffer_size);
@@ -0,0 +1,110 @@
+#include "scheduler.h"
+
+#include <stdint.h>
+
+#include "nes.h"
+
+void scheduler_init(scheduler* state) {
+	state->count = 0;
+	for (u32 i = 0; i < EVENT_COUNT; i++) {
+		state->position[i] = SCHEDULER_NOT_QUEUED;
+	}
+}
+
+static inline void scheduler_place(scheduler* state, u8 index, scheduler_event event) {
+	state->heap[index] = event;
+	state->position[event.type] = index;
+}
+
+static void scheduler_sift_up(scheduler* state, u8 index) {
+	scheduler_event event = state->heap[index];
+
+	while (index > 0) {
+		u8 parent = (index - 1) / 2;
+		if (state->heap[parent].time <= event.time) {
+			break;
+		}
+
+		scheduler_place(state, index, state->heap[parent]);
+		index = parent;
+	}
+
+	scheduler_place(state, index, event);
+}
+
+static void scheduler_sift_down(scheduler* state, u8 index) {
+	scheduler_event event = state->heap[index];
+
+	while (1) {
+		u8 child = index * 2 + 1;
+		if (child >= state->count) {
+			break;
+		}
+		if (child + 1 < state->count && state->heap[child + 1].time < state->heap[child].time) {
+			child++;
+		}
+		if (event.time <= state->heap[child].time) {
+			break;
+		}
+
+		scheduler_place(state, index, state->heap[child]);
+		index = child;
+	}
+
+	scheduler_place(state, index, event);
+}
+
+static void scheduler_remove(scheduler* state, u8 index) {
+	state->position[state->heap[index].type] = SCHEDULER_NOT_QUEUED;
+	state->count--;
+
+	// The last event fills the hole and moves whichever way it has to
+	if (index < state->count) {
+		scheduler_event moved = state->heap[state->count];
+		scheduler_place(state, index, moved);
+		scheduler_sift_down(state, index);
+		scheduler_sift_up(state, state->position[moved.type]);
+	}
+}
+
+void scheduler_schedule(nes_system* system, scheduler_event_type type, u64 time) {
+	scheduler* state = &system->scheduler;
+
+	u8 index = state->position[type];
+	if (index == SCHEDULER_NOT_QUEUED) {
+		index = state->count++;
+	}
+
+	state->heap[index] = (scheduler_event){ time, type };
+	state->position[type] = index;
+	scheduler_sift_up(state, index);
+	scheduler_sift_down(state, state->position[type]);
+
+	u64 cycle = (time + SCHEDULER_TICKS_PER_CPU_CYCLE - 1) / SCHEDULER_TICKS_PER_CPU_CYCLE;
+	if (cycle < system->cpu_stop_cycle) {
+		system->cpu_stop_cycle = cycle;
+	}
+}
+
+void scheduler_cancel(nes_system* system, scheduler_event_type type) {
+	scheduler* state = &system->scheduler;
+
+	if (state->position[type] != SCHEDULER_NOT_QUEUED) {
+		scheduler_remove(state, state->position[type]);
+	}
+}
+
+scheduler_event_type scheduler_pop_due(scheduler* state, u64 time) {
+	if (state->count == 0 || state->heap[0].time > time) {
+		return EVENT_COUNT;
+	}
+
+	scheduler_event_type type = state->heap[0].type;
+	scheduler_remove(state, 0);
+
+	return type;
+}
+
+u64 scheduler_next_time(const scheduler* state) {
+	return state->count > 0 ? state->heap[0].time : UINT64_MAX;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "types.h"
+
+typedef struct nes_system nes_system;
+
+// Events are timed on the master clock, which the CPU and PPU divide down (NTSC).
+#define SCHEDULER_TICKS_PER_CPU_CYCLE 12
+#define SCHEDULER_TICKS_PER_PPU_DOT 4
+
+typedef enum scheduler_event_type {
+	// Vblank starting or the frame ending, see ppu_next_event
+	EVENT_PPU,
+	EVENT_APU_FRAME_IRQ,
+	// Last byte of a DMC sample being fetched with its IRQ enabled
+	EVENT_APU_DMC_IRQ,
+	// The mapper's IRQ coming due, see mapper_interface.irq_event
+	EVENT_MAPPER_IRQ,
+	// Written $4014 and the DMA is waiting for the write's instruction to end
+	EVENT_OAM_DMA,
+	EVENT_COUNT,
+} scheduler_event_type;
+
+typedef struct scheduler_event {
+	u64 time;
+	u8 type;
+} scheduler_event;
+
+// Min-heap of pending events, every type is in it at most once.
+typedef struct scheduler {
+	scheduler_event heap[EVENT_COUNT];
+	u8 count;
+
+	// Where each type sits in the heap, SCHEDULER_NOT_QUEUED if it isn't
+	u8 position[EVENT_COUNT];
+} scheduler;
+
+#define SCHEDULER_NOT_QUEUED 0xFF
+
+void scheduler_init(scheduler* state);
+
+// Queues the event at `time`, or moves it there if it's already queued. If the
+// CPU is running it stops at the first instruction boundary at or after it.
+void scheduler_schedule(nes_system* system, scheduler_event_type type, u64 time);
+void scheduler_cancel(nes_system* system, scheduler_event_type type);
+
+// Takes the earliest event off the queue if it's due by `time`, otherwise
+// returns EVENT_COUNT.
+scheduler_event_type scheduler_pop_due(scheduler* state, u64 time);
+
+// Time of the earliest event, UINT64_MAX if nothing is queued.
+u64 scheduler_next_time(const scheduler* state);
@@ -0,0 +1,27 @@
+#include "shared_memory.h"
+
+#include <stdlib.h>
+
+#include "thread.h"
+
+shared_memory* shared_memory_create(u32 length) {
+	shared_memory* memory = malloc(sizeof(shared_memory) + length);
+	if (memory == NULL) {
+		return NULL;
+	}
+
+	memory->reference_count = 1;
+	memory->length = length;
+	return memory;
+}
+
+shared_memory* shared_memory_retain(shared_memory* memory) {
+	atomic_add(&memory->reference_count, 1);
+	return memory;
+}
+
+void shared_memory_release(shared_memory* memory) {
+	if (memory != NULL && atomic_add(&memory->reference_count, -1) == 0) {
+		free(memory);
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "types.h"
+
+#include <stddef.h>
+
+// Memory any number of systems can hold on to, freed once the last one lets go.
+// Forked systems share their ROM this way, and their cartridge RAM until they
+// write to it (see nes_fork). The count is atomic so the systems can live on
+// different threads.
+typedef struct shared_memory {
+	volatile u32 reference_count;
+	u32 length;
+	u8 data[];
+} shared_memory;
+
+// Starts out with one reference and uninitialised contents, NULL if allocating failed.
+shared_memory* shared_memory_create(u32 length);
+shared_memory* shared_memory_retain(shared_memory* memory);
+// NULL is ignored.
+void shared_memory_release(shared_memory* memory);
+
+static inline int shared_memory_contains(const shared_memory* memory, const u8* pointer) {
+	return memory != NULL && pointer >= memory->data && pointer < memory->data + memory->length;
+}
@@ -0,0 +1,672 @@
+#include "single_step.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nes.h"
+#include "memory_bus.h"
+#include "cpu.h"
+#include "file.h"
+#include "json_reader.h"
+#include "thread.h"
+
+typedef struct single_step_result {
+	char* path;
+	u8 opcode;
+
+	int load_error;
+	u32 passed;
+	u32 failed;
+	char first_failure[32];
+	char first_failure_reason[192];
+	double seconds;
+} single_step_result;
+
+typedef struct single_step_suite {
+	single_step_result* results;
+	u32 result_count;
+	u32 next_result;
+	int verbose;
+	mutex lock;
+} single_step_suite;
+
+static double seconds_since(const struct timespec* start) {
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+
+	return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Reads the rest of a "[number, ...]" array into `values`, returns the count or -1.
+static int single_step_read_numbers(json_reader* reader, i64* values, u32 max_count) {
+	u32 count = 0;
+
+	json_token token;
+	while ((token = json_reader_next(reader)) == JSON_NUMBER && count < max_count) {
+		values[count++] = reader->number;
+	}
+
+	return token == JSON_ARRAY_END ? (int)count : -1;
+}
+
+// Reads a "[[address, value], ...]" RAM list.
+static int single_step_read_ram(json_reader* reader, single_step_state* state) {
+	if (json_reader_next(reader) != JSON_ARRAY_BEGIN) {
+		return -1;
+	}
+
+	json_token token;
+	while ((token = json_reader_next(reader)) == JSON_ARRAY_BEGIN) {
+		i64 pair[2];
+		if (state->ram_count == SINGLE_STEP_MAX_RAM || single_step_read_numbers(reader, pair, 2) != 2) {
+			return -1;
+		}
+
+		state->ram_address[state->ram_count] = (u16)pair[0];
+		state->ram_value[state->ram_count] = (u8)pair[1];
+		state->ram_count++;
+	}
+
+	return token == JSON_ARRAY_END ? 0 : -1;
+}
+
+// Reads a "[[address, value, "read" or "write"], ...]" cycle list.
+static int single_step_read_cycles(json_reader* reader, single_step_case* test_case) {
+	if (json_reader_next(reader) != JSON_ARRAY_BEGIN) {
+		return -1;
+	}
+
+	json_token token;
+	while ((token = json_reader_next(reader)) == JSON_ARRAY_BEGIN) {
+		if (test_case->cycle_count == SINGLE_STEP_MAX_CYCLES ||
+			json_reader_next(reader) != JSON_NUMBER) {
+			return -1;
+		}
+		single_step_cycle* cycle = &test_case->cycles[test_case->cycle_count++];
+		cycle->address = (u16)reader->number;
+
+		if (json_reader_next(reader) != JSON_NUMBER) {
+			return -1;
+		}
+		cycle->value = (u8)reader->number;
+
+		if (json_reader_next(reader) != JSON_STRING) {
+			return -1;
+		}
+		cycle->is_write = strcmp(reader->string, "write") == 0;
+
+		if (json_reader_next(reader) != JSON_ARRAY_END) {
+			return -1;
+		}
+	}
+
+	return token == JSON_ARRAY_END ? 0 : -1;
+}
+
+static int single_step_read_state(json_reader* reader, single_step_state* state) {
+	if (json_reader_next(reader) != JSON_OBJECT_BEGIN) {
+		return -1;
+	}
+
+	json_token token;
+	while ((token = json_reader_next(reader)) == JSON_KEY) {
+		char key[JSON_READER_STRING_SIZE];
+		memcpy(key, reader->string, sizeof(key));
+
+		if (strcmp(key, "ram") == 0) {
+			if (single_step_read_ram(reader, state) != 0) {
+				return -1;
+			}
+			continue;
+		}
+
+		token = json_reader_next(reader);
+		if (token != JSON_NUMBER) {
+			if (json_reader_skip(reader, token) != 0) {
+				return -1;
+			}
+			continue;
+		}
+
+		if (strcmp(key, "pc") == 0) {
+			state->program_counter = (u16)reader->number;
+		}
+		else if (strcmp(key, "s") == 0) {
+			state->stack_pointer = (u8)reader->number;
+		}
+		else if (strcmp(key, "a") == 0) {
+			state->accumulator = (u8)reader->number;
+		}
+		else if (strcmp(key, "x") == 0) {
+			state->register_x = (u8)reader->number;
+		}
+		else if (strcmp(key, "y") == 0) {
+			state->register_y = (u8)reader->number;
+		}
+		else if (strcmp(key, "p") == 0) {
+			state->status = (u8)reader->number;
+		}
+	}
+
+	return token == JSON_OBJECT_END ? 0 : -1;
+}
+
+// Test files are one big array of cases, this reads the opening bracket.
+static int single_step_open(json_reader* reader, const char* path) {
+	if (json_reader_open(reader, path) != 0) {
+		return -1;
+	}
+
+	if (json_reader_next(reader) != JSON_ARRAY_BEGIN) {
+		json_reader_close(reader);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Decodes the next case, returns 1 if there was one, 0 at the end of the file and -1 on bad data.
+static int single_step_read_case(json_reader* reader, single_step_case* test_case) {
+	json_token token = json_reader_next(reader);
+	if (token == JSON_ARRAY_END) {
+		return 0;
+	}
+	if (token != JSON_OBJECT_BEGIN) {
+		return -1;
+	}
+
+	memset(test_case, 0, sizeof(single_step_case));
+
+	while ((token = json_reader_next(reader)) == JSON_KEY) {
+		int status = 0;
+
+		if (strcmp(reader->string, "name") == 0) {
+			if (json_reader_next(reader) != JSON_STRING) {
+				return -1;
+			}
+			memcpy(test_case->name, reader->string, sizeof(test_case->name) - 1);
+		}
+		else if (strcmp(reader->string, "initial") == 0) {
+			status = single_step_read_state(reader, &test_case->initial);
+		}
+		else if (strcmp(reader->string, "final") == 0) {
+			status = single_step_read_state(reader, &test_case->final);
+		}
+		else if (strcmp(reader->string, "cycles") == 0) {
+			status = single_step_read_cycles(reader, test_case);
+		}
+		else {
+			status = json_reader_skip(reader, json_reader_next(reader));
+		}
+
+		if (status != 0) {
+			return -1;
+		}
+	}
+
+	return token == JSON_OBJECT_END ? 1 : -1;
+}
+
+// Appends a mismatch to the failure reason, only the first few fit which is plenty.
+static void single_step_fail(char* reason, u64 reason_size, const char* format, ...) {
+	char message[96];
+
+	va_list arguments;
+	va_start(arguments, format);
+	vsnprintf(message, sizeof(message), format, arguments);
+	va_end(arguments);
+
+	u64 length = strlen(reason);
+	if (length + 2 < reason_size) {
+		snprintf(reason + length, reason_size - length, "%s%s", length > 0 ? ", " : "", message);
+	}
+}
+
+// Diffs the bus accesses the test bus logged against the expected cycles, only
+// the first difference is reported since everything after it is usually off too.
+static int single_step_check_cycles(const nes_system* system, const single_step_case* test_case, char* reason, u64 reason_size) {
+	u32 count = system->testmode_log_count;
+	if (count > NES_TESTMODE_LOG_SIZE) {
+		count = NES_TESTMODE_LOG_SIZE;
+	}
+
+	for (u32 i = 0; i < count && i < test_case->cycle_count; i++) {
+		const bus_access* is = &system->testmode_log[i];
+		const single_step_cycle* expected = &test_case->cycles[i];
+
+		if (is->address != expected->address || is->value != expected->value || is->is_write != expected->is_write) {
+			single_step_fail(
+				reason, reason_size, "Cycle %u should %s 0x%02X at 0x%04X but %s 0x%02X at 0x%04X", i + 1,
+				expected->is_write ? "write" : "read", expected->value, expected->address,
+				is->is_write ? "writes" : "reads", is->value, is->address
+			);
+			return -1;
+		}
+	}
+
+	if (system->testmode_log_count != test_case->cycle_count) {
+		single_step_fail(reason, reason_size, "Should take %u cycles but took %u", test_case->cycle_count, system->testmode_log_count);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int single_step_run_case(nes_system* system, const single_step_case* test_case, char* reason, u64 reason_size) {
+	const single_step_state* initial = &test_case->initial;
+	const single_step_state* final = &test_case->final;
+
+	// Only the few bytes the last case wrote get cleared, not the whole 64KB
+	cpubus_reset_testmode(system);
+
+	cpu cpu_state;
+	cpu_init(&cpu_state, system);
+
+	cpu_state.program_counter = initial->program_counter;
+	cpu_state.stack_pointer = initial->stack_pointer;
+	cpu_state.accumulator = initial->accumulator;
+	cpu_state.register_x = initial->register_x;
+	cpu_state.register_y = initial->register_y;
+	cpu_state.status.as_byte = initial->status;
+
+	for (u8 i = 0; i < initial->ram_count; i++) {
+		cpubus_write(system, initial->ram_address[i], initial->ram_value[i]);
+	}
+
+	system->testmode_log_count = 0;
+	cpu_execute_instruction(&cpu_state);
+
+	reason[0] = '\0';
+	int passed = 1;
+
+	if (single_step_check_cycles(system, test_case, reason, reason_size) != 0) {
+		passed = 0;
+	}
+
+	if (cpu_state.current_instruction_cycles != test_case->cycle_count) {
+		single_step_fail(reason, reason_size, "Counted %u cycles but should be %u", (u32)cpu_state.current_instruction_cycles, test_case->cycle_count);
+		passed = 0;
+	}
+
+	for (u8 i = 0; i < final->ram_count; i++) {
+		u8 is = cpubus_read(system, final->ram_address[i]);
+		if (is != final->ram_value[i]) {
+			single_step_fail(reason, reason_size, "Ram 0x%04X should be 0x%02X but is 0x%02X", final->ram_address[i], final->ram_value[i], is);
+			passed = 0;
+		}
+	}
+
+	if (final->program_counter != cpu_state.program_counter) {
+		single_step_fail(reason, reason_size, "PC should be 0x%04X but is 0x%04X", final->program_counter, cpu_state.program_counter);
+		passed = 0;
+	}
+
+	if (final->stack_pointer != cpu_state.stack_pointer) {
+		single_step_fail(reason, reason_size, "SP should be 0x%02X but is 0x%02X", final->stack_pointer, cpu_state.stack_pointer);
+		passed = 0;
+	}
+
+	if (final->accumulator != cpu_state.accumulator) {
+		single_step_fail(reason, reason_size, "A should be 0x%02X but is 0x%02X", final->accumulator, cpu_state.accumulator);
+		passed = 0;
+	}
+
+	if (final->register_x != cpu_state.register_x) {
+		single_step_fail(reason, reason_size, "X should be 0x%02X but is 0x%02X", final->register_x, cpu_state.register_x);
+		passed = 0;
+	}
+
+	if (final->register_y != cpu_state.register_y) {
+		single_step_fail(reason, reason_size, "Y should be 0x%02X but is 0x%02X", final->register_y, cpu_state.register_y);
+		passed = 0;
+	}
+
+	if (final->status != cpu_state.status.as_byte) {
+		single_step_fail(reason, reason_size, "Status should be 0x%02X but is 0x%02X", final->status, cpu_state.status.as_byte);
+		passed = 0;
+	}
+
+	return passed;
+}
+
+static void single_step_check_case(nes_system* system, single_step_result* result, const single_step_case* test_case, int verbose) {
+	char reason[192];
+
+	if (single_step_run_case(system, test_case, reason, sizeof(reason))) {
+		result->passed++;
+		return;
+	}
+
+	if (verbose) {
+		printf("Test '%s' failed: %s\n", test_case->name, reason);
+	}
+
+	if (result->failed == 0) {
+		snprintf(result->first_failure, sizeof(result->first_failure), "%s", test_case->name);
+		snprintf(result->first_failure_reason, sizeof(result->first_failure_reason), "%s", reason);
+	}
+	result->failed++;
+}
+
+// Cases are decoded and run one at a time, so memory use doesn't grow with the file.
+static int single_step_run_json(nes_system* system, single_step_result* result, int verbose) {
+	json_reader* reader = malloc(sizeof(json_reader));
+	if (single_step_open(reader, result->path) != 0) {
+		free(reader);
+		return -1;
+	}
+
+	single_step_case test_case;
+	int status;
+
+	while ((status = single_step_read_case(reader, &test_case)) == 1) {
+		single_step_check_case(system, result, &test_case, verbose);
+	}
+
+	json_reader_close(reader);
+	free(reader);
+	return status;
+}
+
+// The counts in a case index its fixed size arrays, a corrupt file mustn't take them past the end.
+static int single_step_case_valid(const single_step_case* test_case) {
+	return test_case->initial.ram_count <= SINGLE_STEP_MAX_RAM &&
+		test_case->final.ram_count <= SINGLE_STEP_MAX_RAM &&
+		test_case->cycle_count <= SINGLE_STEP_MAX_CYCLES;
+}
+
+// Maps a compiled test file, checks its header and every case, and returns the cases.
+static const single_step_case* single_step_map_binary(const char* path, const u8** data, u64* length, u32* case_count) {
+	*data = file_map(path, length);
+	if (*data == NULL) {
+		return NULL;
+	}
+
+	const single_step_binary_header* header = (const single_step_binary_header*)*data;
+	if (*length < sizeof(single_step_binary_header) ||
+		memcmp(header->magic, SINGLE_STEP_BINARY_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != SINGLE_STEP_BINARY_VERSION ||
+		header->case_size != sizeof(single_step_case) ||
+		*length < sizeof(single_step_binary_header) + (u64)header->case_count * sizeof(single_step_case)) {
+		file_unmap(*data, *length);
+		return NULL;
+	}
+
+	const single_step_case* cases = (const single_step_case*)(*data + sizeof(single_step_binary_header));
+	for (u32 i = 0; i < header->case_count; i++) {
+		if (!single_step_case_valid(&cases[i])) {
+			file_unmap(*data, *length);
+			return NULL;
+		}
+	}
+
+	*case_count = header->case_count;
+	return cases;
+}
+
+static int single_step_run_binary(nes_system* system, single_step_result* result, int verbose) {
+	const u8* data;
+	u64 length;
+	u32 case_count;
+
+	const single_step_case* cases = single_step_map_binary(result->path, &data, &length, &case_count);
+	if (cases == NULL) {
+		return -1;
+	}
+
+	for (u32 i = 0; i < case_count; i++) {
+		single_step_check_case(system, result, &cases[i], verbose);
+	}
+
+	file_unmap(data, length);
+	return 0;
+}
+
+static int single_step_is_binary(const char* path) {
+	u64 length = strlen(path);
+	return length >= 4 && strcmp(path + length - 4, ".bin") == 0;
+}
+
+static void single_step_run_result(nes_system* system, single_step_result* result, int verbose) {
+	struct timespec start;
+	timespec_get(&start, TIME_UTC);
+
+	// Every case runs, a failure doesn't stop the rest of the file
+	int status = single_step_is_binary(result->path) ?
+		single_step_run_binary(system, result, verbose) :
+		single_step_run_json(system, result, verbose);
+
+	if (status != 0) {
+		result->load_error = 1;
+	}
+
+	result->seconds = seconds_since(&start);
+}
+
+static int single_step_worker(void* argument) {
+	single_step_suite* suite = argument;
+
+	u8* memory = malloc(0x10000);
+	nes_system* system = malloc(sizeof(nes_system));
+	nes_init_testmode(system, memory);
+	cpubus_set_testmode_logging(system, 1);
+
+	while (1) {
+		mutex_lock(&suite->lock);
+		u32 index = suite->next_result++;
+		mutex_unlock(&suite->lock);
+
+		if (index >= suite->result_count) {
+			break;
+		}
+
+		single_step_run_result(system, &suite->results[index], suite->verbose);
+	}
+
+	nes_free(system);
+	free(system);
+	free(memory);
+	return 0;
+}
+
+// Runs the suite's files on a pool of threads, each worker takes a whole file at
+// a time so loading the vectors is spread over the threads as well.
+static void single_step_run(single_step_suite* suite, u32 thread_count) {
+	mutex_init(&suite->lock);
+	suite->next_result = 0;
+
+	thread* threads = malloc(thread_count * sizeof(thread));
+	u8* started = malloc(thread_count);
+	u32 started_count = 0;
+	for (u32 i = 0; i < thread_count; i++) {
+		started[i] = thread_create(&threads[i], single_step_worker, suite) == 0;
+		started_count += started[i];
+	}
+
+	// The workers share one counter so the ones that did start pick up the slack,
+	// only with none at all does the calling thread have to run the tests itself
+	if (started_count == 0) {
+		printf("Couldn't start any worker threads, running the tests on the main thread.\n");
+		single_step_worker(suite);
+	}
+
+	for (u32 i = 0; i < thread_count; i++) {
+		if (started[i]) {
+			thread_join(&threads[i]);
+		}
+	}
+
+	free(started);
+	free(threads);
+	mutex_destroy(&suite->lock);
+}
+
+int single_step_compile(const char* json_path, const char* binary_path) {
+	json_reader* reader = malloc(sizeof(json_reader));
+	if (single_step_open(reader, json_path) != 0) {
+		printf("Couldn't open test file '%s'.\n", json_path);
+		free(reader);
+		return -1;
+	}
+
+	FILE* file = fopen(binary_path, "wb");
+	if (file == NULL) {
+		printf("Couldn't create '%s'.\n", binary_path);
+		json_reader_close(reader);
+		free(reader);
+		return -1;
+	}
+
+	// The case count goes in once every case is written
+	single_step_binary_header header;
+	memcpy(header.magic, SINGLE_STEP_BINARY_MAGIC, sizeof(header.magic));
+	header.version = SINGLE_STEP_BINARY_VERSION;
+	header.case_size = sizeof(single_step_case);
+	header.case_count = 0;
+	fwrite(&header, sizeof(header), 1, file);
+
+	single_step_case test_case;
+	int status;
+	while ((status = single_step_read_case(reader, &test_case)) == 1) {
+		fwrite(&test_case, sizeof(test_case), 1, file);
+		header.case_count++;
+	}
+
+	rewind(file);
+	fwrite(&header, sizeof(header), 1, file);
+
+	json_reader_close(reader);
+	free(reader);
+
+	if (fclose(file) != 0 || status != 0) {
+		printf("Couldn't compile '%s'.\n", json_path);
+		remove(binary_path);
+		return -1;
+	}
+
+	printf("Compiled %u cases into '%s'.\n", header.case_count, binary_path);
+	return 0;
+}
+
+int single_step_run_file(const char* path) {
+	printf("Running test: %s\n", path);
+
+	single_step_result result;
+	memset(&result, 0, sizeof(result));
+	result.path = (char*)path;
+
+	single_step_suite suite;
+	suite.results = &result;
+	suite.result_count = 1;
+	suite.verbose = 1;
+	single_step_run(&suite, 1);
+
+	if (result.load_error) {
+		printf("Wrong file.\n");
+		return -1;
+	}
+
+	printf("\n%u passed, %u failed in %.3f seconds.\n", result.passed, result.failed, result.seconds);
+	return result.failed == 0 ? 0 : -1;
+}
+
+int single_step_run_suite(const char* directory, u32 thread_count) {
+	u32 file_count = 0;
+	char** files = file_list_directory(directory, &file_count);
+	if (files == NULL) {
+		printf("Couldn't open test directory '%s'.\n", directory);
+		return -1;
+	}
+
+	// Test files are named after their opcode, e.g. "a9.json" or a compiled "a9.bin".
+	// The list is sorted so "a9.bin" comes first and is the one that's run.
+	u8 opcode_seen[256] = { 0 };
+	single_step_result* results = calloc(file_count > 0 ? file_count : 1, sizeof(single_step_result));
+	u32 result_count = 0;
+	u32 skipped = 0;
+
+	for (u32 i = 0; i < file_count; i++) {
+		// strtoul alone would take a sign or leading spaces, like "-1.json"
+		if (!isxdigit((unsigned char)files[i][0]) || !isxdigit((unsigned char)files[i][1])) {
+			continue;
+		}
+
+		char* end = NULL;
+		unsigned long opcode = strtoul(files[i], &end, 16);
+		if (end != files[i] + 2 || (strcmp(end, ".json") != 0 && strcmp(end, ".bin") != 0) || opcode_seen[opcode]) {
+			continue;
+		}
+		opcode_seen[opcode] = 1;
+
+		if (!cpu_opcode_is_official((u8)opcode)) {
+			skipped++;
+			continue;
+		}
+
+		u64 length = strlen(directory) + strlen(files[i]) + 2;
+		results[result_count].path = malloc(length);
+		snprintf(results[result_count].path, length, "%s/%s", directory, files[i]);
+		results[result_count].opcode = (u8)opcode;
+		result_count++;
+	}
+
+	file_list_free(files, file_count);
+
+	if (thread_count == 0) {
+		thread_count = thread_hardware_concurrency();
+	}
+	if (thread_count > result_count && result_count > 0) {
+		thread_count = result_count;
+	}
+
+	printf("Running %u opcodes on %u threads, %u unofficial opcodes skipped.\n", result_count, thread_count, skipped);
+
+	struct timespec start;
+	timespec_get(&start, TIME_UTC);
+
+	single_step_suite suite;
+	suite.results = results;
+	suite.result_count = result_count;
+	suite.verbose = 0;
+	single_step_run(&suite, thread_count);
+
+	double total_seconds = seconds_since(&start);
+
+	u64 total_passed = 0;
+	u64 total_failed = 0;
+	u32 failed_opcodes = 0;
+
+	printf("\n%-7s %-7s %-7s %-8s %s\n", "Opcode", "Passed", "Failed", "Seconds", "First failure");
+	for (u32 i = 0; i < result_count; i++) {
+		single_step_result* result = &results[i];
+
+		if (result->load_error) {
+			printf("%02x      couldn't load '%s'\n", result->opcode, result->path);
+			failed_opcodes++;
+		}
+		else {
+			printf("%02x      %-7u %-7u %-8.3f", result->opcode, result->passed, result->failed, result->seconds);
+			if (result->failed > 0) {
+				printf(" '%s': %s", result->first_failure, result->first_failure_reason);
+				failed_opcodes++;
+			}
+			printf("\n");
+		}
+
+		total_passed += result->passed;
+		total_failed += result->failed;
+		free(result->path);
+	}
+
+	printf(
+		"\n%u/%u opcodes passed, %llu cases passed, %llu failed in %.3f seconds.\n",
+		result_count - failed_opcodes, result_count, total_passed, total_failed, total_seconds
+	);
+
+	free(results);
+	return failed_opcodes == 0 ? 0 : -1;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "types.h"
+
+// Runner for the SingleStepTests nes6502 test vectors
+// (https://github.com/SingleStepTests/65x02/tree/main/nes6502).
+
+#define SINGLE_STEP_MAX_RAM 16
+#define SINGLE_STEP_MAX_CYCLES 8
+
+typedef struct single_step_state {
+	u16 program_counter;
+	u8 stack_pointer;
+	u8 accumulator;
+	u8 register_x, register_y;
+	u8 status;
+
+	u8 ram_count;
+	u16 ram_address[SINGLE_STEP_MAX_RAM];
+	u8 ram_value[SINGLE_STEP_MAX_RAM];
+} single_step_state;
+
+// One bus access the CPU is expected to make.
+typedef struct single_step_cycle {
+	u16 address;
+	u8 value;
+	u8 is_write;
+} single_step_cycle;
+
+typedef struct single_step_case {
+	char name[32];
+	single_step_state initial;
+	single_step_state final;
+
+	u8 cycle_count;
+	single_step_cycle cycles[SINGLE_STEP_MAX_CYCLES];
+} single_step_case;
+
+// Compiled test files are a header followed by `case_count` single_step_case
+// records exactly as they're laid out in memory, so they can be mapped and run
+// without parsing anything. They're only portable between little endian machines.
+#define SINGLE_STEP_BINARY_MAGIC "NSST"
+#define SINGLE_STEP_BINARY_VERSION 1
+
+typedef struct single_step_binary_header {
+	char magic[4];
+	u32 version;
+	u32 case_size;
+	u32 case_count;
+} single_step_binary_header;
+
+// Converts a JSON test file into the compiled format, returns 0 on success.
+int single_step_compile(const char* json_path, const char* binary_path);
+
+// Runs every case in one test file (JSON or compiled) and prints each failing case, returns 0 if all passed.
+int single_step_run_file(const char* path);
+
+// Runs every official opcode's test file in a directory on `thread_count` threads
+// (0 uses every core) and prints a summary table, returns 0 if all passed.
+// A compiled "a9.bin" is used over "a9.json" when both are there.
+int single_step_run_suite(const char* directory, u32 thread_count);
@@ -0,0 +1,106 @@
+#include "thread.h"
+
+#include <stdlib.h>
+
+#ifndef _WIN32
+	#include <unistd.h>
+#endif
+
+typedef struct thread_start {
+	thread_function function;
+	void* argument;
+} thread_start;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_entry(LPVOID parameter) {
+	thread_start start = *(thread_start*)parameter;
+	free(parameter);
+
+	return (DWORD)start.function(start.argument);
+}
+#else
+static void* thread_entry(void* parameter) {
+	thread_start start = *(thread_start*)parameter;
+	free(parameter);
+
+	start.function(start.argument);
+	return NULL;
+}
+#endif
+
+int thread_create(thread* thread, thread_function function, void* argument) {
+	thread_start* start = malloc(sizeof(thread_start));
+	if (start == NULL) {
+		return -1;
+	}
+
+	start->function = function;
+	start->argument = argument;
+
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, thread_entry, start, 0, NULL);
+	if (thread->handle == NULL) {
+		free(start);
+		return -1;
+	}
+#else
+	if (pthread_create(&thread->handle, NULL, thread_entry, start) != 0) {
+		free(start);
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+void thread_join(thread* thread) {
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+}
+
+u32 thread_hardware_concurrency() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (u32)count : 1;
+#endif
+}
+
+void mutex_init(mutex* mutex) {
+#ifdef _WIN32
+	InitializeSRWLock(&mutex->lock);
+#else
+	pthread_mutex_init(&mutex->lock, NULL);
+#endif
+}
+
+void mutex_lock(mutex* mutex) {
+#ifdef _WIN32
+	AcquireSRWLockExclusive(&mutex->lock);
+#else
+	pthread_mutex_lock(&mutex->lock);
+#endif
+}
+
+void mutex_unlock(mutex* mutex) {
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(&mutex->lock);
+#else
+	pthread_mutex_unlock(&mutex->lock);
+#endif
+}
+
+void mutex_destroy(mutex* mutex) {
+#ifdef _WIN32
+	// SRW locks don't need to be destroyed
+#else
+	pthread_mutex_destroy(&mutex->lock);
+#endif
+}
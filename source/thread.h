@@ -0,0 +1,91 @@
+#pragma once
+
+#include "types.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <pthread.h>
+#endif
+
+typedef int (*thread_function)(void* argument);
+
+typedef struct thread {
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+} thread;
+
+typedef struct mutex {
+#ifdef _WIN32
+	SRWLOCK lock;
+#else
+	pthread_mutex_t lock;
+#endif
+} mutex;
+
+// For mutexes with static storage, which don't need mutex_init then
+#ifdef _WIN32
+	#define MUTEX_INITIALIZER { SRWLOCK_INIT }
+#else
+	#define MUTEX_INITIALIZER { PTHREAD_MUTEX_INITIALIZER }
+#endif
+
+int thread_create(thread* thread, thread_function function, void* argument);
+void thread_join(thread* thread);
+u32 thread_hardware_concurrency();
+
+void mutex_init(mutex* mutex);
+void mutex_lock(mutex* mutex);
+void mutex_unlock(mutex* mutex);
+void mutex_destroy(mutex* mutex);
+
+// Loads and stores that order the memory accesses around them, for handing data
+// between two threads without a lock. A store_release makes everything written
+// before it visible to the thread that load_acquires the value it stored.
+static inline u32 atomic_load_acquire(volatile u32* value) {
+#ifdef _WIN32
+	return (u32)InterlockedOr((volatile LONG*)value, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void atomic_store_release(volatile u32* value, u32 new_value) {
+#ifdef _WIN32
+	InterlockedExchange((volatile LONG*)value, (LONG)new_value);
+#else
+	__atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+#endif
+}
+
+// Keeps the loads before it from moving past the loads and stores after it, for
+// checking that data read without a lock wasn't overwritten in the meantime.
+static inline void atomic_fence_acquire() {
+#ifdef _WIN32
+	MemoryBarrier();
+#else
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
+// Swaps in `new_value` and returns what was there, ordered both ways.
+static inline u32 atomic_exchange(volatile u32* value, u32 new_value) {
+#ifdef _WIN32
+	return (u32)InterlockedExchange((volatile LONG*)value, (LONG)new_value);
+#else
+	return __atomic_exchange_n(value, new_value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+// Adds `amount` and returns the new value.
+static inline u32 atomic_add(volatile u32* value, i32 amount) {
+#ifdef _WIN32
+	return (u32)InterlockedExchangeAdd((volatile LONG*)value, amount) + amount;
+#else
+	return __atomic_add_fetch(value, amount, __ATOMIC_ACQ_REL);
+#endif
+}
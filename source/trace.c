@@ -0,0 +1,185 @@
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+
+int trace_ring_init(trace_ring* ring, u32 capacity) {
+	u32 size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	// Zeroed so the padding in the records written to files is too
+	ring->records = calloc(size, sizeof(trace_record));
+	if (ring->records == NULL) {
+		return -1;
+	}
+
+	ring->capacity = size;
+	ring->write_position = 0;
+	ring->read_position = 0;
+	return 0;
+}
+
+void trace_ring_free(trace_ring* ring) {
+	free(ring->records);
+	ring->records = NULL;
+}
+
+u32 trace_ring_read(trace_ring* ring, trace_record* records, u32 count, u64* dropped) {
+	u32 read_position = ring->read_position;
+	u32 write_position = atomic_load_acquire(&ring->write_position);
+
+	// Fell more than a whole ring behind, the oldest ones are gone already
+	if (write_position - read_position > ring->capacity) {
+		*dropped += write_position - ring->capacity - read_position;
+		read_position = write_position - ring->capacity;
+	}
+
+	u32 available = write_position - read_position;
+	if (count > available) {
+		count = available;
+	}
+
+	for (u32 i = 0; i < count; i++) {
+		records[i] = ring->records[(read_position + i) & (ring->capacity - 1)];
+	}
+
+	// The writer kept going during the copy, anything it could have written over
+	// (including the slot it's filling right now) is thrown away
+	atomic_fence_acquire();
+	u32 safe_position = atomic_load_acquire(&ring->write_position) + 1 - ring->capacity;
+	if ((i32)(safe_position - read_position) > 0) {
+		u32 overwritten = safe_position - read_position;
+		if (overwritten > count) {
+			overwritten = count;
+		}
+
+		memmove(records, records + overwritten, (count - overwritten) * sizeof(trace_record));
+		*dropped += overwritten;
+		count -= overwritten;
+		read_position += overwritten;
+	}
+
+	ring->read_position = read_position + count;
+	return count;
+}
+
+i64 trace_ring_drain(trace_ring* ring, FILE* file, u64* dropped) {
+	trace_record records[1024];
+	i64 total = 0;
+
+	u32 count;
+	while ((count = trace_ring_read(ring, records, 1024, dropped)) != 0) {
+		if (fwrite(records, sizeof(trace_record), count, file) != count) {
+			return -1;
+		}
+		total += count;
+	}
+
+	return total;
+}
+
+int trace_write_header(FILE* file) {
+	trace_file_header header;
+	memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_FILE_VERSION;
+	header.record_size = sizeof(trace_record);
+	header.reserved = 0;
+
+	return fwrite(&header, sizeof(header), 1, file) == 1 ? 0 : -1;
+}
+
+// C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+static void trace_format_record(const trace_record* record, char* line, u32 line_size) {
+	char text[32];
+	u32 length = cpu_disassemble(record->program_counter, record->bytes, text, sizeof(text));
+
+	char bytes[16] = "";
+	for (u32 i = 0; i < length; i++) {
+		snprintf(bytes + i * 3, sizeof(bytes) - i * 3, "%02X ", record->bytes[i]);
+	}
+
+	// Unofficial opcodes are marked with a * right in front of the mnemonic,
+	// either way the registers start at column 48
+	char instruction[40];
+	snprintf(instruction, sizeof(instruction), "%s%s", text[0] == '*' ? "" : " ", text);
+
+	snprintf(
+		line, line_size, "%04X  %-9s%-33sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3u,%3u CYC:%llu",
+		record->program_counter, bytes, instruction,
+		record->accumulator, record->register_x, record->register_y, record->status, record->stack_pointer,
+		record->scanline, record->dot, (unsigned long long)record->cycle
+	);
+}
+
+int trace_render(const char* path, FILE* output) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		printf("Couldn't open trace file '%s'.\n", path);
+		return -1;
+	}
+
+	trace_file_header header;
+	if (
+		fread(&header, sizeof(header), 1, file) != 1 ||
+		memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != TRACE_FILE_VERSION ||
+		header.record_size != sizeof(trace_record)
+	) {
+		printf("'%s' isn't a trace file or was written by a different version.\n", path);
+		fclose(file);
+		return -1;
+	}
+
+	trace_record records[1024];
+	char line[128];
+	u64 count;
+	while ((count = fread(records, sizeof(trace_record), 1024, file)) != 0) {
+		for (u64 i = 0; i < count; i++) {
+			trace_format_record(&records[i], line, sizeof(line));
+			fprintf(output, "%s\n", line);
+		}
+	}
+
+	fclose(file);
+	return 0;
+}
+
+int trace_check_format() {
+	// The first lines of nestest.log, a trace diffed against it has to match character for character
+	static const struct {
+		trace_record record;
+		const char* line;
+	} cases[] = {
+		{
+			{ 7, 0xC000, 0, 21, { 0x4C, 0xF5, 0xC5 }, 0x00, 0x00, 0x00, 0x24, 0xFD },
+			"C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7"
+		},
+		{
+			{ 10, 0xC5F5, 0, 30, { 0xA2, 0x00, 0x86 }, 0x00, 0x00, 0x00, 0x24, 0xFD },
+			"C5F5  A2 00     LDX #$00                        A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 30 CYC:10"
+		},
+		{
+			{ 21, 0xC5FD, 0, 63, { 0x20, 0x2D, 0xC7 }, 0x00, 0x00, 0x00, 0x24, 0xFD },
+			"C5FD  20 2D C7  JSR $C72D                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 63 CYC:21"
+		},
+	};
+
+	int return_code = 0;
+	for (u32 i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		char line[128];
+		trace_format_record(&cases[i].record, line, sizeof(line));
+		if (strcmp(line, cases[i].line) != 0) {
+			printf("Expected: %s\nRendered: %s\n", cases[i].line, line);
+			return_code = -1;
+		}
+	}
+
+	if (return_code == 0) {
+		printf("Trace lines match nestest.log.\n");
+	}
+	return return_code;
+}
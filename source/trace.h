@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "types.h"
+#include "thread.h"
+
+// Instruction trace, one fixed size binary record per instruction written by
+// the CPU before it runs the instruction. Formatting is left to --render-trace,
+// so tracing costs little more than the copy.
+
+// The registers before the instruction, 24 bytes with the padding
+typedef struct trace_record {
+	u64 cycle;
+	u16 program_counter;
+	// Where the PPU is when the instruction starts
+	u16 scanline;
+	u16 dot;
+	// The opcode and the two bytes after it, whether it uses them or not
+	u8 bytes[3];
+	u8 accumulator;
+	u8 register_x, register_y;
+	u8 status;
+	u8 stack_pointer;
+} trace_record;
+
+// Trace files are this header followed by the records
+#define TRACE_FILE_MAGIC "NTRC"
+#define TRACE_FILE_VERSION 1
+
+typedef struct trace_file_header {
+	char magic[4];
+	u32 version;
+	u32 record_size;
+	u32 reserved;
+} trace_file_header;
+
+// Written by the emulation thread only and drained by one reader, possibly on
+// another thread. The writer never waits: once the ring is full the oldest
+// records are overwritten, and the reader is told how many it missed.
+typedef struct trace_ring {
+	trace_record* records;
+	// Power of two
+	u32 capacity;
+
+	// Both only ever count up and wrap, each is written by one side only
+	volatile u32 write_position;
+	u32 read_position;
+} trace_ring;
+
+// The capacity is rounded up to a power of two. Returns -1 if it can't be allocated.
+int trace_ring_init(trace_ring* ring, u32 capacity);
+void trace_ring_free(trace_ring* ring);
+
+// The slot for the next record, it's only seen by the reader after trace_ring_commit.
+static inline trace_record* trace_ring_next(trace_ring* ring) {
+	return &ring->records[ring->write_position & (ring->capacity - 1)];
+}
+
+static inline void trace_ring_commit(trace_ring* ring) {
+	atomic_store_release(&ring->write_position, ring->write_position + 1);
+}
+
+// Copies out up to `count` of the oldest records the writer hasn't overwritten
+// yet, returns how many. Records lost since the last read are added to `dropped`.
+u32 trace_ring_read(trace_ring* ring, trace_record* records, u32 count, u64* dropped);
+
+// Reads everything that's in the ring into `file`, returns the amount of records
+// written or -1 if writing failed.
+i64 trace_ring_drain(trace_ring* ring, FILE* file, u64* dropped);
+
+int trace_write_header(FILE* file);
+// Prints the trace file at `path` to `output` in nestest.log's format.
+int trace_render(const char* path, FILE* output);
+// Renders a few records with known nestest.log lines and compares them, returns
+// -1 and prints the difference if any line is off.
+int trace_check_format();